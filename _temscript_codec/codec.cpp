@@ -0,0 +1,634 @@
+// Lossless codec for detector frames.
+//
+// The data is split into blocks, which are compressed independently (in parallel threads).
+// Each block is preconditioned and then compressed by a byte oriented LZ compressor:
+//  * delta (optional): each element is replaced by the difference to its predecessor,
+//    zigzag encoded (small negative differences become small positive numbers)
+//  * bitshuffle: the elements are transposed into bit planes, so the mostly zero high
+//    bits of the differences form long runs of zero bytes
+//
+// Stream format (all numbers little endian):
+//  header:     "BSLZ", version (u8), itemsize (u8), flags (u8), reserved (u8),
+//              size (u64), block size (u32), block count (u32)
+//  table:      compressed size of each block (u32)
+//  blocks:     method (u8, 0: stored, 1: LZ), preconditioned data (stored or compressed)
+//
+// LZ sequences: token (u8, literal count << 4 | match length - 4), [literal count - 15 as
+// 255, ..., rest], literals, offset (u16), [match length - 19 as 255, ..., rest]. The last
+// sequence of a block has literals only.
+
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if PY_MAJOR_VERSION < 3
+#define PyBytes_FromStringAndSize   PyString_FromStringAndSize
+#define PyBytes_AS_STRING           PyString_AS_STRING
+#endif
+
+static const uint8_t  MAGIC[4] = { 'B', 'S', 'L', 'Z' };
+static const uint8_t  VERSION = 1;
+static const size_t   HEADER_SIZE = 24;
+static const uint8_t  FLAG_DELTA = 1;
+static const uint8_t  BLOCK_STORED = 0;
+static const uint8_t  BLOCK_LZ = 1;
+static const size_t   DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+static const size_t   MIN_MATCH = 4;
+static const size_t   MAX_OFFSET = 65535;
+static const size_t   LAST_LITERALS = 8;    // matches end at least this many bytes before the end of the block
+static const int      HASH_BITS = 14;
+static const int      SKIP_SHIFT = 6;       // step size grows in incompressible data
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put64(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get64(const uint8_t* p)
+{
+    return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+//
+// Preconditioning
+//
+
+template<typename U>
+static void deltaEncode(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    const int bits = 8 * sizeof(U);
+    U prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        U value;
+        memcpy(&value, src + i * sizeof(U), sizeof(U));
+        U d = (U)(value - prev);
+        prev = value;
+        U z = (U)((U)(d << 1) ^ (U)(0 - (d >> (bits - 1))));
+        memcpy(dst + i * sizeof(U), &z, sizeof(U));
+    }
+}
+
+template<typename U>
+static void deltaDecode(uint8_t* data, size_t count)
+{
+    U prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        U z;
+        memcpy(&z, data + i * sizeof(U), sizeof(U));
+        U d = (U)((z >> 1) ^ (U)(0 - (z & 1)));
+        prev = (U)(prev + d);
+        memcpy(data + i * sizeof(U), &prev, sizeof(U));
+    }
+}
+
+static void deltaEncode(const uint8_t* src, uint8_t* dst, size_t count, size_t itemsize)
+{
+    switch (itemsize) {
+    case 1:  deltaEncode<uint8_t>(src, dst, count); break;
+    case 2:  deltaEncode<uint16_t>(src, dst, count); break;
+    case 4:  deltaEncode<uint32_t>(src, dst, count); break;
+    default: deltaEncode<uint64_t>(src, dst, count); break;
+    }
+}
+
+static void deltaDecode(uint8_t* data, size_t count, size_t itemsize)
+{
+    switch (itemsize) {
+    case 1:  deltaDecode<uint8_t>(data, count); break;
+    case 2:  deltaDecode<uint16_t>(data, count); break;
+    case 4:  deltaDecode<uint32_t>(data, count); break;
+    default: deltaDecode<uint64_t>(data, count); break;
+    }
+}
+
+// Transpose 8x8 bit matrix (byte i = row i), its own inverse
+static uint64_t transpose8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Bit planes of the first count & ~7 elements, remaining bytes are copied
+static void bitshuffle(const uint8_t* src, uint8_t* dst, size_t size, size_t itemsize)
+{
+    size_t groups = size / itemsize / 8;
+    for (size_t c = 0; c < itemsize; c++) {
+        uint8_t* plane = dst + c * 8 * groups;
+        for (size_t g = 0; g < groups; g++) {
+            const uint8_t* s = src + g * 8 * itemsize + c;
+            uint64_t x = 0;
+            for (int i = 0; i < 8; i++)
+                x |= (uint64_t)s[i * itemsize] << (8 * i);
+            x = transpose8(x);
+            for (int j = 0; j < 8; j++)
+                plane[j * groups + g] = (uint8_t)(x >> (8 * j));
+        }
+    }
+    size_t done = groups * 8 * itemsize;
+    memcpy(dst + done, src + done, size - done);
+}
+
+static void bitunshuffle(const uint8_t* src, uint8_t* dst, size_t size, size_t itemsize)
+{
+    size_t groups = size / itemsize / 8;
+    for (size_t c = 0; c < itemsize; c++) {
+        const uint8_t* plane = src + c * 8 * groups;
+        for (size_t g = 0; g < groups; g++) {
+            uint64_t x = 0;
+            for (int j = 0; j < 8; j++)
+                x |= (uint64_t)plane[j * groups + g] << (8 * j);
+            x = transpose8(x);
+            uint8_t* d = dst + g * 8 * itemsize + c;
+            for (int i = 0; i < 8; i++)
+                d[i * itemsize] = (uint8_t)(x >> (8 * i));
+        }
+    }
+    size_t done = groups * 8 * itemsize;
+    memcpy(dst + done, src + done, size - done);
+}
+
+//
+// LZ compression
+//
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hashSequence(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static bool putLength(uint8_t*& op, const uint8_t* oend, size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        if (op >= oend)
+            return false;
+        *op++ = 255;
+    }
+    if (op >= oend)
+        return false;
+    *op++ = (uint8_t)length;
+    return true;
+}
+
+// Sequence with literals only (match == 0) or literals and match
+static bool putSequence(uint8_t*& op, const uint8_t* oend, const uint8_t* literals, size_t literalCount,
+                        size_t offset, size_t match)
+{
+    if (op >= oend)
+        return false;
+    size_t matchCode = match ? match - MIN_MATCH : 0;
+    uint8_t* token = op++;
+    *token = (uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+    if (literalCount >= 15 && !putLength(op, oend, literalCount - 15))
+        return false;
+    if ((size_t)(oend - op) < literalCount)
+        return false;
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+    if (!match)
+        return true;
+    if (oend - op < 2)
+        return false;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    return matchCode < 15 || putLength(op, oend, matchCode - 15);
+}
+
+// Returns compressed size, 0 if it exceeds capacity
+static size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity, std::vector<uint32_t>& table)
+{
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + capacity;
+    size_t anchor = 0;
+
+    if (size >= LAST_LITERALS + 2 * MIN_MATCH) {
+        table.assign((size_t)1 << HASH_BITS, 0);
+        size_t limit = size - LAST_LITERALS;
+        size_t i = 0;
+        while (i + MIN_MATCH <= limit) {
+            uint32_t seq = read32(src + i);
+            uint32_t h = hashSequence(seq);
+            size_t ref = table[h];
+            table[h] = (uint32_t)(i + 1);       // 0: empty
+            if (ref && i - (ref - 1) <= MAX_OFFSET && read32(src + ref - 1) == seq) {
+                size_t r = ref - 1;
+                size_t length = MIN_MATCH;
+                while (i + length < limit && src[r + length] == src[i + length])
+                    length++;
+                while (i > anchor && r > 0 && src[i - 1] == src[r - 1]) {
+                    i--;
+                    r--;
+                    length++;
+                }
+                if (!putSequence(op, oend, src + anchor, i - anchor, i - r, length))
+                    return 0;
+                i += length;
+                anchor = i;
+            } else
+                i += 1 + ((i - anchor) >> SKIP_SHIFT);
+        }
+    }
+
+    if (!putSequence(op, oend, src + anchor, size - anchor, 0, 0))
+        return 0;
+    return op - dst;
+}
+
+static bool getLength(const uint8_t*& ip, const uint8_t* iend, size_t& length)
+{
+    uint8_t b;
+    do {
+        if (ip >= iend)
+            return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+static bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + size;
+    size_t op = 0;
+
+    for (;;) {
+        if (ip >= iend)
+            return false;
+        uint8_t token = *ip++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !getLength(ip, iend, literalCount))
+            return false;
+        if (literalCount > (size_t)(iend - ip) || literalCount > dstSize - op)
+            return false;
+        memcpy(dst + op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        if (ip == iend)
+            return op == dstSize;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        size_t length = token & 15;
+        if (length == 15 && !getLength(ip, iend, length))
+            return false;
+        length += MIN_MATCH;
+        if (length > dstSize - op)
+            return false;
+        const uint8_t* match = dst + op - offset;
+        if (offset >= length)
+            memcpy(dst + op, match, length);
+        else {
+            for (size_t n = 0; n < length; n++)
+                dst[op + n] = match[n];
+        }
+        op += length;
+    }
+}
+
+//
+// Blocks
+//
+
+struct Layout {
+    size_t  size;
+    size_t  itemsize;
+    size_t  blockSize;
+    size_t  blockCount;
+    bool    delta;
+
+    size_t blockLength(size_t n) const
+    {
+        return std::min(blockSize, size - n * blockSize);
+    }
+};
+
+static void compressBlock(const Layout& layout, const uint8_t* src, size_t n, std::vector<uint8_t>& out,
+                          std::vector<uint8_t>& scratch, std::vector<uint32_t>& table)
+{
+    size_t length = layout.blockLength(n);
+    src += n * layout.blockSize;
+
+    // preconditioned block in out[1...] (stored), LZ compressed into scratch
+    out.resize(1 + length);
+    scratch.resize(length);
+    if (layout.delta) {
+        size_t count = length / layout.itemsize;
+        deltaEncode(src, &scratch[0], count, layout.itemsize);
+        memcpy(&scratch[count * layout.itemsize], src + count * layout.itemsize, length - count * layout.itemsize);
+        bitshuffle(&scratch[0], &out[1], length, layout.itemsize);
+    } else
+        bitshuffle(src, &out[1], length, layout.itemsize);
+
+    size_t compressed = lzCompress(&out[1], length, &scratch[0], length, table);
+    if (compressed > 0 && compressed < length) {
+        out[0] = BLOCK_LZ;
+        memcpy(&out[1], &scratch[0], compressed);
+        out.resize(1 + compressed);
+    } else
+        out[0] = BLOCK_STORED;
+}
+
+static bool decompressBlock(const Layout& layout, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t n,
+                            std::vector<uint8_t>& scratch)
+{
+    size_t length = layout.blockLength(n);
+    dst += n * layout.blockSize;
+    if (srcSize < 1)
+        return false;
+
+    scratch.resize(length);
+    if (src[0] == BLOCK_LZ) {
+        if (!lzDecompress(src + 1, srcSize - 1, &scratch[0], length))
+            return false;
+    } else if (src[0] == BLOCK_STORED && srcSize - 1 == length)
+        memcpy(&scratch[0], src + 1, length);
+    else
+        return false;
+
+    bitunshuffle(&scratch[0], dst, length, layout.itemsize);
+    if (layout.delta)
+        deltaDecode(dst, length / layout.itemsize, layout.itemsize);
+    return true;
+}
+
+// Run task(n, worker) for n = 0..count-1 in up to 'threads' threads (0: number of cores)
+template<typename Task>
+static void runParallel(size_t count, int threads, Task task)
+{
+    size_t workers = threads > 0 ? (size_t)threads : (size_t)std::thread::hardware_concurrency();
+    workers = std::max<size_t>(1, std::min(workers, count));
+    std::atomic<size_t> next(0);
+    auto work = [&](size_t worker) {
+        for (size_t n = next++; n < count; n = next++)
+            task(n, worker);
+    };
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; w++)
+        pool.push_back(std::thread(work, w));
+    work(0);
+    for (size_t w = 0; w < pool.size(); w++)
+        pool[w].join();
+}
+
+static PyObject* compressData(const uint8_t* src, const Layout& layout, int threads)
+{
+    std::vector<std::vector<uint8_t> > blocks(layout.blockCount);
+
+    Py_BEGIN_ALLOW_THREADS
+    size_t workers = threads > 0 ? (size_t)threads : (size_t)std::thread::hardware_concurrency();
+    std::vector<std::vector<uint8_t> > scratch(std::max<size_t>(1, workers));
+    std::vector<std::vector<uint32_t> > tables(scratch.size());
+    runParallel(layout.blockCount, (int)scratch.size(), [&](size_t n, size_t worker) {
+        compressBlock(layout, src, n, blocks[n], scratch[worker], tables[worker]);
+    });
+    Py_END_ALLOW_THREADS
+
+    size_t total = HEADER_SIZE + 4 * layout.blockCount;
+    for (size_t n = 0; n < layout.blockCount; n++)
+        total += blocks[n].size();
+
+    PyObject* result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)total);
+    if (!result)
+        return NULL;
+    uint8_t* op = (uint8_t*)PyBytes_AS_STRING(result);
+    memcpy(op, MAGIC, 4);
+    op[4] = VERSION;
+    op[5] = (uint8_t)layout.itemsize;
+    op[6] = layout.delta ? FLAG_DELTA : 0;
+    op[7] = 0;
+    put64(op + 8, layout.size);
+    put32(op + 16, (uint32_t)layout.blockSize);
+    put32(op + 20, (uint32_t)layout.blockCount);
+    op += HEADER_SIZE;
+    for (size_t n = 0; n < layout.blockCount; n++, op += 4)
+        put32(op, (uint32_t)blocks[n].size());
+    for (size_t n = 0; n < layout.blockCount; n++) {
+        if (!blocks[n].empty())
+            memcpy(op, &blocks[n][0], blocks[n].size());
+        op += blocks[n].size();
+    }
+    return result;
+}
+
+static bool validItemsize(long itemsize)
+{
+    return itemsize == 1 || itemsize == 2 || itemsize == 4 || itemsize == 8;
+}
+
+// Parse header and block table of stream, returns offsets of the blocks (blockCount + 1 entries)
+static bool parseHeader(const uint8_t* src, size_t size, Layout& layout, std::vector<size_t>& offsets)
+{
+    if (size < HEADER_SIZE || memcmp(src, MAGIC, 4) != 0) {
+        PyErr_SetString(PyExc_ValueError, "Not a BSLZ stream");
+        return false;
+    }
+    if (src[4] != VERSION) {
+        PyErr_Format(PyExc_ValueError, "Unsupported BSLZ version: %d", (int)src[4]);
+        return false;
+    }
+    layout.itemsize = src[5];
+    layout.delta = (src[6] & FLAG_DELTA) != 0;
+    uint64_t total = get64(src + 8);
+    layout.blockSize = get32(src + 16);
+    layout.blockCount = get32(src + 20);
+    if (!validItemsize((long)layout.itemsize) || layout.blockSize == 0 || layout.blockSize % layout.itemsize != 0
+            || total > (uint64_t)PY_SSIZE_T_MAX
+            || layout.blockCount != (total + layout.blockSize - 1) / layout.blockSize
+            || layout.blockCount > (size - HEADER_SIZE) / 4) {
+        PyErr_SetString(PyExc_ValueError, "Corrupt BSLZ header");
+        return false;
+    }
+    layout.size = (size_t)total;
+
+    offsets.resize(layout.blockCount + 1);
+    size_t offset = HEADER_SIZE + 4 * layout.blockCount;
+    for (size_t n = 0; n < layout.blockCount; n++) {
+        offsets[n] = offset;
+        offset += get32(src + HEADER_SIZE + 4 * n);
+        if (offset > size) {
+            PyErr_SetString(PyExc_ValueError, "Truncated BSLZ stream");
+            return false;
+        }
+    }
+    offsets[layout.blockCount] = offset;
+    return true;
+}
+
+//
+// Python functions
+//
+
+static PyObject* compress(PyObject* self, PyObject* args, PyObject* kw)
+{
+    static const char* kwlist[] = {"data", "itemsize", "delta", "threads", "block_size", NULL};
+    PyObject* obj;
+    long itemsize = 1;
+    PyObject* deltaObj = Py_True;
+    int threads = 0;
+    Py_ssize_t blockSize = DEFAULT_BLOCK_SIZE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "O|lOin", const_cast<char**>(kwlist), &obj, &itemsize,
+                                     &deltaObj, &threads, &blockSize))
+        return NULL;
+    int delta = PyObject_IsTrue(deltaObj);
+    if (delta < 0)
+        return NULL;
+    if (!validItemsize(itemsize)) {
+        PyErr_SetString(PyExc_ValueError, "Expected itemsize 1, 2, 4 or 8");
+        return NULL;
+    }
+    if (blockSize < 8 * itemsize || blockSize > 0x7fffffff) {
+        PyErr_SetString(PyExc_ValueError, "Invalid block size");
+        return NULL;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+
+    Layout layout;
+    layout.size = (size_t)view.len;
+    layout.itemsize = (size_t)itemsize;
+    layout.blockSize = (size_t)blockSize / (8 * itemsize) * (8 * itemsize);
+    layout.blockCount = (layout.size + layout.blockSize - 1) / layout.blockSize;
+    layout.delta = delta != 0;
+
+    PyObject* result = compressData((const uint8_t*)view.buf, layout, threads);
+    PyBuffer_Release(&view);
+    return result;
+}
+
+static PyObject* decompress(PyObject* self, PyObject* args, PyObject* kw)
+{
+    static const char* kwlist[] = {"data", "out", "threads", NULL};
+    PyObject* obj;
+    PyObject* outObj = Py_None;
+    int threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "O|Oi", const_cast<char**>(kwlist), &obj, &outObj, &threads))
+        return NULL;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+    const uint8_t* src = (const uint8_t*)view.buf;
+
+    Layout layout;
+    std::vector<size_t> offsets;
+    if (!parseHeader(src, (size_t)view.len, layout, offsets)) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    // Output: new bytes object or writeable buffer 'out' of matching size
+    PyObject* result;
+    Py_buffer outView;
+    uint8_t* dst;
+    if (outObj == Py_None) {
+        result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)layout.size);
+        if (!result) {
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        dst = (uint8_t*)PyBytes_AS_STRING(result);
+        outView.obj = NULL;
+    } else {
+        if (PyObject_GetBuffer(outObj, &outView, PyBUF_SIMPLE | PyBUF_WRITABLE) < 0) {
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        if ((size_t)outView.len != layout.size) {
+            PyErr_Format(PyExc_ValueError, "Expected output buffer of %zd bytes", (Py_ssize_t)layout.size);
+            PyBuffer_Release(&outView);
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        Py_INCREF(outObj);
+        result = outObj;
+        dst = (uint8_t*)outView.buf;
+    }
+
+    std::atomic<bool> ok(true);
+    Py_BEGIN_ALLOW_THREADS
+    size_t workers = threads > 0 ? (size_t)threads : (size_t)std::thread::hardware_concurrency();
+    std::vector<std::vector<uint8_t> > scratch(std::max<size_t>(1, workers));
+    runParallel(layout.blockCount, (int)scratch.size(), [&](size_t n, size_t worker) {
+        if (!decompressBlock(layout, src + offsets[n], offsets[n + 1] - offsets[n], dst, n, scratch[worker]))
+            ok = false;
+    });
+    Py_END_ALLOW_THREADS
+
+    if (outView.obj)
+        PyBuffer_Release(&outView);
+    PyBuffer_Release(&view);
+    if (!ok) {
+        Py_DECREF(result);
+        PyErr_SetString(PyExc_ValueError, "Corrupt BSLZ block");
+        return NULL;
+    }
+    return result;
+}
+
+static PyMethodDef methods[] = {
+    {"compress", (PyCFunction)compress, METH_VARARGS | METH_KEYWORDS,
+     "compress(data, itemsize=1, delta=True, threads=0, block_size=262144) -> bytes"},
+    {"decompress", (PyCFunction)decompress, METH_VARARGS | METH_KEYWORDS,
+     "decompress(data, out=None, threads=0) -> bytes (or out)"},
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+#if PY_MAJOR_VERSION >= 3
+
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "_temscript_codec", "Lossless codec for detector frames", -1, methods
+};
+
+extern "C" PyMODINIT_FUNC PyInit__temscript_codec(void)
+{
+    return PyModule_Create(&moduledef);
+}
+
+#else
+
+extern "C" void init_temscript_codec(void)
+{
+    Py_InitModule3("_temscript_codec", methods, "Lossless codec for detector frames");
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include "temscript.h"
+#include "types.h"
+
+#define NO_IMPORT_ARRAY
+#include <numpy/arrayobject.h>
+
+// Accumulation of frames into an int32 or float32 sum. Frames can be added shifted by whole
+// pixels (alignment), pixels shifted out of the frame add nothing. The inner loops run over
+// contiguous rows without branches, so the compiler vectorizes them.
+
+// Source pixel types, from numpy kind and item size
+enum PixelType { PIXEL_NONE, PIXEL_I8, PIXEL_U8, PIXEL_I16, PIXEL_U16, PIXEL_I32, PIXEL_U32, PIXEL_F32, PIXEL_F64 };
+
+static PixelType pixelType(PyArrayObject* array)
+{
+    char kind = PyArray_DESCR(array)->kind;
+    switch (PyArray_ITEMSIZE(array)) {
+    case 1: return kind == 'i' ? PIXEL_I8  : (kind == 'u' ? PIXEL_U8  : PIXEL_NONE);
+    case 2: return kind == 'i' ? PIXEL_I16 : (kind == 'u' ? PIXEL_U16 : PIXEL_NONE);
+    case 4: return kind == 'i' ? PIXEL_I32 : (kind == 'u' ? PIXEL_U32 : (kind == 'f' ? PIXEL_F32 : PIXEL_NONE));
+    case 8: return kind == 'f' ? PIXEL_F64 : PIXEL_NONE;
+    default: return PIXEL_NONE;
+    }
+}
+
+// dst[y][x] += src[y + dy][x + dx] for all pixels inside both frames
+template<typename S, typename D>
+static void addShifted(const S* src, D* dst, long width, long height, long dx, long dy)
+{
+    long x0 = dx < 0 ? -dx : 0, x1 = dx > 0 ? width - dx : width;
+    long y0 = dy < 0 ? -dy : 0, y1 = dy > 0 ? height - dy : height;
+    for (long y = y0; y < y1; y++) {
+        const S* s = src + (y + dy) * width + dx;
+        D* d = dst + y * width;
+        for (long x = x0; x < x1; x++)
+            d[x] += (D)s[x];
+    }
+}
+
+// Mean, minimum and maximum of n pixels
+template<typename S>
+static void frameStats(const S* src, size_t n, double* stats)
+{
+    double sum = 0.0;
+    S lo = src[0], hi = src[0];
+    for (size_t i = 0; i < n; i++) {
+        S v = src[i];
+        sum += (double)v;
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+    }
+    stats[0] = sum / (double)n;
+    stats[1] = (double)lo;
+    stats[2] = (double)hi;
+}
+
+template<typename S, typename D>
+static void addFrame(const S* src, D* dst, long width, long height, long dx, long dy, double* stats)
+{
+    addShifted(src, dst, width, height, dx, dy);
+    frameStats(src, (size_t)width * height, stats);
+}
+
+template<typename D>
+static void addFrame(PixelType type, const void* src, D* dst, long width, long height, long dx, long dy, double* stats)
+{
+    switch (type) {
+    case PIXEL_I8:  addFrame((const npy_int8*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_U8:  addFrame((const npy_uint8*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_I16: addFrame((const npy_int16*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_U16: addFrame((const npy_uint16*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_I32: addFrame((const npy_int32*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_U32: addFrame((const npy_uint32*)src, dst, width, height, dx, dy, stats); break;
+    case PIXEL_F32: addFrame((const npy_float32*)src, dst, width, height, dx, dy, stats); break;
+    default:        addFrame((const npy_float64*)src, dst, width, height, dx, dy, stats); break;
+    }
+}
+
+//
+// FrameAccumulator python type: sum of frames
+//
+
+struct FrameAccumulator {
+    PyObject_HEAD
+    PyObject*       weakRefList;
+    PyArrayObject*  sum;
+    long            count;
+};
+
+// Returns new reference to contiguous 2D array from array-like or AcqImage (unsupported types as double)
+static PyArrayObject* frameArray(PyObject* obj)
+{
+    PyObject* image;
+    if (AcqImage_query(obj))
+        obj = image = PyObject_GetAttrString(obj, "Array");
+    else
+        image = NULL;
+    if (!obj)
+        return NULL;
+
+    PyArrayObject* array = (PyArrayObject*)PyArray_FROMANY(obj, NPY_NOTYPE, 2, 2, NPY_ARRAY_CARRAY_RO);
+    if (array && (pixelType(array) == PIXEL_NONE || !PyArray_ISNOTSWAPPED(array))) {
+        Py_DECREF(array);
+        array = (PyArrayObject*)PyArray_FROMANY(obj, NPY_DOUBLE, 2, 2, NPY_ARRAY_CARRAY_RO);
+    }
+    Py_XDECREF(image);
+    return array;
+}
+
+static int getShift(PyObject* obj, long& value)
+{
+    value = 0;
+    if (!obj || obj == Py_None)
+        return 0;
+    value = PyLong_AsLong(obj);
+    if (value == -1 && PyErr_Occurred())
+        return -1;
+    return 1;
+}
+
+// Keyword arguments of Add
+static const char* addNames[] = { "frame", "dx", "dy" };
+static PyObject* addKeys[3] = { NULL };
+
+static PyObject* FrameAccumulator_Add(FrameAccumulator* self, KEYWORD_ARGS)
+{
+    PyObject* objs[3];
+    long dx, dy;
+
+    if (!internStrings(addNames, addKeys, 3))
+        return NULL;
+    if (!parseOptionalArgs(PASS_KEYWORD_ARGS, addKeys, objs, 3))
+        return NULL;
+    if (!objs[0]) {
+        PyErr_SetString(PyExc_TypeError, "Missing argument: frame");
+        return NULL;
+    }
+    if (getShift(objs[1], dx) < 0 || getShift(objs[2], dy) < 0)
+        return NULL;
+
+    PyArrayObject* array = frameArray(objs[0]);
+    if (!array)
+        return NULL;
+
+    long width = (long)PyArray_DIM(self->sum, 1);
+    long height = (long)PyArray_DIM(self->sum, 0);
+    if (PyArray_DIM(array, 0) != height || PyArray_DIM(array, 1) != width) {
+        Py_DECREF(array);
+        PyErr_Format(PyExc_ValueError, "Expected frame of shape (%d, %d)", (int)height, (int)width);
+        return NULL;
+    }
+
+    PixelType type = pixelType(array);
+    const void* src = PyArray_DATA(array);
+    void* dst = PyArray_DATA(self->sum);
+    bool isFloat = PyArray_TYPE(self->sum) == NPY_FLOAT32;
+    double stats[3] = { 0.0, 0.0, 0.0 };
+
+    Py_BEGIN_ALLOW_THREADS
+    if (width > 0 && height > 0) {
+        if (isFloat)
+            addFrame(type, src, (npy_float32*)dst, width, height, dx, dy, stats);
+        else
+            addFrame(type, src, (npy_int32*)dst, width, height, dx, dy, stats);
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(array);
+    self->count++;
+    return Py_BuildValue("(ddd)", stats[0], stats[1], stats[2]);
+}
+
+static PyObject* FrameAccumulator_Reset(FrameAccumulator* self)
+{
+    memset(PyArray_DATA(self->sum), 0, PyArray_NBYTES(self->sum));
+    self->count = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject* FrameAccumulator_get_Sum(FrameAccumulator* self, void*)
+{
+    Py_INCREF(self->sum);
+    return (PyObject*)self->sum;
+}
+
+static PyObject* FrameAccumulator_get_Count(FrameAccumulator* self, void*)
+{
+    return PyLong_FromLong(self->count);
+}
+
+static PyObject* FrameAccumulator_get_Width(FrameAccumulator* self, void*)
+{
+    return PyLong_FromSsize_t(PyArray_DIM(self->sum, 1));
+}
+
+static PyObject* FrameAccumulator_get_Height(FrameAccumulator* self, void*)
+{
+    return PyLong_FromSsize_t(PyArray_DIM(self->sum, 0));
+}
+
+static PyMethodDef FrameAccumulator_methods[] = {
+    {"Add", (PyCFunction)&FrameAccumulator_Add, METH_KEYWORD_ARGS, "Add frame shifted by (dx, dy), returns (mean, min, max) of frame"},
+    {"Reset", (PyCFunction)&FrameAccumulator_Reset, METH_NOARGS, "Clear sum"},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef FrameAccumulator_getset[] = {
+    {"Sum",     (getter)&FrameAccumulator_get_Sum, NULL, NULL, NULL},
+    {"Count",   (getter)&FrameAccumulator_get_Count, NULL, NULL, NULL},
+    {"Width",   (getter)&FrameAccumulator_get_Width, NULL, NULL, NULL},
+    {"Height",  (getter)&FrameAccumulator_get_Height, NULL, NULL, NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyObject* FrameAccumulator_new(PyTypeObject* type, PyObject* args, PyObject* kw)
+{
+    static const char* kwlist[] = {"height", "width", "dtype", NULL};
+    Py_ssize_t height, width;
+    PyArray_Descr* descr = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "nn|O&", const_cast<char**>(kwlist), &height, &width,
+                                     PyArray_DescrConverter2, &descr))
+        return NULL;
+    int npType = NPY_INT32;
+    if (descr) {
+        bool isInt32 = PyArray_EquivTypenums(descr->type_num, NPY_INT32) != 0;
+        bool isFloat32 = PyArray_EquivTypenums(descr->type_num, NPY_FLOAT32) != 0;
+        Py_DECREF(descr);
+        if (!isInt32 && !isFloat32) {
+            PyErr_SetString(PyExc_ValueError, "Expected dtype int32 or float32");
+            return NULL;
+        }
+        npType = isFloat32 ? NPY_FLOAT32 : NPY_INT32;
+    }
+    if (height < 0 || width < 0) {
+        PyErr_SetString(PyExc_ValueError, "Expected non-negative frame size");
+        return NULL;
+    }
+
+    npy_intp dims[2] = { height, width };
+    PyArrayObject* sum = (PyArrayObject*)PyArray_ZEROS(2, dims, npType, 0);
+    if (!sum)
+        return NULL;
+
+    FrameAccumulator* self = (FrameAccumulator*)type->tp_alloc(type, 0);
+    if (!self) {
+        Py_DECREF(sum);
+        return NULL;
+    }
+    self->weakRefList = NULL;
+    self->sum = sum;
+    self->count = 0;
+    DEBUGF("FrameAccumulator(%p): create\n", self);
+    return (PyObject*)self;
+}
+
+static void FrameAccumulator_dealloc(FrameAccumulator* self)
+{
+    DEBUGF("FrameAccumulator(%p): dealloc\n", self);
+    if (self->weakRefList != NULL)
+        PyObject_ClearWeakRefs((PyObject*)self);
+    Py_XDECREF(self->sum);
+    self->sum = NULL;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyTypeObject FrameAccumulator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "temscript.FrameAccumulator",       /*tp_name*/
+    sizeof(FrameAccumulator),           /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)FrameAccumulator_dealloc, /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash */
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    0,                                  /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                 /*tp_flags*/
+    "FrameAccumulator(height, width, dtype='int32'): sum of frames", /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    offsetof(FrameAccumulator, weakRefList), /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    FrameAccumulator_methods,           /* tp_methods */
+    0,                                  /* tp_members */
+    FrameAccumulator_getset,            /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    0,                                  /* tp_init */
+    0,                                  /* tp_alloc */
+    FrameAccumulator_new                /* tp_new */
+};
@@ -8,6 +8,27 @@ LONG_PROPERTY_GETTER(AcqImage, Height)
 LONG_PROPERTY_GETTER(AcqImage, Depth)
 ARRAY_PROPERTY_GETTER(AcqImage, AsSafeArray)
 
+bool AcqImage_readInto(TEMScripting::AcqImage* iface, PyObject* out)
+{
+    SAFEARRAY* arr = 0;
+    HRESULT result = iface->get_AsSafeArray(&arr);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return false;
+    }
+    bool success = copySafeArrayInto(arr, out);
+    SafeArrayDestroy(arr);
+    return success;
+}
+
+static PyObject* AcqImage_ReadInto(AcqImage* self, PyObject* out)
+{
+    if (!AcqImage_readInto(self->iface, out))
+        return NULL;
+    Py_INCREF(out);
+    return out;
+}
+
 static PyGetSetDef AcqImage_getset[] = {
     {"Name",    (getter)&AcqImage_get_Name, NULL, NULL, NULL},
     {"Width",   (getter)&AcqImage_get_Width, NULL, NULL, NULL},
@@ -17,4 +38,9 @@ static PyGetSetDef AcqImage_getset[] = {
     {NULL}  /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(AcqImage, TEMScripting::AcqImage, AcqImage_getset, 0)
+static PyMethodDef AcqImage_methods[] = {
+    {"ReadInto", (PyCFunction)&AcqImage_ReadInto, METH_O, NULL},
+    {NULL}  /* Sentinel */
+};
+
+IMPLEMENT_WRAPPER(AcqImage, TEMScripting::AcqImage, AcqImage_getset, AcqImage_methods)
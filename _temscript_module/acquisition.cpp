@@ -2,7 +2,16 @@
 #include "defines.h"
 #include "types.h"
 
-static PyObject* Acquisition_get_Cameras(Acquisition *self, void *)
+struct Acquisition {
+    PyObject_HEAD
+    PyObject*                   weakRefList;
+    TEMScripting::Acquisition*  iface;
+    PyObject*                   cameras;    // Cached list of CCDCamera wrappers (or NULL)
+    PyObject*                   detectors;  // Cached list of STEMDetector wrappers (or NULL)
+    PyObject*                   devices;    // Cached dict: device name -> device wrapper (or NULL)
+};
+
+static PyObject* Acquisition_buildCameras(Acquisition *self)
 {
     TEMScripting::CCDCameras* collection;
     
@@ -59,7 +68,7 @@ static PyObject* Acquisition_get_Cameras(Acquisition *self, void *)
     return tuple;
 }
 
-static PyObject* Acquisition_get_Detectors(Acquisition *self, void *)
+static PyObject* Acquisition_buildDetectors(Acquisition *self)
 {
     TEMScripting::STEMDetectors* collection;
     
@@ -132,27 +141,166 @@ static PyObject* Acquisition_get_Detectors(Acquisition *self, void *)
     return tuple;
 }
 
-static PyObject* Acquisition_AddAcqDevice(Acquisition *self, PyObject* args)
+static PyObject* nameFromBSTR(BSTR value)
+{
+    PyObject* strObj = PyUnicode_FromWideChar(value, SysStringLen(value));
+    SysFreeString(value);
+    return strObj;
+}
+
+static PyObject* cameraName(TEMScripting::CCDCamera* camera)
 {
-    if (!args || PySequence_Size(args) != 1) {
-        PyErr_SetString(PyExc_ValueError, "1 argument expected.");
+    TEMScripting::CCDCameraInfo* info;
+    HRESULT result = camera->get_Info(&info);
+    if (FAILED(result)) {
+        raiseComError(result);
         return NULL;
     }
-    PyObject* argObj = PySequence_GetItem(args, 0);
-    if (!argObj)
+
+    BSTR value;
+    result = info->get_Name(&value);
+    info->Release();
+    if (FAILED(result)) {
+        raiseComError(result);
         return NULL;
-    
+    }
+    return nameFromBSTR(value);
+}
+
+static PyObject* detectorName(TEMScripting::STEMDetector* detector)
+{
+    TEMScripting::STEMDetectorInfo* info;
+    HRESULT result = detector->get_Info(&info);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return NULL;
+    }
+
+    BSTR value;
+    result = info->get_Name(&value);
+    info->Release();
+    if (FAILED(result)) {
+        raiseComError(result);
+        return NULL;
+    }
+    return nameFromBSTR(value);
+}
+
+/**
+ * Drop the cached device table. It is rebuilt on next access.
+ */
+static void Acquisition_clearDevices(Acquisition *self)
+{
+    Py_CLEAR(self->cameras);
+    Py_CLEAR(self->detectors);
+    Py_CLEAR(self->devices);
+}
+
+/**
+ * Make sure the device table (camera list, detector list, and name index) is populated.
+ * Return: true, on success
+ */
+static bool Acquisition_updateDevices(Acquisition *self)
+{
+    if (self->devices)
+        return true;
+
+    PyObject* cameras = Acquisition_buildCameras(self);
+    if (!cameras)
+        return false;
+
+    PyObject* detectors = Acquisition_buildDetectors(self);
+    if (!detectors) {
+        Py_DECREF(cameras);
+        return false;
+    }
+
+    PyObject* devices = PyDict_New();
+    if (!devices)
+        goto error;
+
+    for (Py_ssize_t n = 0; n < PyList_GET_SIZE(cameras); n++) {
+        PyObject* obj = PyList_GET_ITEM(cameras, n);
+        PyObject* name = cameraName(CCDCamera_query(obj));
+        if (!name)
+            goto error;
+        int test = PyDict_SetItem(devices, name, obj);
+        Py_DECREF(name);
+        if (test < 0)
+            goto error;
+    }
+
+    for (Py_ssize_t n = 0; n < PyList_GET_SIZE(detectors); n++) {
+        PyObject* obj = PyList_GET_ITEM(detectors, n);
+        PyObject* name = detectorName(STEMDetector_query(obj));
+        if (!name)
+            goto error;
+        int test = PyDict_SetItem(devices, name, obj);
+        Py_DECREF(name);
+        if (test < 0)
+            goto error;
+    }
+
+    self->cameras = cameras;
+    self->detectors = detectors;
+    self->devices = devices;
+    return true;
+
+error:
+    Py_XDECREF(devices);
+    Py_DECREF(detectors);
+    Py_DECREF(cameras);
+    return false;
+}
+
+static PyObject* Acquisition_get_Cameras(Acquisition *self, void *)
+{
+    if (!Acquisition_updateDevices(self))
+        return NULL;
+    return PyList_GetSlice(self->cameras, 0, PyList_GET_SIZE(self->cameras));
+}
+
+static PyObject* Acquisition_get_Detectors(Acquisition *self, void *)
+{
+    if (!Acquisition_updateDevices(self))
+        return NULL;
+    return PyList_GetSlice(self->detectors, 0, PyList_GET_SIZE(self->detectors));
+}
+
+static PyObject* Acquisition_FindDevice(Acquisition *self, PyObject* nameObj)
+{
+    if (!Acquisition_updateDevices(self))
+        return NULL;
+
+    PyObject* device = PyDict_GetItem(self->devices, nameObj);
+    if (!device) {
+        PyErr_SetObject(PyExc_KeyError, nameObj);
+        return NULL;
+    }
+
+    Py_INCREF(device);
+    return device;
+}
+
+static PyObject* Acquisition_InvalidateDevices(Acquisition *self)
+{
+    Acquisition_clearDevices(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Acquisition_AddAcqDevice(Acquisition *self, PyObject* argObj)
+{
     IDispatch* device;
     device = CCDCamera_query(argObj);
     if (!device)
         device = STEMDetector_query(argObj);
     if (!device) {
-        Py_XDECREF(argObj);
         PyErr_SetString(PyExc_TypeError, "Acquisition device expected.");
+        return NULL;
     }
 
+    // argObj keeps reference on device
     HRESULT result = self->iface->raw_AddAcqDevice(device);
-    Py_XDECREF(argObj); // argObj keeps reference on device
     if (FAILED(result)) {
         raiseComError(result);
         return NULL;
@@ -161,18 +309,9 @@ static PyObject* Acquisition_AddAcqDevice(Acquisition *self, PyObject* args)
     Py_RETURN_NONE;
 }
 
-static PyObject* Acquisition_AddAcqDeviceByName(Acquisition *self, PyObject* args)
+static PyObject* Acquisition_AddAcqDeviceByName(Acquisition *self, PyObject* argObj)
 {
-    if (!args || PySequence_Size(args) != 1) {
-        PyErr_SetString(PyExc_ValueError, "1 argument expected.");
-        return NULL;
-    }
-    PyObject* argObj = PySequence_GetItem(args, 0);
-    if (!argObj)
-        return NULL;
-    
     PyObject* nameObj = PyUnicode_FromObject(argObj);
-    Py_XDECREF(argObj);
     if (!nameObj)
         return NULL;
 
@@ -189,27 +328,19 @@ static PyObject* Acquisition_AddAcqDeviceByName(Acquisition *self, PyObject* arg
     Py_RETURN_NONE;
 }
 
-static PyObject* Acquisition_RemoveAcqDevice(Acquisition *self, PyObject* args)
+static PyObject* Acquisition_RemoveAcqDevice(Acquisition *self, PyObject* argObj)
 {
-    if (!args || PySequence_Size(args) != 1) {
-        PyErr_SetString(PyExc_ValueError, "1 argument expected.");
-        return NULL;
-    }
-    PyObject* argObj = PySequence_GetItem(args, 0);
-    if (!argObj)
-        return NULL;
-    
     IDispatch* device;
     device = CCDCamera_query(argObj);
     if (!device)
         device = STEMDetector_query(argObj);
     if (!device) {
-        Py_XDECREF(argObj);
         PyErr_SetString(PyExc_TypeError, "Acquisition device expected.");
+        return NULL;
     }
 
+    // argObj keeps reference on device
     HRESULT result = self->iface->raw_RemoveAcqDevice(device);
-    Py_XDECREF(argObj); // argObj keeps reference on device
     if (FAILED(result)) {
         raiseComError(result);
         return NULL;
@@ -218,18 +349,9 @@ static PyObject* Acquisition_RemoveAcqDevice(Acquisition *self, PyObject* args)
     Py_RETURN_NONE;
 }
 
-static PyObject* Acquisition_RemoveAcqDeviceByName(Acquisition *self, PyObject* args)
+static PyObject* Acquisition_RemoveAcqDeviceByName(Acquisition *self, PyObject* argObj)
 {
-    if (!args || PySequence_Size(args) != 1) {
-        PyErr_SetString(PyExc_ValueError, "1 argument expected.");
-        return NULL;
-    }
-    PyObject* argObj = PySequence_GetItem(args, 0);
-    if (!argObj)
-        return NULL;
-    
     PyObject* nameObj = PyUnicode_FromObject(argObj);
-    Py_XDECREF(argObj);
     if (!nameObj)
         return NULL;
 
@@ -257,8 +379,46 @@ static PyObject* Acquisition_RemoveAllAcqDevices(Acquisition *self)
     Py_RETURN_NONE;
 }
 
-static PyObject* Acquisition_AcquireImages(Acquisition *self)
+/**
+ * Read image into out[image.Name], if *out* contains the name.
+ * Return: true, on success
+ */
+static bool readImageInto(TEMScripting::AcqImage* image, PyObject* out)
 {
+    BSTR value;
+    HRESULT result = image->get_Name(&value);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return false;
+    }
+    PyObject* name = PyUnicode_FromWideChar(value, SysStringLen(value));
+    SysFreeString(value);
+    if (!name)
+        return false;
+
+    PyObject* array = PyDict_GetItem(out, name);     // Borrowed reference
+    Py_DECREF(name);
+    return !array || AcqImage_readInto(image, array);
+}
+
+// Keyword arguments of AcquireImages and AcquireStack
+static const char* acquireNames[] = { "out" };
+static PyObject* acquireKeys[1] = { NULL };
+
+static PyObject* Acquisition_AcquireImages(Acquisition *self, KEYWORD_ARGS)
+{
+    PyObject* out;
+    if (!internStrings(acquireNames, acquireKeys, 1))
+        return NULL;
+    if (!parseOptionalArgs(PASS_KEYWORD_ARGS, acquireKeys, &out, 1))
+        return NULL;
+    if (out == Py_None)
+        out = NULL;
+    if (out && !PyDict_Check(out)) {
+        PyErr_SetString(PyExc_TypeError, "Expected dict of output arrays.");
+        return NULL;
+    }
+
     TEMScripting::AcqImages* collection;
     
     HRESULT result = self->iface->raw_AcquireImages(&collection);
@@ -297,6 +457,13 @@ static PyObject* Acquisition_AcquireImages(Acquisition *self)
             return NULL;
         }
 
+        if (out && !readImageInto(image, out)) {
+            image->Release();
+            collection->Release();
+            Py_XDECREF(tuple);
+            return NULL;
+        }
+
         PyObject* obj = AcqImage_create(image);
         if (!obj) {
             image->Release();
@@ -311,6 +478,133 @@ static PyObject* Acquisition_AcquireImages(Acquisition *self)
     return tuple;
 }
 
+/**
+ * Read name of image into names[index] and its data into (*stack)[index]. The stack
+ * of *count* images is created from the first image, if *stack* is NULL or does not
+ * fit the first image.
+ * Return: true, on success
+ */
+static bool readImageIntoStack(TEMScripting::AcqImage* image, PyObject* names, PyObject** stack,
+                               Py_ssize_t index, Py_ssize_t count)
+{
+    BSTR value;
+    HRESULT result = image->get_Name(&value);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return false;
+    }
+    PyObject* name = nameFromBSTR(value);
+    if (!name)
+        return false;
+    PyTuple_SET_ITEM(names, index, name);
+
+    SAFEARRAY* arr = 0;
+    result = image->get_AsSafeArray(&arr);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return false;
+    }
+    if (*stack && index == 0) {
+        // Preallocated stack of other size, shape or dtype is replaced
+        Py_ssize_t length = PyObject_Length(*stack);
+        if (length < 0) {
+            SafeArrayDestroy(arr);
+            return false;
+        }
+        if (length == count && copySafeArrayIntoStack(arr, *stack, 0)) {
+            SafeArrayDestroy(arr);
+            return true;
+        }
+        if (PyErr_Occurred() && !PyErr_ExceptionMatches(PyExc_ValueError)) {
+            SafeArrayDestroy(arr);
+            return false;
+        }
+        PyErr_Clear();
+        Py_CLEAR(*stack);
+    }
+    if (!*stack)
+        *stack = newStackForSafeArray(arr, count);
+    bool success = *stack && copySafeArrayIntoStack(arr, *stack, index);
+    SafeArrayDestroy(arr);
+    return success;
+}
+
+static PyObject* Acquisition_AcquireStack(Acquisition *self, KEYWORD_ARGS)
+{
+    PyObject* out;
+    if (!internStrings(acquireNames, acquireKeys, 1))
+        return NULL;
+    if (!parseOptionalArgs(PASS_KEYWORD_ARGS, acquireKeys, &out, 1))
+        return NULL;
+    if (out == Py_None)
+        out = NULL;
+
+    TEMScripting::AcqImages* collection;
+
+    HRESULT result = self->iface->raw_AcquireImages(&collection);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return NULL;
+    }
+
+    long count;
+    result = collection->get_Count(&count);
+    if (FAILED(result)) {
+        collection->Release();
+        raiseComError(result);
+        return NULL;
+    }
+    if (count < 0) {
+        collection->Release();
+        PyErr_SetString(PyExc_RuntimeError, "Negative collection size.");
+        return NULL;
+    }
+
+    PyObject* names = PyTuple_New(count);
+    if (!names) {
+        collection->Release();
+        return NULL;
+    }
+    PyObject* stack = out;
+    Py_XINCREF(stack);
+    for (long n = 0; n < count; n++) {
+        TEMScripting::AcqImage* image;
+
+        VARIANT nVariant;
+        VariantInit(&nVariant);
+        nVariant.lVal = n;
+        nVariant.vt   = VT_I4;
+
+        result = collection->get_Item(nVariant, &image);
+        if (FAILED(result)) {
+            collection->Release();
+            Py_XDECREF(stack);
+            Py_DECREF(names);
+            raiseComError(result);
+            return NULL;
+        }
+
+        bool success = readImageIntoStack(image, names, &stack, n, count);
+        image->Release();
+        if (!success) {
+            collection->Release();
+            Py_XDECREF(stack);
+            Py_DECREF(names);
+            return NULL;
+        }
+    }
+    collection->Release();
+
+    if (!stack) {
+        Py_INCREF(Py_None);
+        stack = Py_None;
+    }
+    PyObject* tuple = PyTuple_Pack(2, names, stack);
+    Py_DECREF(stack);
+    Py_DECREF(names);
+    return tuple;
+}
+
 static PyGetSetDef Acquisition_getset[] = {
     {"Cameras",   (getter)&Acquisition_get_Cameras, NULL, NULL, NULL},
     {"Detectors", (getter)&Acquisition_get_Detectors, NULL, NULL, NULL},
@@ -318,13 +612,87 @@ static PyGetSetDef Acquisition_getset[] = {
 };
 
 static PyMethodDef Acquisition_methods[] = {
-    {"AddAcqDevice",            (PyCFunction)&Acquisition_AddAcqDevice, METH_VARARGS, NULL},
-    {"AddAcqDeviceByName",      (PyCFunction)&Acquisition_AddAcqDeviceByName, METH_VARARGS, NULL},
-    {"RemoveAcqDevice",         (PyCFunction)&Acquisition_RemoveAcqDevice, METH_VARARGS, NULL},
-    {"RemoveAcqDeviceByName",   (PyCFunction)&Acquisition_RemoveAcqDeviceByName, METH_VARARGS, NULL},
+    {"AddAcqDevice",            (PyCFunction)&Acquisition_AddAcqDevice, METH_O, NULL},
+    {"AddAcqDeviceByName",      (PyCFunction)&Acquisition_AddAcqDeviceByName, METH_O, NULL},
+    {"RemoveAcqDevice",         (PyCFunction)&Acquisition_RemoveAcqDevice, METH_O, NULL},
+    {"RemoveAcqDeviceByName",   (PyCFunction)&Acquisition_RemoveAcqDeviceByName, METH_O, NULL},
     {"RemoveAllAcqDevices",     (PyCFunction)&Acquisition_RemoveAllAcqDevices, METH_NOARGS, NULL},
-    {"AcquireImages",           (PyCFunction)&Acquisition_AcquireImages, METH_NOARGS, NULL},
+    {"AcquireImages",           (PyCFunction)&Acquisition_AcquireImages, METH_KEYWORD_ARGS, NULL},
+    {"AcquireStack",            (PyCFunction)&Acquisition_AcquireStack, METH_KEYWORD_ARGS, NULL},
+    {"FindDevice",              (PyCFunction)&Acquisition_FindDevice, METH_O, NULL},
+    {"InvalidateDevices",       (PyCFunction)&Acquisition_InvalidateDevices, METH_NOARGS, NULL},
     {NULL}  /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(Acquisition, TEMScripting::Acquisition, Acquisition_getset, Acquisition_methods)
+static void Acquisition_dealloc(Acquisition* self)
+{
+    DEBUGF("Acquisition(%p): dealloc\n", self);
+    if (self->weakRefList != NULL)
+        PyObject_ClearWeakRefs((PyObject*)self);
+    Acquisition_clearDevices(self);
+    self->iface->Release();
+    self->iface = NULL;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyObject* Acquisition_create(TEMScripting::Acquisition* iface)
+{
+    Acquisition* self = PyObject_NEW(Acquisition, &Acquisition_Type);
+    if (self) {
+        self->iface       = iface;
+        self->weakRefList = NULL;
+        self->cameras     = NULL;
+        self->detectors   = NULL;
+        self->devices     = NULL;
+        DEBUGF("Acquisition(%p): create(%p)\n", self, iface);
+    }
+    return (PyObject *)self;
+}
+
+TEMScripting::Acquisition* Acquisition_query(PyObject* self)
+{
+    if (!self || !PyObject_TypeCheck(self, &Acquisition_Type))
+        return NULL;
+    return reinterpret_cast<Acquisition*>(self)->iface;
+}
+
+PyTypeObject Acquisition_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "temscript.Acquisition",            /*tp_name*/
+    sizeof(Acquisition),                /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)Acquisition_dealloc,    /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash */
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    0,                                  /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    0,                                  /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    offsetof(Acquisition, weakRefList), /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    Acquisition_methods,                /* tp_methods */
+    0,                                  /* tp_members */
+    Acquisition_getset,                 /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    0,                                  /* tp_init */
+    0,                                  /* tp_alloc */
+    0                                   /* tp_new */
+};
@@ -36,5 +36,19 @@ static PyGetSetDef CCDAcqParams_getset[] = {
     {NULL}  /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(CCDAcqParams, TEMScripting::CCDAcqParams, CCDAcqParams_getset, 0)
+static PyObject* CCDAcqParams_Apply(CCDAcqParams *self, PyObject* values)
+{
+    if (!PyDict_Check(values)) {
+        PyErr_SetString(PyExc_TypeError, "dict expected.");
+        return NULL;
+    }
+    return applyProperties((PyObject*)self, CCDAcqParams_getset, values);
+}
+
+static PyMethodDef CCDAcqParams_methods[] = {
+    {"Apply",   (PyCFunction)&CCDAcqParams_Apply, METH_O, NULL},
+    {NULL}  /* Sentinel */
+};
+
+IMPLEMENT_WRAPPER(CCDAcqParams, TEMScripting::CCDAcqParams, CCDAcqParams_getset, CCDAcqParams_methods)
 
@@ -22,4 +22,18 @@ static PyGetSetDef CCDCameraInfo_getset[] = {
     {NULL}          /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(CCDCameraInfo, TEMScripting::CCDCameraInfo, CCDCameraInfo_getset, 0)
+static PyObject* CCDCameraInfo_Apply(CCDCameraInfo *self, PyObject* values)
+{
+    if (!PyDict_Check(values)) {
+        PyErr_SetString(PyExc_TypeError, "dict expected.");
+        return NULL;
+    }
+    return applyProperties((PyObject*)self, CCDCameraInfo_getset, values);
+}
+
+static PyMethodDef CCDCameraInfo_methods[] = {
+    {"Apply",   (PyCFunction)&CCDCameraInfo_Apply, METH_O, NULL},
+    {NULL}  /* Sentinel */
+};
+
+IMPLEMENT_WRAPPER(CCDCameraInfo, TEMScripting::CCDCameraInfo, CCDCameraInfo_getset, CCDCameraInfo_methods)
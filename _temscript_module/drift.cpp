@@ -0,0 +1,370 @@
+#include "temscript.h"
+#include "types.h"
+#define NO_IMPORT_ARRAY
+#include <numpy/arrayobject.h>
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+// Phase correlation drift measurement. Frames are converted to double, the mean is subtracted,
+// a separable Hann window is applied (optional), and the frame is zero padded to power of two
+// size for the radix-2 FFT.
+
+typedef std::complex<double> Complex;
+
+static const double PI = 3.14159265358979323846;
+
+static size_t nextPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+// In-place iterative radix-2 FFT of n (power of two) elements, unnormalized
+static void fft(Complex* a, size_t n, bool inverse)
+{
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double angle = 2 * PI / len * (inverse ? 1 : -1);
+        Complex wlen(cos(angle), sin(angle));
+        for (size_t i = 0; i < n; i += len) {
+            Complex w(1.0);
+            for (size_t j = 0; j < len / 2; j++) {
+                Complex u = a[i + j];
+                Complex v = a[i + j + len / 2] * w;
+                a[i + j] = u + v;
+                a[i + j + len / 2] = u - v;
+                w *= wlen;
+            }
+        }
+    }
+}
+
+// 2D FFT of row major width x height array (both powers of two)
+static void fft2(std::vector<Complex>& data, size_t width, size_t height, bool inverse)
+{
+    for (size_t y = 0; y < height; y++)
+        fft(&data[y * width], width, inverse);
+
+    std::vector<Complex> column(height);
+    for (size_t x = 0; x < width; x++) {
+        for (size_t y = 0; y < height; y++)
+            column[y] = data[y * width + x];
+        fft(&column[0], height, inverse);
+        for (size_t y = 0; y < height; y++)
+            data[y * width + x] = column[y];
+    }
+}
+
+static void hannWindow(std::vector<double>& w, size_t n, bool window)
+{
+    w.resize(n);
+    for (size_t i = 0; i < n; i++)
+        w[i] = (window && n > 1) ? 0.5 - 0.5 * cos(2 * PI * i / (n - 1)) : 1.0;
+}
+
+DriftFrame::DriftFrame(size_t width, size_t height, bool window)
+    : width(width), height(height), fftWidth(nextPowerOfTwo(width)), fftHeight(nextPowerOfTwo(height)),
+      window(window)
+{
+}
+
+void DriftFrame::transform(const double* src, std::vector<Complex>& spectrum) const
+{
+    double mean = 0.0;
+    for (size_t i = 0; i < width * height; i++)
+        mean += src[i];
+    mean /= (double)(width * height);
+
+    std::vector<double> wx, wy;
+    hannWindow(wx, width, window);
+    hannWindow(wy, height, window);
+
+    spectrum.assign(fftWidth * fftHeight, Complex(0.0));
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++)
+            spectrum[y * fftWidth + x] = (src[y * width + x] - mean) * wx[x] * wy[y];
+    }
+    fft2(spectrum, fftWidth, fftHeight, false);
+}
+
+// Parabolic fit through three samples, returns offset of vertex in [-0.5, 0.5]
+static double parabolicOffset(double left, double center, double right)
+{
+    double denom = left - 2.0 * center + right;
+    if (denom == 0.0)
+        return 0.0;
+    double delta = 0.5 * (left - right) / denom;
+    if (delta < -0.5) return -0.5;
+    if (delta > 0.5) return 0.5;
+    return delta;
+}
+
+void DriftFrame::correlate(const std::vector<Complex>& reference, const std::vector<Complex>& image,
+                           double* dx, double* dy, double* confidence) const
+{
+    size_t n = fftWidth * fftHeight;
+    std::vector<Complex> cross(n);
+    for (size_t i = 0; i < n; i++) {
+        Complex c = image[i] * std::conj(reference[i]);
+        double mag = std::abs(c);
+        cross[i] = (mag > 1e-300) ? c / mag : Complex(0.0);
+    }
+    fft2(cross, fftWidth, fftHeight, true);
+
+    size_t peak = 0;
+    double peakValue = cross[0].real();
+    for (size_t i = 1; i < n; i++) {
+        if (cross[i].real() > peakValue) {
+            peakValue = cross[i].real();
+            peak = i;
+        }
+    }
+
+    size_t px = peak % fftWidth;
+    size_t py = peak / fftWidth;
+    double left   = cross[py * fftWidth + (px + fftWidth - 1) % fftWidth].real();
+    double right  = cross[py * fftWidth + (px + 1) % fftWidth].real();
+    double top    = cross[((py + fftHeight - 1) % fftHeight) * fftWidth + px].real();
+    double bottom = cross[((py + 1) % fftHeight) * fftWidth + px].real();
+
+    double sx = (double)px + parabolicOffset(left, peakValue, right);
+    double sy = (double)py + parabolicOffset(top, peakValue, bottom);
+    if (sx >= fftWidth / 2.0) sx -= fftWidth;
+    if (sy >= fftHeight / 2.0) sy -= fftHeight;
+
+    *dx = sx;
+    *dy = sy;
+    *confidence = peakValue / (double)n;     // inverse FFT is unnormalized
+}
+
+//
+// DriftKernel python type: phase correlation against cached reference spectrum
+//
+
+struct DriftKernel {
+    PyObject_HEAD
+    PyObject*               weakRefList;
+    DriftFrame*             frame;
+    std::vector<Complex>*   reference;
+    PyThread_type_lock      lock;       // Held while frame and reference are used without the GIL
+};
+
+/**
+ * Acquire the lock of the kernel. If it is held by another thread, wait with
+ * the GIL released (the other thread needs the GIL to finish).
+ */
+static void DriftKernel_lock(DriftKernel* self)
+{
+    if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(self->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+// Returns new reference to 2D double array from array-like or AcqImage
+static PyArrayObject* frameArray(PyObject* obj)
+{
+    PyObject* array;
+    if (AcqImage_query(obj))
+        obj = array = PyObject_GetAttrString(obj, "Array");
+    else
+        array = NULL;
+    if (!obj)
+        return NULL;
+    PyObject* result = PyArray_FROMANY(obj, NPY_DOUBLE, 2, 2, NPY_ARRAY_CARRAY_RO);
+    Py_XDECREF(array);
+    return (PyArrayObject*)result;
+}
+
+static bool DriftKernel_transform(DriftKernel* self, PyArrayObject* array, std::vector<Complex>& spectrum)
+{
+    if ((size_t)PyArray_DIM(array, 0) != self->frame->height || (size_t)PyArray_DIM(array, 1) != self->frame->width) {
+        PyErr_Format(PyExc_ValueError, "Expected frame of shape (%d, %d)", (int)self->frame->height, (int)self->frame->width);
+        return false;
+    }
+    const double* data = (const double*)PyArray_DATA(array);
+    Py_BEGIN_ALLOW_THREADS
+    self->frame->transform(data, spectrum);
+    Py_END_ALLOW_THREADS
+    return true;
+}
+
+static PyObject* DriftKernel_SetReference(DriftKernel* self, PyObject* obj)
+{
+    PyArrayObject* array = frameArray(obj);
+    if (!array)
+        return NULL;
+
+    // A running Measure() uses frame and reference without the GIL
+    DriftKernel_lock(self);
+    DriftFrame* frame = new DriftFrame(PyArray_DIM(array, 1), PyArray_DIM(array, 0), self->frame->window);
+    delete self->frame;
+    self->frame = frame;
+    bool ok = DriftKernel_transform(self, array, *self->reference);
+    PyThread_release_lock(self->lock);
+    Py_DECREF(array);
+    if (!ok)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* DriftKernel_Measure(DriftKernel* self, PyObject* obj)
+{
+    PyArrayObject* array = frameArray(obj);
+    if (!array)
+        return NULL;
+
+    std::vector<Complex> spectrum;
+    DriftKernel_lock(self);
+    bool ok = DriftKernel_transform(self, array, spectrum);
+    Py_DECREF(array);
+    if (!ok) {
+        PyThread_release_lock(self->lock);
+        return NULL;
+    }
+
+    double dx, dy, confidence;
+    Py_BEGIN_ALLOW_THREADS
+    self->frame->correlate(*self->reference, spectrum, &dx, &dy, &confidence);
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(self->lock);
+    return Py_BuildValue("(ddd)", dx, dy, confidence);
+}
+
+static PyObject* DriftKernel_get_Width(DriftKernel* self, void*)
+{
+    return PyLong_FromSize_t(self->frame->width);
+}
+
+static PyObject* DriftKernel_get_Height(DriftKernel* self, void*)
+{
+    return PyLong_FromSize_t(self->frame->height);
+}
+
+static PyObject* DriftKernel_get_Window(DriftKernel* self, void*)
+{
+    return PyBool_FromLong(self->frame->window);
+}
+
+static PyMethodDef DriftKernel_methods[] = {
+    {"SetReference", (PyCFunction)&DriftKernel_SetReference, METH_O, "Replace reference frame"},
+    {"Measure", (PyCFunction)&DriftKernel_Measure, METH_O, "Returns (dx, dy, confidence) of frame relative to reference"},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DriftKernel_getset[] = {
+    {"Width",   (getter)&DriftKernel_get_Width, NULL, NULL, NULL},
+    {"Height",  (getter)&DriftKernel_get_Height, NULL, NULL, NULL},
+    {"Window",  (getter)&DriftKernel_get_Window, NULL, NULL, NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyObject* DriftKernel_new(PyTypeObject* type, PyObject* args, PyObject* kw)
+{
+    static const char* kwlist[] = {"reference", "window", NULL};
+    PyObject* obj;
+    PyObject* windowObj = Py_True;
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", const_cast<char**>(kwlist), &obj, &windowObj))
+        return NULL;
+    int window = PyObject_IsTrue(windowObj);
+    if (window < 0)
+        return NULL;
+
+    PyArrayObject* array = frameArray(obj);
+    if (!array)
+        return NULL;
+
+    DriftKernel* self = (DriftKernel*)type->tp_alloc(type, 0);
+    if (!self) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    self->weakRefList = NULL;
+    self->frame = new DriftFrame(PyArray_DIM(array, 1), PyArray_DIM(array, 0), window != 0);
+    self->reference = new std::vector<Complex>();
+    self->lock = PyThread_allocate_lock();
+    if (!self->lock) {
+        Py_DECREF(array);
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    bool ok = DriftKernel_transform(self, array, *self->reference);
+    Py_DECREF(array);
+    if (!ok) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    DEBUGF("DriftKernel(%p): create\n", self);
+    return (PyObject*)self;
+}
+
+static void DriftKernel_dealloc(DriftKernel* self)
+{
+    DEBUGF("DriftKernel(%p): dealloc\n", self);
+    if (self->weakRefList != NULL)
+        PyObject_ClearWeakRefs((PyObject*)self);
+    delete self->frame;
+    self->frame = NULL;
+    delete self->reference;
+    self->reference = NULL;
+    if (self->lock) {
+        PyThread_free_lock(self->lock);
+        self->lock = NULL;
+    }
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyTypeObject DriftKernel_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "temscript.DriftKernel",            /*tp_name*/
+    sizeof(DriftKernel),                /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)DriftKernel_dealloc,    /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash */
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    0,                                  /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                 /*tp_flags*/
+    "DriftKernel(reference, window=True): phase correlation drift measurement", /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    offsetof(DriftKernel, weakRefList), /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    DriftKernel_methods,                /* tp_methods */
+    0,                                  /* tp_members */
+    DriftKernel_getset,                 /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    0,                                  /* tp_init */
+    0,                                  /* tp_alloc */
+    DriftKernel_new                     /* tp_new */
+};
@@ -0,0 +1,83 @@
+#include "temscript.h"
+#include "enumnames.h"
+
+#if PY_MAJOR_VERSION >= 3
+#define InternFromString    PyUnicode_InternFromString
+#else
+#define InternFromString    PyString_InternFromString
+#define PyLong_FromLong     PyInt_FromLong
+#endif
+
+/**
+ * Add table 'table' to dict 'names' (value -> interned name) and 'values' (name -> value).
+ * Return: true, on success
+ */
+static bool addEnumTable(PyObject* names, PyObject* values, const EnumTable& table)
+{
+    PyObject* byValue = PyDict_New();
+    PyObject* byName = PyDict_New();
+    if (!byValue || !byName)
+        goto error;
+
+    for (size_t n = 0; n < table.count; n++) {
+        const EnumName& entry = table.names[n];
+        PyObject* value = PyLong_FromLong(entry.value);
+        PyObject* name = InternFromString(entry.name);
+        int test = -1;
+        if (value && name) {
+            test = PyDict_SetItem(byName, name, value);
+            if (test == 0 && !entry.alias)
+                test = PyDict_SetItem(byValue, value, name);
+        }
+        Py_XDECREF(value);
+        Py_XDECREF(name);
+        if (test < 0)
+            goto error;
+    }
+
+    if (PyDict_SetItemString(names, table.typeName, byValue) < 0)
+        goto error;
+    if (PyDict_SetItemString(values, table.typeName, byName) < 0)
+        goto error;
+    Py_DECREF(byValue);
+    Py_DECREF(byName);
+    return true;
+
+error:
+    Py_XDECREF(byValue);
+    Py_XDECREF(byName);
+    return false;
+}
+
+/**
+ * Add the enum name tables as module attributes:
+ *  EnumNames:  dict enum type name -> dict value -> interned name
+ *  EnumValues: dict enum type name -> dict name -> value (including aliases)
+ * Return: true, on success
+ */
+bool addEnumNames(PyObject* module)
+{
+    PyObject* names = PyDict_New();
+    PyObject* values = PyDict_New();
+    if (!names || !values)
+        goto error;
+
+    for (size_t n = 0; n < sizeof(enumTables) / sizeof(EnumTable); n++) {
+        if (!addEnumTable(names, values, enumTables[n]))
+            goto error;
+    }
+
+    // PyModule_AddObject steals the references
+    if (PyModule_AddObject(module, "EnumNames", names) < 0) {
+        Py_DECREF(values);
+        return false;
+    }
+    if (PyModule_AddObject(module, "EnumValues", values) < 0)
+        return false;
+    return true;
+
+error:
+    Py_XDECREF(names);
+    Py_XDECREF(values);
+    return false;
+}
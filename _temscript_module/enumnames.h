@@ -0,0 +1,195 @@
+// Generated by generate_enumnames.py from temscript/enums.py - do not edit
+#ifndef ENUMNAMES_INC
+#define ENUMNAMES_INC
+
+#include <stddef.h>
+
+struct EnumName {
+    long        value;
+    const char* name;
+    bool        alias;      // only valid for name -> value lookup
+};
+
+struct EnumTable {
+    const char*     typeName;
+    const EnumName* names;
+    size_t          count;
+};
+
+static constexpr EnumName DetectorType_names[] = {
+    {1, "CAMERA", false},
+    {2, "STEM_DETECTOR", false},
+};
+
+static constexpr EnumName VacuumStatus_names[] = {
+    {1, "UNKNOWN", false},
+    {2, "OFF", false},
+    {3, "CAMERA_AIR", false},
+    {4, "BUSY", false},
+    {5, "READY", false},
+    {6, "ELSE", false},
+};
+
+static constexpr EnumName GaugeStatus_names[] = {
+    {0, "UNDEFINED", false},
+    {1, "UNDERFLOW", false},
+    {2, "OVERFLOW", false},
+    {3, "INVALID", false},
+    {4, "VALID", false},
+};
+
+static constexpr EnumName GaugePressureLevel_names[] = {
+    {0, "UNDEFINED", false},
+    {1, "LOW", false},
+    {2, "LOW_MEDIUM", false},
+    {3, "MEDIUM_HIGH", false},
+    {4, "HIGH", false},
+};
+
+static constexpr EnumName StageStatus_names[] = {
+    {0, "READY", false},
+    {1, "DISABLE", false},
+    {2, "NOT_READY", false},
+    {3, "GOING", false},
+    {4, "MOVING", false},
+    {5, "WOBBLING", false},
+};
+
+static constexpr EnumName StageHolderType_names[] = {
+    {0, "NONE", false},
+    {1, "SINGLE_TILT", false},
+    {2, "DOUBLE_TILT", false},
+    {4, "INVALID", false},
+    {5, "POLARA", false},
+    {6, "DUAL_AXIS", false},
+};
+
+static constexpr EnumName IlluminationNormalization_names[] = {
+    {1, "SPOTSIZE", false},
+    {2, "INTENSITY", false},
+    {3, "CONDENSER", false},
+    {4, "MINI_CONDENSER", false},
+    {5, "OBJECTIVE", false},
+    {6, "ALL", false},
+};
+
+static constexpr EnumName IlluminationMode_names[] = {
+    {0, "NANOPROBE", false},
+    {1, "MICROPROBE", false},
+};
+
+static constexpr EnumName DarkFieldMode_names[] = {
+    {1, "OFF", false},
+    {2, "CARTESIAN", false},
+    {3, "CONICAL", false},
+};
+
+static constexpr EnumName CondenserMode_names[] = {
+    {0, "PARALLEL", false},
+    {1, "PROBE", false},
+};
+
+static constexpr EnumName ProjectionNormalization_names[] = {
+    {10, "OBJECTIVE", false},
+    {11, "PROJECTOR", false},
+    {12, "ALL", false},
+};
+
+static constexpr EnumName ProjectionMode_names[] = {
+    {1, "IMAGING", false},
+    {2, "DIFFRACTION", false},
+};
+
+static constexpr EnumName ProjectionSubMode_names[] = {
+    {1, "LM", false},
+    {2, "M", false},
+    {3, "SA", false},
+    {4, "MH", false},
+    {5, "LAD", false},
+    {6, "D", false},
+};
+
+static constexpr EnumName LensProg_names[] = {
+    {1, "REGULAR", false},
+    {2, "EFTEM", false},
+};
+
+static constexpr EnumName ProjectionDetectorShift_names[] = {
+    {0, "ON_AXIS", false},
+    {1, "NEAR_AXIS", false},
+    {2, "OFF_AXIS", false},
+};
+
+static constexpr EnumName ProjDetectorShiftMode_names[] = {
+    {1, "AUTO_IGNORE", false},
+    {2, "MANUAL", false},
+    {3, "ALIGNMENT", false},
+};
+
+static constexpr EnumName HighTensionState_names[] = {
+    {1, "DISABLED", false},
+    {2, "OFF", false},
+    {3, "ON", false},
+};
+
+static constexpr EnumName InstrumentMode_names[] = {
+    {0, "TEM", false},
+    {1, "STEM", false},
+};
+
+static constexpr EnumName AcqShutterMode_names[] = {
+    {0, "PRE_SPECIMEN", false},
+    {1, "POST_SPECIMEN", false},
+    {2, "BOTH", false},
+};
+
+static constexpr EnumName AcqImageSize_names[] = {
+    {0, "FULL", false},
+    {1, "HALF", false},
+    {2, "QUARTER", false},
+};
+
+static constexpr EnumName AcqImageCorrection_names[] = {
+    {0, "UNPROCESSED", false},
+    {1, "DEFAULT", false},
+};
+
+static constexpr EnumName AcqExposureMode_names[] = {
+    {0, "NONE", false},
+    {1, "SIMULTANEOUS", false},
+    {2, "PRE_EXPOSURE", false},
+    {3, "PRE_EXPOSURE_PAUSE", false},
+};
+
+static constexpr EnumName ProductFamily_names[] = {
+    {0, "TECNAI", false},
+    {1, "TITAN", false},
+};
+
+static constexpr EnumTable enumTables[] = {
+    {"DetectorType", DetectorType_names, sizeof(DetectorType_names) / sizeof(EnumName)},
+    {"VacuumStatus", VacuumStatus_names, sizeof(VacuumStatus_names) / sizeof(EnumName)},
+    {"GaugeStatus", GaugeStatus_names, sizeof(GaugeStatus_names) / sizeof(EnumName)},
+    {"GaugePressureLevel", GaugePressureLevel_names, sizeof(GaugePressureLevel_names) / sizeof(EnumName)},
+    {"StageStatus", StageStatus_names, sizeof(StageStatus_names) / sizeof(EnumName)},
+    {"StageHolderType", StageHolderType_names, sizeof(StageHolderType_names) / sizeof(EnumName)},
+    {"IlluminationNormalization", IlluminationNormalization_names, sizeof(IlluminationNormalization_names) / sizeof(EnumName)},
+    {"IlluminationMode", IlluminationMode_names, sizeof(IlluminationMode_names) / sizeof(EnumName)},
+    {"DarkFieldMode", DarkFieldMode_names, sizeof(DarkFieldMode_names) / sizeof(EnumName)},
+    {"CondenserMode", CondenserMode_names, sizeof(CondenserMode_names) / sizeof(EnumName)},
+    {"ProjectionNormalization", ProjectionNormalization_names, sizeof(ProjectionNormalization_names) / sizeof(EnumName)},
+    {"ProjectionMode", ProjectionMode_names, sizeof(ProjectionMode_names) / sizeof(EnumName)},
+    {"ProjectionSubMode", ProjectionSubMode_names, sizeof(ProjectionSubMode_names) / sizeof(EnumName)},
+    {"LensProg", LensProg_names, sizeof(LensProg_names) / sizeof(EnumName)},
+    {"ProjectionDetectorShift", ProjectionDetectorShift_names, sizeof(ProjectionDetectorShift_names) / sizeof(EnumName)},
+    {"ProjDetectorShiftMode", ProjDetectorShiftMode_names, sizeof(ProjDetectorShiftMode_names) / sizeof(EnumName)},
+    {"HighTensionState", HighTensionState_names, sizeof(HighTensionState_names) / sizeof(EnumName)},
+    {"InstrumentMode", InstrumentMode_names, sizeof(InstrumentMode_names) / sizeof(EnumName)},
+    {"AcqShutterMode", AcqShutterMode_names, sizeof(AcqShutterMode_names) / sizeof(EnumName)},
+    {"AcqImageSize", AcqImageSize_names, sizeof(AcqImageSize_names) / sizeof(EnumName)},
+    {"AcqImageCorrection", AcqImageCorrection_names, sizeof(AcqImageCorrection_names) / sizeof(EnumName)},
+    {"AcqExposureMode", AcqExposureMode_names, sizeof(AcqExposureMode_names) / sizeof(EnumName)},
+    {"ProductFamily", ProductFamily_names, sizeof(ProductFamily_names) / sizeof(EnumName)},
+};
+
+#endif // ENUMNAMES_INC
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+"""
+Generate enumnames.h (constexpr name tables of the enums in temscript/enums.py).
+
+Run by setup.py before building the _temscript module, run manually after changing the enums:
+
+    python _temscript_module/generate_enumnames.py
+"""
+from __future__ import print_function
+import os.path
+import sys
+import types
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+
+def load_enums():
+    """Import temscript.enums without temscript/__init__.py (which needs the native module)"""
+    saved = sys.modules.get("temscript")
+    package = types.ModuleType("temscript")
+    package.__path__ = [os.path.join(ROOT, "temscript")]
+    sys.modules["temscript"] = package
+    try:
+        import temscript.enums as enums
+        return enums
+    finally:
+        if saved is not None:
+            sys.modules["temscript"] = saved
+        else:
+            del sys.modules["temscript"]
+
+
+def generate(enums):
+    lines = [
+        "// Generated by generate_enumnames.py from temscript/enums.py - do not edit",
+        "#ifndef ENUMNAMES_INC",
+        "#define ENUMNAMES_INC",
+        "",
+        "#include <stddef.h>",
+        "",
+        "struct EnumName {",
+        "    long        value;",
+        "    const char* name;",
+        "    bool        alias;      // only valid for name -> value lookup",
+        "};",
+        "",
+        "struct EnumTable {",
+        "    const char*     typeName;",
+        "    const EnumName* names;",
+        "    size_t          count;",
+        "};",
+        "",
+    ]
+    for type_name in enums.__all__:
+        enum_type = getattr(enums, type_name)
+        lines.append("static constexpr EnumName %s_names[] = {" % type_name)
+        for name, member in enum_type.__members__.items():
+            alias = member.name != name
+            lines.append('    {%d, "%s", %s},' % (int(member), name, "true" if alias else "false"))
+        lines.append("};")
+        lines.append("")
+    lines.append("static constexpr EnumTable enumTables[] = {")
+    for type_name in enums.__all__:
+        lines.append('    {"%s", %s_names, sizeof(%s_names) / sizeof(EnumName)},' % (type_name, type_name, type_name))
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif // ENUMNAMES_INC")
+    return "\n".join(lines) + "\n"
+
+
+def main(output=None):
+    if output is None:
+        output = os.path.join(HERE, "enumnames.h")
+    content = generate(load_enums())
+    # keep timestamp (no rebuild) if unchanged
+    try:
+        with open(output) as fp:
+            if fp.read() == content:
+                return
+    except IOError:
+        pass
+    with open(output, "w") as fp:
+        fp.write(content)
+    print("Generated %s" % output)
+
+
+if __name__ == '__main__':
+    main(*sys.argv[1:])
@@ -33,10 +33,10 @@ DOUBLE_PROPERTY_SETTER(Illumination, StemMagnification)
 DOUBLE_PROPERTY_GETTER(Illumination, StemRotation)
 DOUBLE_PROPERTY_SETTER(Illumination, StemRotation)
 
-static PyObject* Illumination_Normalize(Illumination *self, PyObject* args)
+static PyObject* Illumination_Normalize(Illumination *self, PyObject* arg)
 {
-    long norm;
-    if (!PyArg_ParseTuple(args, "l", &norm))
+    long norm = PyLong_AsLong(arg);
+    if (norm == -1 && PyErr_Occurred())
         return NULL;
 
     HRESULT result = self->iface->raw_Normalize((TEMScripting::IlluminationNormalization)norm);
@@ -70,7 +70,7 @@ static PyGetSetDef Illumination_getset[] = {
 };
 
 static PyMethodDef Illumination_methods[] = {
-    {"Normalize",               (PyCFunction)&Illumination_Normalize, METH_VARARGS, NULL},
+    {"Normalize",               (PyCFunction)&Illumination_Normalize, METH_O, NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -20,35 +20,39 @@ void raiseComError(HRESULT result)
     //PyErr_Format(comError, "HRESULT=0x%08x", (int)result);
 }
 
-PyObject* arrayFromSafeArray(SAFEARRAY* arr)
+/**
+ * Get shape (*ndim* dims, 1 <= ndim <= NPY_MAXDIMS) and numpy type of array *arr*.
+ * Return: true, on success
+ */
+static bool safeArrayLayout(SAFEARRAY* arr, npy_intp* dims, int& ndim, int& npType)
 {
-    UINT ndim = SafeArrayGetDim(arr);
+    ndim = (int)SafeArrayGetDim(arr);
     if (ndim == 0) {
         PyErr_SetString(PyExc_RuntimeError, "Expected array to be non-scalar");
-        return NULL;
+        return false;
+    }
+    if (ndim > NPY_MAXDIMS) {
+        PyErr_Format(PyExc_RuntimeError, "Array has too many dimensions: %d.", ndim);
+        return false;
     }
 
-    npy_intp* dims = new npy_intp[ndim];
-    for (UINT i = 0; i < ndim; i++ ) {
+    for (int i = 0; i < ndim; i++ ) {
         long lower, upper;
         HRESULT result = SafeArrayGetUBound(arr, 1 + i, &upper);    // Surprise: 1-Indexed
         if (FAILED(result)) {
-            delete[] dims;
             raiseComError(result);
-            return NULL;
+            return false;
         }   
 
         result = SafeArrayGetLBound(arr, 1 + i, &lower);    // Surprise: 1-Indexed
         if (FAILED(result)) {
-            delete[] dims;
             raiseComError(result);
-            return NULL;
+            return false;
         }   
 
         if (upper < lower) {    // Bounds are inclusive
-            delete[] dims;
             PyErr_Format(PyExc_RuntimeError, "Expected array bounds of dim %d to be lower < upper: lower=%d, upper=%d.", i, lower, upper);
-            return NULL;
+            return false;
         }
 
         dims[i] = 1 + upper - lower;
@@ -57,12 +61,10 @@ PyObject* arrayFromSafeArray(SAFEARRAY* arr)
     VARTYPE vtype;
     HRESULT result = SafeArrayGetVartype(arr, &vtype);
     if (FAILED(result)) {
-        delete[] dims;
         raiseComError(result);
-        return NULL;
+        return false;
     }
 
-    int npType;
     switch (vtype) {
     case VT_I1:   npType = NPY_INT8; break;
     case VT_I2:   npType = NPY_INT16; break;
@@ -75,32 +77,142 @@ PyObject* arrayFromSafeArray(SAFEARRAY* arr)
     case VT_INT:  npType = NPY_INT; break;
     case VT_UINT: npType = NPY_UINT; break;
     default:
-        delete[] dims;
         PyErr_Format(PyExc_RuntimeError, "Unknown array VARTYPE: %d.", vtype);
-        return NULL;
+        return false;
     }
 
+    return true;
+}
+
+/**
+ * Copy data of *arr* to numpy array *obj* (of matching size)
+ * Return: true, on success
+ */
+static bool copySafeArrayData(SAFEARRAY* arr, PyArrayObject* obj)
+{
     void *data;
-    result = SafeArrayAccessData(arr, &data);
+    HRESULT result = SafeArrayAccessData(arr, &data);
     if (FAILED(result)) {
-        delete[] dims;
         raiseComError(result);
-        return NULL;
+        return false;
     }
 
+    memcpy(PyArray_DATA(obj), data, PyArray_NBYTES(obj));
+    SafeArrayUnaccessData(arr);
+    return true;
+}
+
+PyObject* arrayFromSafeArray(SAFEARRAY* arr)
+{
+    npy_intp dims[NPY_MAXDIMS];
+    int ndim, npType;
+    if (!safeArrayLayout(arr, dims, ndim, npType))
+        return NULL;
+
     PyArrayObject* obj = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(ndim, dims, npType));
-    delete[] dims;
-    if (!obj) {
-        SafeArrayUnaccessData(arr);
+    if (!obj)
         return NULL;
-    }
 
-    memcpy(PyArray_DATA(obj), data, PyArray_NBYTES(obj));
-        SafeArrayUnaccessData(arr);
+    if (!copySafeArrayData(arr, obj)) {
+        Py_DECREF(obj);
+        return NULL;
+    }
 
     return reinterpret_cast<PyObject*>(obj);
 }
 
+bool copySafeArrayInto(SAFEARRAY* arr, PyObject* out)
+{
+    if (!PyArray_Check(out)) {
+        PyErr_SetString(PyExc_TypeError, "numpy array expected.");
+        return false;
+    }
+    PyArrayObject* obj = reinterpret_cast<PyArrayObject*>(out);
+
+    npy_intp dims[NPY_MAXDIMS];
+    int ndim, npType;
+    if (!safeArrayLayout(arr, dims, ndim, npType))
+        return false;
+
+    if (!PyArray_IS_C_CONTIGUOUS(obj) || !PyArray_ISWRITEABLE(obj)) {
+        PyErr_SetString(PyExc_ValueError, "Output array must be C-contiguous and writeable.");
+        return false;
+    }
+    if (!PyArray_EquivTypenums(PyArray_TYPE(obj), npType) || !PyArray_ISNOTSWAPPED(obj)) {
+        PyErr_Format(PyExc_ValueError, "Output array has wrong dtype (expected numpy type number %d).", npType);
+        return false;
+    }
+    bool sameShape = (PyArray_NDIM(obj) == ndim);
+    for (int i = 0; sameShape && i < ndim; i++)
+        sameShape = (PyArray_DIM(obj, i) == dims[i]);
+    if (!sameShape) {
+        PyErr_SetString(PyExc_ValueError, "Output array has wrong shape.");
+        return false;
+    }
+
+    return copySafeArrayData(arr, obj);
+}
+
+PyObject* newStackForSafeArray(SAFEARRAY* arr, Py_ssize_t count)
+{
+    npy_intp dims[NPY_MAXDIMS];
+    int ndim, npType;
+    if (!safeArrayLayout(arr, dims + 1, ndim, npType))
+        return NULL;
+    if (ndim + 1 > NPY_MAXDIMS) {
+        PyErr_Format(PyExc_RuntimeError, "Array has too many dimensions: %d.", ndim);
+        return NULL;
+    }
+    dims[0] = count;
+    return PyArray_SimpleNew(ndim + 1, dims, npType);
+}
+
+bool copySafeArrayIntoStack(SAFEARRAY* arr, PyObject* out, Py_ssize_t index)
+{
+    if (!PyArray_Check(out)) {
+        PyErr_SetString(PyExc_TypeError, "numpy array expected.");
+        return false;
+    }
+    PyArrayObject* obj = reinterpret_cast<PyArrayObject*>(out);
+
+    npy_intp dims[NPY_MAXDIMS];
+    int ndim, npType;
+    if (!safeArrayLayout(arr, dims, ndim, npType))
+        return false;
+
+    if (!PyArray_IS_C_CONTIGUOUS(obj) || !PyArray_ISWRITEABLE(obj)) {
+        PyErr_SetString(PyExc_ValueError, "Output array must be C-contiguous and writeable.");
+        return false;
+    }
+    if (!PyArray_EquivTypenums(PyArray_TYPE(obj), npType) || !PyArray_ISNOTSWAPPED(obj)) {
+        PyErr_Format(PyExc_ValueError, "Image %d has a different dtype than the stack (numpy type number %d).",
+                     (int)index, npType);
+        return false;
+    }
+    bool sameShape = (PyArray_NDIM(obj) == ndim + 1) && index < PyArray_DIM(obj, 0);
+    for (int i = 0; sameShape && i < ndim; i++)
+        sameShape = (PyArray_DIM(obj, i + 1) == dims[i]);
+    if (!sameShape) {
+        PyErr_Format(PyExc_ValueError, "Image %d has a different shape than the stack.", (int)index);
+        return false;
+    }
+
+    // Size of one image (the stride of a dimension of size 1 is arbitrary)
+    npy_intp size = PyArray_ITEMSIZE(obj);
+    for (int i = 0; i < ndim; i++)
+        size *= dims[i];
+
+    void *data;
+    HRESULT result = SafeArrayAccessData(arr, &data);
+    if (FAILED(result)) {
+        raiseComError(result);
+        return false;
+    }
+    memcpy(PyArray_BYTES(obj) + index * size, data, size);
+    SafeArrayUnaccessData(arr);
+    return true;
+}
+
 PyObject* tupleFromVector(TEMScripting::Vector* vec)
 {
     double x, y;
@@ -171,6 +283,208 @@ bool setVectorFromSequence(TEMScripting::Vector* vec, PyObject* seq)
     return true;
 }
 
+static PyGetSetDef* findSettableProperty(PyGetSetDef* getset, PyObject* nameObj)
+{
+    for (; getset->name; getset++) {
+        if (!getset->get || !getset->set)
+            continue;
+#if PY_MAJOR_VERSION >= 3
+        if (PyUnicode_Check(nameObj) && PyUnicode_CompareWithASCIIString(nameObj, getset->name) == 0)
+            return getset;
+#else
+        if (PyString_Check(nameObj) && strcmp(PyString_AS_STRING(nameObj), getset->name) == 0)
+            return getset;
+#endif
+    }
+    return NULL;
+}
+
+/**
+ * Set several properties of the wrapper *self* in one call. *values* is a dict mapping
+ * property names of the *getset* table to the new values. Each property is read first
+ * and only written if its current value differs.
+ *
+ * Returns a dict mapping each property name to its result: False if the value was unchanged,
+ * True if the value was written, or the exception instance if reading or writing failed.
+ * Unknown or read-only property names raise a KeyError before anything is written.
+ */
+PyObject* applyProperties(PyObject* self, PyGetSetDef* getset, PyObject* values)
+{
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+
+    while (PyDict_Next(values, &pos, &key, &value)) {
+        if (!findSettableProperty(getset, key)) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return NULL;
+        }
+    }
+
+    PyObject* results = PyDict_New();
+    if (!results)
+        return NULL;
+
+    pos = 0;
+    while (PyDict_Next(values, &pos, &key, &value)) {
+        PyGetSetDef* prop = findSettableProperty(getset, key);
+        PyObject* status = NULL;
+
+        PyObject* current = prop->get(self, prop->closure);
+        if (current) {
+            int equal = PyObject_RichCompareBool(current, value, Py_EQ);
+            Py_DECREF(current);
+            if (equal > 0) {
+                status = Py_False;
+                Py_INCREF(status);
+            } else if (equal == 0 && prop->set(self, value, prop->closure) == 0) {
+                status = Py_True;
+                Py_INCREF(status);
+            }
+        }
+
+        if (!status) {
+            PyObject* type;
+            PyObject* traceback;
+            PyErr_Fetch(&type, &status, &traceback);
+            PyErr_NormalizeException(&type, &status, &traceback);
+            Py_XDECREF(type);
+            Py_XDECREF(traceback);
+            if (!status) {
+                Py_INCREF(Py_None);
+                status = Py_None;
+            }
+        }
+
+        int test = PyDict_SetItem(results, key, status);
+        Py_DECREF(status);
+        if (test < 0) {
+            Py_DECREF(results);
+            return NULL;
+        }
+    }
+
+    return results;
+}
+
+/**
+ * Create interned string objects for *names* in *strings* (count entries), once.
+ * Used for names compared on each call (keywords, axis names, dict keys).
+ * Return: true, on success
+ */
+bool internStrings(const char* const* names, PyObject** strings, size_t count)
+{
+    if (strings[count - 1])
+        return true;
+    for (size_t n = 0; n < count; n++) {
+        if (strings[n])
+            continue;
+#if PY_MAJOR_VERSION >= 3
+        strings[n] = PyUnicode_InternFromString(names[n]);
+#else
+        strings[n] = PyString_InternFromString(names[n]);
+#endif
+        if (!strings[n])
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Find *obj* in the interned *strings* (count entries).
+ * Interned arguments are found by identity, others by comparison.
+ * Return: index, -1 if not found, -2 on error
+ */
+int findString(PyObject* obj, PyObject* const* strings, size_t count)
+{
+    for (size_t n = 0; n < count; n++) {
+        if (obj == strings[n])
+            return (int)n;
+    }
+    for (size_t n = 0; n < count; n++) {
+        int equal = PyObject_RichCompareBool(obj, strings[n], Py_EQ);
+        if (equal > 0)
+            return (int)n;
+        else if (equal < 0)
+            return -2;
+    }
+    return -1;
+}
+
+static bool setOptionalArg(PyObject* name, PyObject* value, PyObject* const* keys, PyObject** values, size_t count)
+{
+    int index = findString(name, keys, count);
+    if (index == -2)
+        return false;
+    if (index < 0) {
+        PyObject* repr = PyObject_Repr(name);
+        if (repr) {
+#if PY_MAJOR_VERSION >= 3
+            PyErr_Format(PyExc_TypeError, "Unexpected keyword argument %U", repr);
+#else
+            PyErr_Format(PyExc_TypeError, "Unexpected keyword argument %s", PyString_AsString(repr));
+#endif
+            Py_DECREF(repr);
+        }
+        return false;
+    }
+    if (values[index]) {
+        PyErr_Format(PyExc_TypeError, "Got multiple values for argument '%s'",
+#if PY_MAJOR_VERSION >= 3
+                     PyUnicode_AsUTF8(keys[index]));
+#else
+                     PyString_AsString(keys[index]));
+#endif
+        return false;
+    }
+    values[index] = value;
+    return true;
+}
+
+/**
+ * Parse optional arguments, given by position or by the keywords *keys* (interned, see internStrings()),
+ * into *values* (borrowed references, NULL for arguments not given).
+ * Return: true, on success
+ */
+bool parseOptionalArgs(KEYWORD_ARGS, PyObject* const* keys, PyObject** values, size_t count)
+{
+    for (size_t n = 0; n < count; n++)
+        values[n] = NULL;
+
+#if PY_VERSION_HEX >= 0x03070000
+    if ((size_t)nargs > count) {
+        PyErr_Format(PyExc_TypeError, "Expected at most %d arguments", (int)count);
+        return false;
+    }
+    for (Py_ssize_t n = 0; n < nargs; n++)
+        values[n] = args[n];
+    if (kwnames) {
+        for (Py_ssize_t n = 0; n < PyTuple_GET_SIZE(kwnames); n++) {
+            if (!setOptionalArg(PyTuple_GET_ITEM(kwnames, n), args[nargs + n], keys, values, count))
+                return false;
+        }
+    }
+#else
+    Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+    if ((size_t)nargs > count) {
+        PyErr_Format(PyExc_TypeError, "Expected at most %d arguments", (int)count);
+        return false;
+    }
+    for (Py_ssize_t n = 0; n < nargs; n++)
+        values[n] = PyTuple_GET_ITEM(args, n);
+    if (kw) {
+        PyObject* name;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(kw, &pos, &name, &value)) {
+            if (!setOptionalArg(name, value, keys, values, count))
+                return false;
+        }
+    }
+#endif
+    return true;
+}
+
 // Global objects
 PyObject* comError = NULL;
 PyObject* temscriptModule = NULL;
@@ -196,61 +510,44 @@ static PyMethodDef methods[] = {
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
-#if PY_MAJOR_VERSION >= 3
-
-#define INIT_ERROR NULL
-
-static struct PyModuleDef moduledef = {
-    PyModuleDef_HEAD_INIT, "_temscript", NULL, -1, methods
-};
-
-extern "C" PyMODINIT_FUNC PyInit__temscript(void)
-
-#else
-
-#define INIT_ERROR
-
-extern "C" void init_temscript(void)
-
-#endif
-
-{   
-    import_array();
+/**
+ * Initialize module object *module* (Py_mod_exec slot).
+ * Return: 0 on success, -1 on error
+ */
+static int execModule(PyObject* module)
+{
+    import_array1(-1);
     HRESULT result = CoInitializeEx(NULL, 0);
     if (FAILED(result)) {
-        printf("CoInitializeEx failed. HRESULT=%08x\n", result);
-        return INIT_ERROR;
+        // comError does not exist yet
+        PyErr_Format(PyExc_RuntimeError, "CoInitializeEx failed. HRESULT=0x%08x", (int)result);
+        return -1;
     }
     
     // Initialize types
-    if (PyType_Ready(&Stage_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&CCDCamera_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&CCDCameraInfo_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&CCDAcqParams_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&STEMDetector_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&STEMDetectorInfo_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&STEMAcqParams_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&AcqImage_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Acquisition_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Gauge_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Vacuum_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Configuration_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Projection_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Illumination_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Gun_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Gun1_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&BlankerShutter_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&InstrumentModeControl_Type) < 0) return INIT_ERROR;
-    if (PyType_Ready(&Instrument_Type) < 0) return INIT_ERROR;
-
-    // Initialize module
-#if PY_MAJOR_VERSION >= 3
-    temscriptModule = PyModule_Create(&moduledef);
-#else
-    temscriptModule = Py_InitModule("_temscript", methods);
-#endif
-    if (!temscriptModule)
-        return INIT_ERROR;
+    if (PyType_Ready(&Stage_Type) < 0) return -1;
+    if (PyType_Ready(&CCDCamera_Type) < 0) return -1;
+    if (PyType_Ready(&CCDCameraInfo_Type) < 0) return -1;
+    if (PyType_Ready(&CCDAcqParams_Type) < 0) return -1;
+    if (PyType_Ready(&STEMDetector_Type) < 0) return -1;
+    if (PyType_Ready(&STEMDetectorInfo_Type) < 0) return -1;
+    if (PyType_Ready(&STEMAcqParams_Type) < 0) return -1;
+    if (PyType_Ready(&AcqImage_Type) < 0) return -1;
+    if (PyType_Ready(&Acquisition_Type) < 0) return -1;
+    if (PyType_Ready(&Gauge_Type) < 0) return -1;
+    if (PyType_Ready(&Vacuum_Type) < 0) return -1;
+    if (PyType_Ready(&Configuration_Type) < 0) return -1;
+    if (PyType_Ready(&Projection_Type) < 0) return -1;
+    if (PyType_Ready(&Illumination_Type) < 0) return -1;
+    if (PyType_Ready(&Gun_Type) < 0) return -1;
+    if (PyType_Ready(&Gun1_Type) < 0) return -1;
+    if (PyType_Ready(&BlankerShutter_Type) < 0) return -1;
+    if (PyType_Ready(&InstrumentModeControl_Type) < 0) return -1;
+    if (PyType_Ready(&Instrument_Type) < 0) return -1;
+    if (PyType_Ready(&DriftKernel_Type) < 0) return -1;
+    if (PyType_Ready(&FrameAccumulator_Type) < 0) return -1;
+
+    temscriptModule = module;
 
     // Add exception
     comError = PyErr_NewException("temscript.COMError", NULL, NULL);
@@ -277,6 +574,8 @@ extern "C" void init_temscript(void)
     Py_INCREF(&BlankerShutter_Type);
     Py_INCREF(&InstrumentModeControl_Type);
     Py_INCREF(&Instrument_Type);
+    Py_INCREF(&DriftKernel_Type);
+    Py_INCREF(&FrameAccumulator_Type);
 
     PyModule_AddObject(temscriptModule, "Stage", (PyObject *)&Stage_Type);
     PyModule_AddObject(temscriptModule, "CCDCamera", (PyObject *)&CCDCamera_Type);
@@ -297,8 +596,54 @@ extern "C" void init_temscript(void)
     PyModule_AddObject(temscriptModule, "BlankerShutter", (PyObject *)&BlankerShutter_Type);
     PyModule_AddObject(temscriptModule, "InstrumentModeControl", (PyObject *)&InstrumentModeControl_Type);
     PyModule_AddObject(temscriptModule, "Instrument", (PyObject *)&Instrument_Type);
+    PyModule_AddObject(temscriptModule, "DriftKernel", (PyObject *)&DriftKernel_Type);
+    PyModule_AddObject(temscriptModule, "FrameAccumulator", (PyObject *)&FrameAccumulator_Type);
 
-#if PY_MAJOR_VERSION >= 3
-    return temscriptModule;
-#endif 
+    // Add enum name tables
+    if (!addEnumNames(temscriptModule))
+        return -1;
+
+    return 0;
+}
+
+#if PY_VERSION_HEX >= 0x03050000
+
+// Multi-phase initialization (PEP 489)
+static PyModuleDef_Slot slots[] = {
+    {Py_mod_exec, (void*)execModule},
+    {0, NULL}
+};
+
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "_temscript", NULL, 0, methods, slots
+};
+
+extern "C" PyMODINIT_FUNC PyInit__temscript(void)
+{
+    return PyModuleDef_Init(&moduledef);
+}
+
+#elif PY_MAJOR_VERSION >= 3
+
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "_temscript", NULL, -1, methods
+};
+
+extern "C" PyMODINIT_FUNC PyInit__temscript(void)
+{
+    PyObject* module = PyModule_Create(&moduledef);
+    if (module && execModule(module) < 0)
+        Py_CLEAR(module);
+    return module;
+}
+
+#else
+
+extern "C" void init_temscript(void)
+{
+    PyObject* module = Py_InitModule("_temscript", methods);
+    if (module)
+        execModule(module);
 }
+
+#endif
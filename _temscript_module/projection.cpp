@@ -51,10 +51,10 @@ static PyObject* Projection_ResetDefocus(Projection *self)
     Py_RETURN_NONE;
 }
 
-static PyObject* Projection_ChangeProjectionIndex(Projection *self, PyObject* args)
+static PyObject* Projection_ChangeProjectionIndex(Projection *self, PyObject* arg)
 {
-    long diff;
-    if (!PyArg_ParseTuple(args, "l", &diff))
+    long diff = PyLong_AsLong(arg);
+    if (diff == -1 && PyErr_Occurred())
         return NULL;
 
     HRESULT result = self->iface->raw_ChangeProjectionIndex(diff);
@@ -66,10 +66,10 @@ static PyObject* Projection_ChangeProjectionIndex(Projection *self, PyObject* ar
     Py_RETURN_NONE;
 }
 
-static PyObject* Projection_Normalize(Projection *self, PyObject* args)
+static PyObject* Projection_Normalize(Projection *self, PyObject* arg)
 {
-    long norm;
-    if (!PyArg_ParseTuple(args, "l", &norm))
+    long norm = PyLong_AsLong(arg);
+    if (norm == -1 && PyErr_Occurred())
         return NULL;
 
     HRESULT result = self->iface->raw_Normalize((TEMScripting::ProjectionNormalization)norm);
@@ -110,8 +110,8 @@ static PyGetSetDef Projection_getset[] = {
 
 static PyMethodDef Projection_methods[] = {
     {"ResetDefocus",            (PyCFunction)&Projection_ResetDefocus, METH_NOARGS, NULL},
-    {"ChangeProjectionIndex",   (PyCFunction)&Projection_ChangeProjectionIndex, METH_VARARGS, NULL},
-    {"Normalize",               (PyCFunction)&Projection_Normalize, METH_VARARGS, NULL},
+    {"ChangeProjectionIndex",   (PyCFunction)&Projection_ChangeProjectionIndex, METH_O, NULL},
+    {"Normalize",               (PyCFunction)&Projection_Normalize, METH_O, NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -5,52 +5,44 @@
 ENUM_PROPERTY_GETTER(Stage, Status, TEMScripting::StageStatus)
 ENUM_PROPERTY_GETTER(Stage, Holder, TEMScripting::StageHolderType)
 
+// Axis names (dict keys of position, keyword arguments of GoTo/MoveTo, AxisData argument)
+static const char* axisNames[] = { "x", "y", "z", "a", "b", "speed" };
+static PyObject* axisKeys[6] = { NULL };
+
+static const TEMScripting::StageAxes axisFlags[] = {
+    TEMScripting::axisX, TEMScripting::axisY, TEMScripting::axisZ, TEMScripting::axisA, TEMScripting::axisB
+};
+
 static PyObject* buildPositionDict(TEMScripting::StagePosition* position)
 {
+    double values[5];
+    HRESULT result;
+
+    if (FAILED(result = position->get_X(&values[0])) || FAILED(result = position->get_Y(&values[1]))
+            || FAILED(result = position->get_Z(&values[2])) || FAILED(result = position->get_A(&values[3]))
+            || FAILED(result = position->get_B(&values[4]))) {
+        raiseComError(result);
+        return NULL;
+    }
+
+    if (!internStrings(axisNames, axisKeys, 6))
+        return NULL;
+
     PyObject* dict = PyDict_New();
-    double value;
-
-    HRESULT result = position->get_X(&value);
-    if (FAILED(result))
-        goto error;
-    PyObject* obj = PyFloat_FromDouble(value);
-    PyDict_SetItemString(dict, "x", obj);
-    Py_XDECREF(obj);
-
-    result = position->get_Y(&value);
-    if (FAILED(result))
-        goto error;
-    obj = PyFloat_FromDouble(value);
-    PyDict_SetItemString(dict, "y", obj);
-    Py_XDECREF(obj);
-
-    result = position->get_Z(&value);
-    if (FAILED(result))
-        goto error;
-    obj = PyFloat_FromDouble(value);
-    PyDict_SetItemString(dict, "z", obj);
-    Py_XDECREF(obj);
-
-    result = position->get_A(&value);
-    if (FAILED(result))
-        goto error;
-    obj = PyFloat_FromDouble(value);
-    PyDict_SetItemString(dict, "a", obj);
-    Py_XDECREF(obj);
-
-    result = position->get_B(&value);
-    if (FAILED(result))
-        goto error;
-    obj = PyFloat_FromDouble(value);
-    PyDict_SetItemString(dict, "b", obj);
-    Py_XDECREF(obj);
+    if (!dict)
+        return NULL;
 
-    return dict;
+    for (int n = 0; n < 5; n++) {
+        PyObject* obj = PyFloat_FromDouble(values[n]);
+        if (!obj || PyDict_SetItem(dict, axisKeys[n], obj) < 0) {
+            Py_XDECREF(obj);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(obj);
+    }
 
-error:
-    Py_XDECREF(dict);
-    raiseComError(result);
-    return NULL;
+    return dict;
 }
 
 static PyObject* Stage_get_Position(Stage *self, void *)
@@ -85,98 +77,62 @@ static int getFloat(PyObject* obj, double& value)
     return 1;
 }
 
+static HRESULT putAxis(TEMScripting::StagePosition* position, int axis, double value)
+{
+    switch (axis) {
+    case 0:     return position->put_X(value);
+    case 1:     return position->put_Y(value);
+    case 2:     return position->put_Z(value);
+    case 3:     return position->put_A(value);
+    default:    return position->put_B(value);
+    }
+}
+
 /**
- * Parse stage position dictionary into StagePosition instance.
+ * Parse stage position arguments (x, y, z, a, b, speed) into StagePosition instance.
  * On return a bitmap with set axes is returned in *axes*.
- * If *speed* is non-NULL and a float-value for "speed" is set in *kw*, *speed* is uptdated to the new value.
+ * If *speed* is non-NULL and a float-value for "speed" is given, *speed* is uptdated to the new value.
  * Return: true, on success
  */
-static bool parsePosition(PyObject* args, PyObject* kw, TEMScripting::StagePosition* position, unsigned& axes, double* speed=NULL)
+static bool parsePosition(KEYWORD_ARGS, TEMScripting::StagePosition* position, unsigned& axes, double* speed=NULL)
 {
-    PyObject* xObj = NULL;
-    PyObject* yObj = NULL;
-    PyObject* zObj = NULL;
-    PyObject* aObj = NULL;
-    PyObject* bObj = NULL;
-	PyObject* speedObj = NULL;
-    
-    static const char* kwlist[] = { "x", "y", "z", "a", "b", "speed", NULL };
-
+    PyObject* objs[6];
     double  value;
     int     test;
-    
-    if (!PyArg_ParseTupleAndKeywords(args, kw, "|OOOOOO", (char**)kwlist, &xObj, &yObj, &zObj, &aObj, &bObj, &speedObj))
-        return false;
-        
-    axes = 0;
-    
-    test = getFloat(xObj, value);
-    if (test > 0) {
-        HRESULT result = position->put_X(value);
-        if (FAILED(result)) {
-            raiseComError(result);
-            return false;
-        }
-        axes |= TEMScripting::axisX;
-    } else if (test < 0)
+
+    if (!internStrings(axisNames, axisKeys, 6))
         return false;
-    
-    test = getFloat(yObj, value);
-    if (test > 0) {
-        HRESULT result = position->put_Y(value);
-        if (FAILED(result)) {
-            raiseComError(result);
-            return false;
-        }
-        axes |= TEMScripting::axisY;
-    } else if (test < 0)
+    // "speed" is accepted (and ignored) without *speed*, too
+    if (!parseOptionalArgs(PASS_KEYWORD_ARGS, axisKeys, objs, 6))
         return false;
-        
-    test = getFloat(zObj, value);
-    if (test > 0) {
-        HRESULT result = position->put_Z(value);
-        if (FAILED(result)) {
-            raiseComError(result);
-            return false;
-        }
-        axes |= TEMScripting::axisZ;
-    } else if (test < 0)
-        return false;
-        
-    test = getFloat(aObj, value);
-    if (test > 0) {
-        HRESULT result = position->put_A(value);
-        if (FAILED(result)) {
-            raiseComError(result);
-            return false;
-        }
-        axes |= TEMScripting::axisA;
-    } else if (test < 0)
-        return false;
-        
-    test = getFloat(bObj, value);
-    if (test > 0) {
-        HRESULT result = position->put_B(value);
-        if (FAILED(result)) {
-            raiseComError(result);
+
+    axes = 0;
+
+    for (int n = 0; n < 5; n++) {
+        test = getFloat(objs[n], value);
+        if (test > 0) {
+            HRESULT result = putAxis(position, n, value);
+            if (FAILED(result)) {
+                raiseComError(result);
+                return false;
+            }
+            axes |= axisFlags[n];
+        } else if (test < 0)
             return false;
-        }
-        axes |= TEMScripting::axisB;
-    } else if (test < 0)
-        return false;
+    }
 
-	if (speed) {
-		test = getFloat(speedObj, value);
-		if (test > 0)
-			*speed = value;
-		else if (test < 0)
-			return false;
-	}
+    if (speed) {
+        test = getFloat(objs[5], value);
+        if (test > 0)
+            *speed = value;
+        else if (test < 0)
+            return false;
+    }
 
     return true;
 }
 
-static PyObject* Stage_GoTo(Stage *self, PyObject* args, PyObject* kw)
+static PyObject* Stage_GoTo(Stage *self, KEYWORD_ARGS)
 {
     unsigned axes = 0;
 	double speed = 1.0;
@@ -188,7 +144,7 @@ static PyObject* Stage_GoTo(Stage *self, PyObject* args, PyObject* kw)
         return NULL;
     }
     
-    if (!parsePosition(args, kw, position, axes, &speed)) {
+    if (!parsePosition(PASS_KEYWORD_ARGS, position, axes, &speed)) {
         position->Release();
         return NULL;
     }
@@ -209,7 +165,7 @@ static PyObject* Stage_GoTo(Stage *self, PyObject* args, PyObject* kw)
     Py_RETURN_NONE;
 }
 
-static PyObject* Stage_MoveTo(Stage *self, PyObject* args, PyObject* kw)
+static PyObject* Stage_MoveTo(Stage *self, KEYWORD_ARGS)
 {
     unsigned axes = 0;
    
@@ -220,7 +176,7 @@ static PyObject* Stage_MoveTo(Stage *self, PyObject* args, PyObject* kw)
         return NULL;
     }
 
-    if (!parsePosition(args, kw, position, axes)) {
+    if (!parsePosition(PASS_KEYWORD_ARGS, position, axes)) {
         position->Release();
         return NULL;
     }
@@ -238,28 +194,19 @@ static PyObject* Stage_MoveTo(Stage *self, PyObject* args, PyObject* kw)
     Py_RETURN_NONE;
 }
 
-static PyObject* Stage_AxisData(Stage *self, PyObject* args)
+static PyObject* Stage_AxisData(Stage *self, PyObject* axisObj)
 {
-    const char* axisStr;
-
-    if (!PyArg_ParseTuple(args, "s", &axisStr)) 
+    if (!internStrings(axisNames, axisKeys, 6))
         return NULL;
 
-    TEMScripting::StageAxes axis;
-    if (strcmp(axisStr, "x") == 0)
-        axis = TEMScripting::axisX;
-    else if (strcmp(axisStr, "y") == 0)
-        axis = TEMScripting::axisY;
-    else if (strcmp(axisStr, "z") == 0)
-        axis = TEMScripting::axisZ;
-    else if (strcmp(axisStr, "a") == 0)
-        axis = TEMScripting::axisA;
-    else if (strcmp(axisStr, "b") == 0)
-        axis = TEMScripting::axisB;
-    else {
+    int index = findString(axisObj, axisKeys, 5);
+    if (index == -2)
+        return NULL;
+    else if (index < 0) {
         PyErr_SetString(PyExc_ValueError, "Use value 'x', 'y', 'z', 'a', and 'b' to specify axis.");
         return NULL;
     }
+    TEMScripting::StageAxes axis = axisFlags[index];
 
     TEMScripting::StageAxisData* data;
     HRESULT result = self->iface->get_AxisData(axis, &data);
@@ -313,9 +260,9 @@ static PyGetSetDef Stage_getset[] = {
 };
 
 static PyMethodDef Stage_methods[] = {
-    {"GoTo",     (PyCFunction)&Stage_GoTo, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"MoveTo",   (PyCFunction)&Stage_MoveTo, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"AxisData", (PyCFunction)&Stage_AxisData, METH_VARARGS, NULL},
+    {"GoTo",     (PyCFunction)&Stage_GoTo, METH_KEYWORD_ARGS, NULL},
+    {"MoveTo",   (PyCFunction)&Stage_MoveTo, METH_KEYWORD_ARGS, NULL},
+    {"AxisData", (PyCFunction)&Stage_AxisData, METH_O, NULL},
     {NULL}  /* Sentinel */
 };
 
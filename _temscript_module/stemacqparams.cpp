@@ -16,5 +16,19 @@ static PyGetSetDef STEMAcqParams_getset[] = {
     {NULL}  /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(STEMAcqParams, TEMScripting::STEMAcqParams, STEMAcqParams_getset, 0)
+static PyObject* STEMAcqParams_Apply(STEMAcqParams *self, PyObject* values)
+{
+    if (!PyDict_Check(values)) {
+        PyErr_SetString(PyExc_TypeError, "dict expected.");
+        return NULL;
+    }
+    return applyProperties((PyObject*)self, STEMAcqParams_getset, values);
+}
+
+static PyMethodDef STEMAcqParams_methods[] = {
+    {"Apply",   (PyCFunction)&STEMAcqParams_Apply, METH_O, NULL},
+    {NULL}  /* Sentinel */
+};
+
+IMPLEMENT_WRAPPER(STEMAcqParams, TEMScripting::STEMAcqParams, STEMAcqParams_getset, STEMAcqParams_methods)
 
@@ -17,5 +17,19 @@ static PyGetSetDef STEMDetectorInfo_getset[] = {
     {NULL}          /* Sentinel */
 };
 
-IMPLEMENT_WRAPPER(STEMDetectorInfo, TEMScripting::STEMDetectorInfo, STEMDetectorInfo_getset, 0)
+static PyObject* STEMDetectorInfo_Apply(STEMDetectorInfo *self, PyObject* values)
+{
+    if (!PyDict_Check(values)) {
+        PyErr_SetString(PyExc_TypeError, "dict expected.");
+        return NULL;
+    }
+    return applyProperties((PyObject*)self, STEMDetectorInfo_getset, values);
+}
+
+static PyMethodDef STEMDetectorInfo_methods[] = {
+    {"Apply",   (PyCFunction)&STEMDetectorInfo_Apply, METH_O, NULL},
+    {NULL}  /* Sentinel */
+};
+
+IMPLEMENT_WRAPPER(STEMDetectorInfo, TEMScripting::STEMDetectorInfo, STEMDetectorInfo_getset, STEMDetectorInfo_methods)
 
@@ -10,6 +10,8 @@
 #define NPY_NO_DEPRECATED_API   NPY_1_7_API_VERSION
 
 #include <Python.h>
+#include <complex>
+#include <vector>
 
 // Use this statement to use the type library from your own stdscript.dll
 #import "stdscript.dll" named_guids raw_interfaces_only raw_method_prefix("raw_")
@@ -36,10 +38,48 @@ COMPILE_TIME_ASSERT(sizeof(long) == 4);
 extern PyObject* comError;
 extern PyObject* temscriptModule;
 
+// Methods with keyword arguments: vectorcall convention (METH_FASTCALL) where available,
+// argument tuple and keyword dict otherwise. Functions are declared as f(PyObject* self, KEYWORD_ARGS).
+#if PY_VERSION_HEX >= 0x03070000
+#define KEYWORD_ARGS        PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames
+#define PASS_KEYWORD_ARGS   args, nargs, kwnames
+#define METH_KEYWORD_ARGS   (METH_FASTCALL | METH_KEYWORDS)
+#else
+#define KEYWORD_ARGS        PyObject* args, PyObject* kw
+#define PASS_KEYWORD_ARGS   args, kw
+#define METH_KEYWORD_ARGS   (METH_VARARGS | METH_KEYWORDS)
+#endif
+
 // Helpers (in module.cpp)
 void      raiseComError(HRESULT result);
 PyObject* arrayFromSafeArray(SAFEARRAY* arr);
+bool      copySafeArrayInto(SAFEARRAY* arr, PyObject* out);
+PyObject* newStackForSafeArray(SAFEARRAY* arr, Py_ssize_t count);
+bool      copySafeArrayIntoStack(SAFEARRAY* arr, PyObject* out, Py_ssize_t index);
 PyObject* tupleFromVector(TEMScripting::Vector* vec);
 bool      setVectorFromSequence(TEMScripting::Vector* vec, PyObject* seq);
+PyObject* applyProperties(PyObject* self, PyGetSetDef* getset, PyObject* values);
+bool      internStrings(const char* const* names, PyObject** strings, size_t count);
+int       findString(PyObject* obj, PyObject* const* strings, size_t count);
+bool      parseOptionalArgs(KEYWORD_ARGS, PyObject* const* keys, PyObject** values, size_t count);
+
+// Enum name tables generated from temscript/enums.py (in enumnames.cpp)
+bool      addEnumNames(PyObject* module);
+
+// Phase correlation of width x height frames (in drift.cpp), doesn't need the GIL
+class DriftFrame {
+public:
+    DriftFrame(size_t width, size_t height, bool window);
+
+    // Spectrum of frame 'src' (mean subtracted, optionally Hann windowed, zero padded)
+    void transform(const double* src, std::vector<std::complex<double> >& spectrum) const;
+    // Shift (dx, dy) in pixels of image relative to reference and correlation peak height (0..1)
+    void correlate(const std::vector<std::complex<double> >& reference, const std::vector<std::complex<double> >& image,
+                   double* dx, double* dy, double* confidence) const;
+
+    size_t width, height;
+    size_t fftWidth, fftHeight;
+    bool   window;
+};
 
 #endif // TEMSCRIPT_INC
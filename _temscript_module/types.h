@@ -8,12 +8,12 @@ DECLARE_WRAPPER(Stage, TEMScripting::Stage)
 DECLARE_WRAPPER(Gauge, TEMScripting::Gauge)
 DECLARE_WRAPPER(Vacuum, TEMScripting::Vacuum)
 DECLARE_WRAPPER(AcqImage, TEMScripting::AcqImage)
+bool AcqImage_readInto(TEMScripting::AcqImage* iface, PyObject* out);    // Copy image to numpy array *out*
 DECLARE_WRAPPER(CCDCamera, TEMScripting::CCDCamera)
 DECLARE_WRAPPER(CCDAcqParams, TEMScripting::CCDAcqParams)
 DECLARE_WRAPPER(CCDCameraInfo, TEMScripting::CCDCameraInfo)
 DECLARE_WRAPPER(STEMDetectorInfo, TEMScripting::STEMDetectorInfo)
 DECLARE_WRAPPER(STEMAcqParams, TEMScripting::STEMAcqParams)
-DECLARE_WRAPPER(Acquisition, TEMScripting::Acquisition)
 DECLARE_WRAPPER(Configuration, TEMScripting::Configuration)
 DECLARE_WRAPPER(Projection, TEMScripting::Projection)
 DECLARE_WRAPPER(Illumination, TEMScripting::Illumination)
@@ -30,4 +30,15 @@ extern PyTypeObject STEMDetector_Type;
 PyObject* STEMDetector_create(TEMScripting::STEMDetector* detector, PyObject* acqParams);
 TEMScripting::STEMDetector* STEMDetector_query(PyObject* self);
 
+// Acquisition is handled slightly different (caches its device wrappers)
+extern PyTypeObject Acquisition_Type;
+PyObject* Acquisition_create(TEMScripting::Acquisition* iface);
+TEMScripting::Acquisition* Acquisition_query(PyObject* self);
+
+// DriftKernel wraps no COM object (phase correlation, see drift.cpp)
+extern PyTypeObject DriftKernel_Type;
+
+// FrameAccumulator wraps no COM object (sum of frames, see accumulate.cpp)
+extern PyTypeObject FrameAccumulator_Type;
+
 #endif // TYPES_INC
@@ -0,0 +1,27 @@
+from temscript.enums import *
+from temscript.microscope import _enum_name, _enum_value, _parse_enum
+import timeit
+
+# Cost of the enum conversions in the Microscope getters/setters: the name tables
+# (interned names of the native module, if available) vs. creating Enum instances
+REPEAT = 5
+NUMBER = 200000
+
+cases = [
+    ("get: StageStatus(x).name", lambda: StageStatus(3).name),
+    ("get: _enum_name(StageStatus, x)", lambda: _enum_name(StageStatus, 3)),
+    ("get: AcqImageSize(x).name", lambda: AcqImageSize(1).name),
+    ("get: _enum_name(AcqImageSize, x)", lambda: _enum_name(AcqImageSize, 1)),
+]
+parse_enum = lambda item: int(_parse_enum(AcqImageSize, item))
+enum_value = _enum_value(AcqImageSize)
+cases += [
+    ("set: int(_parse_enum(AcqImageSize, 'HALF'))", lambda: parse_enum("HALF")),
+    ("set: _enum_value(AcqImageSize)('HALF')", lambda: enum_value("HALF")),
+    ("set: int(_parse_enum(AcqImageSize, 1))", lambda: parse_enum(1)),
+    ("set: _enum_value(AcqImageSize)(1)", lambda: enum_value(1)),
+]
+
+for label, func in cases:
+    best = min(timeit.repeat(func, repeat=REPEAT, number=NUMBER)) / NUMBER
+    print("%-45s %7.1f ns" % (label, best * 1e9))
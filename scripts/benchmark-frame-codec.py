@@ -0,0 +1,55 @@
+from temscript.null_microscope import NullMicroscope
+from temscript.server import _gzipencode
+from temscript import framecodec
+import numpy as np
+import sys
+import time
+import zlib
+
+# Compression ratio and throughput of the frame codec vs. gzip (as used by the server) on
+# synthetic frames and on recorded frames given as .npy files on the command line:
+#
+#   python scripts/benchmark-frame-codec.py [frame.npy ...]
+REPEAT = 3
+
+if not framecodec.available():
+    sys.exit("Frame codec (_temscript_codec module) not available")
+
+microscope = NullMicroscope(wait_exposure=False, specimen=True)
+specimen = microscope.acquire("CCD")["CCD"]
+rng = np.random.RandomState(0)
+frames = [
+    ("specimen (int16)", specimen),
+    ("specimen + shot noise (int16)", rng.poisson(specimen / 10.0).astype(np.int16)),
+    ("low dose counting (uint16)", rng.poisson(0.05, size=specimen.shape).astype(np.uint16)),
+    ("specimen sum (int32)", specimen.astype(np.int32) * 37 + rng.poisson(100.0, size=specimen.shape)),
+]
+for path in sys.argv[1:]:
+    frames.append((path, np.load(path)))
+
+
+def best_time(func):
+    best = None
+    for n in range(REPEAT):
+        start = time.time()
+        func()
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+print("%-32s %-8s %7s %12s %12s" % ("frame", "codec", "ratio", "encode MB/s", "decode MB/s"))
+for label, frame in frames:
+    raw = np.ascontiguousarray(frame).tobytes()
+    size = len(raw) / 1e6
+
+    gzipped = _gzipencode(raw)
+    encode = best_time(lambda: _gzipencode(raw))
+    decode = best_time(lambda: zlib.decompress(gzipped, 16 + zlib.MAX_WBITS))
+    print("%-32s %-8s %7.2f %12.1f %12.1f" % (label, "gzip", len(raw) / len(gzipped), size / encode, size / decode))
+
+    encoded = framecodec.encode_frame(frame)
+    assert np.array_equal(framecodec.decode_frame(encoded, frame.dtype, frame.shape), frame)
+    encode = best_time(lambda: framecodec.encode_frame(frame))
+    decode = best_time(lambda: framecodec.decode_frame(encoded, frame.dtype, frame.shape))
+    print("%-32s %-8s %7.2f %12.1f %12.1f" % ("", "bslz", len(raw) / len(encoded), size / encode, size / decode))
@@ -0,0 +1,34 @@
+from temscript import GetInstrument
+import timeit
+
+# Call overhead of the native wrappers, e.g. against the offline simulator of the
+# microscope software. Only calls without effect on the (simulated) microscope:
+# GoTo() without axes only reads the position, Apply() without values does not
+# reach the COM interface. Run before and after changes of the wrappers.
+REPEAT = 5
+NUMBER = 20000
+
+instrument = GetInstrument()
+stage = instrument.Stage
+projection = instrument.Projection
+acquisition = instrument.Acquisition
+cameras = acquisition.Cameras
+params = cameras[0].AcqParams if cameras else None
+device_name = cameras[0].Info.Name if cameras else None
+
+cases = [
+    ("Stage.GoTo()", lambda: stage.GoTo()),
+    ("Stage.GoTo(speed=1.0)", lambda: stage.GoTo(speed=1.0)),
+    ("Stage.AxisData('x')", lambda: stage.AxisData('x')),
+    ("Stage.Position", lambda: stage.Position),
+    ("Projection.MagnificationIndex", lambda: projection.MagnificationIndex),
+]
+if params is not None:
+    cases += [
+        ("CCDAcqParams.Apply({})", lambda: params.Apply({})),
+        ("Acquisition.FindDevice(name)", lambda: acquisition.FindDevice(device_name)),
+    ]
+
+for label, func in cases:
+    best = min(timeit.repeat(func, repeat=REPEAT, number=NUMBER)) / NUMBER
+    print("%-35s %8.2f us" % (label, best * 1e6))
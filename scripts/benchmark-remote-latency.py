@@ -0,0 +1,47 @@
+from temscript import server
+from temscript.remote_microscope import RemoteMicroscope
+from threading import Thread
+import time
+
+# Latency of small requests (as issued by control loops) against a dummy microscope
+# server, with persistent HTTP/1.1 connections and with one connection per request (HTTP/1.0)
+REQUESTS = 2000
+
+
+class QuietHandler(server.MicroscopeHandler):
+    def log_message(self, format, *args):
+        pass
+
+
+class QuietHandler10(QuietHandler):
+    protocol_version = "HTTP/1.0"
+
+
+def run(handler, port):
+    temscripting_server = server.NullMicroscopeServer(("127.0.0.1", port), handler)
+    Thread(target=temscripting_server.serve_forever, daemon=True).start()
+    client = RemoteMicroscope(("127.0.0.1", port))
+    client.get_stem_magnification()
+
+    latency = []
+    for n in range(REQUESTS):
+        start = time.perf_counter()
+        if n % 2:
+            client.set_stem_magnification(1000.0 + n)
+        else:
+            client.get_stem_magnification()
+        latency.append(time.perf_counter() - start)
+    temscripting_server.shutdown()
+    temscripting_server.server_close()
+
+    latency.sort()
+    print("%-9s mean %7.1f us, p50 %7.1f us, p99 %7.1f us" % (
+        handler.protocol_version,
+        1e6 * sum(latency) / len(latency),
+        1e6 * latency[len(latency) // 2],
+        1e6 * latency[int(len(latency) * 0.99)]))
+
+
+print("Small request latency (%d alternating GET/PUT requests):" % REQUESTS)
+run(QuietHandler10, 8090)
+run(QuietHandler, 8091)
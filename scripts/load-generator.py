@@ -0,0 +1,213 @@
+from temscript.remote_microscope import RemoteMicroscope
+from threading import Thread, Lock, Event
+import argparse
+import asyncio
+import json
+import numpy as np
+import time
+
+# Load test of a microscope server with a mix of simulated clients:
+#
+#   pollers      read values in a loop, like dashboards without websocket
+#   acquirers    acquire frames in a loop
+#   controllers  change the STEM magnification (to distinct values, restored at the end)
+#   listeners    receive the change events of the websocket (server_with_events only)
+#
+# e.g. against scripts/start-remote-dummy-server-with-events.py:
+#
+#   python scripts/load-generator.py --pollers 20 --acquirers 2 --controllers 2 --listeners 50
+#
+# Prints the request and error counts per reporting interval and at the end the latency percentiles
+# per method and the event delivery lag (from the start of a change to the websocket message
+# with the new value; only changes published with the value set are matched).
+POLL_METHODS = ["get_stage_position", "get_image_shift", "get_beam_blanked", "get_stem_magnification",
+                "get_projection_mode_string"]
+CONTROL_KEY = "stem_magnification"
+CONTROL_STEPS = 50
+
+
+class Recorder(object):
+    """Thread-safe collection of latencies per method and of errors over time"""
+    def __init__(self):
+        self.lock = Lock()
+        self.latencies = {}
+        self.errors = {}
+        self.event_lags = []
+        self.events = 0
+        self.unmatched_changes = 0
+        self.interval_requests = 0
+        self.interval_errors = 0
+        self.interval_latencies = []
+
+    def call(self, name, func, *args, **kw):
+        start = time.time()
+        try:
+            result = func(*args, **kw)
+        except Exception:
+            with self.lock:
+                self.errors[name] = self.errors.get(name, 0) + 1
+                self.latencies.setdefault(name, [])
+                self.interval_requests += 1
+                self.interval_errors += 1
+            return None
+        latency = time.time() - start
+        with self.lock:
+            self.latencies.setdefault(name, []).append(latency)
+            self.interval_requests += 1
+            self.interval_latencies.append(latency)
+        return result
+
+    def take_interval(self):
+        with self.lock:
+            result = self.interval_requests, self.interval_errors, self.interval_latencies
+            self.interval_requests = self.interval_errors = 0
+            self.interval_latencies = []
+        return result
+
+
+def percentiles(values):
+    if not values:
+        return [float("nan")] * 3
+    return list(np.percentile(values, [50, 95, 99]))
+
+
+def sleep_until(deadline, stop):
+    delay = deadline - time.time()
+    if delay > 0:
+        stop.wait(delay)
+
+
+def poller(args, recorder, stop):
+    microscope = RemoteMicroscope((args.host, args.port), transport=args.transport)
+    methods = args.poll_methods.split(",")
+    next_time = time.time()
+    while not stop.is_set():
+        for method in methods:
+            recorder.call(method, getattr(microscope, method))
+        next_time += args.poll_interval
+        sleep_until(next_time, stop)
+
+
+def acquirer(args, recorder, stop):
+    microscope = RemoteMicroscope((args.host, args.port), transport=args.transport)
+    next_time = time.time()
+    while not stop.is_set():
+        recorder.call("acquire", microscope.acquire, args.detector)
+        next_time += args.acquire_interval
+        sleep_until(next_time, stop)
+
+
+def control_value_key(value):
+    return "%.6g" % value
+
+
+def controller(args, recorder, stop, pending, index):
+    microscope = RemoteMicroscope((args.host, args.port), transport=args.transport)
+    initial = recorder.call("get_" + CONTROL_KEY, getattr(microscope, "get_" + CONTROL_KEY))
+    if initial is None:
+        return
+    setter = getattr(microscope, "set_" + CONTROL_KEY)
+    step = index
+    next_time = time.time()
+    while not stop.is_set():
+        # distinct values (beyond the deadbands), so the events can be matched
+        step = step % CONTROL_STEPS + 1
+        value = initial * (1.0 + 0.002 * step)
+        with recorder.lock:
+            pending[control_value_key(value)] = time.time()
+        recorder.call("set_" + CONTROL_KEY, setter, value)
+        next_time += args.control_interval
+        sleep_until(next_time, stop)
+    recorder.call("set_" + CONTROL_KEY, setter, initial)
+
+
+async def listener(args, recorder, stop, pending):
+    import aiohttp
+    url = "ws://%s:%d/ws/v1" % (args.host, args.port)
+    try:
+        async with aiohttp.ClientSession() as session:
+            async with session.ws_connect(url) as ws:
+                while not stop.is_set():
+                    try:
+                        msg = await ws.receive(timeout=0.5)
+                    except asyncio.TimeoutError:
+                        continue
+                    if msg.type != aiohttp.WSMsgType.TEXT:
+                        break
+                    received = time.time()
+                    changes = json.loads(msg.data)
+                    with recorder.lock:
+                        recorder.events += 1
+                        if CONTROL_KEY in changes:
+                            sent = pending.get(control_value_key(changes[CONTROL_KEY]))
+                            if sent is not None:
+                                recorder.event_lags.append(received - sent)
+                            else:
+                                recorder.unmatched_changes += 1
+    except Exception:
+        with recorder.lock:
+            recorder.errors["websocket"] = recorder.errors.get("websocket", 0) + 1
+
+
+def run_listeners(args, recorder, stop, pending):
+    async def run_all():
+        await asyncio.gather(*[listener(args, recorder, stop, pending) for n in range(args.listeners)])
+    asyncio.run(run_all())
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--host", type=str, default="127.0.0.1", help="Host of the server")
+parser.add_argument("--port", type=int, default=8080, help="Port of the server")
+parser.add_argument("--transport", type=str, default="JSON", help="Transport of the RemoteMicroscope clients")
+parser.add_argument("--duration", type=float, default=30.0, help="Duration of the test in seconds")
+parser.add_argument("--report-interval", type=float, default=5.0, help="Seconds between the progress reports")
+parser.add_argument("--pollers", type=int, default=10, help="Number of polling clients")
+parser.add_argument("--poll-interval", type=float, default=0.2, help="Seconds between the poll cycles of a client")
+parser.add_argument("--poll-methods", type=str, default=",".join(POLL_METHODS), help="Methods called by the pollers")
+parser.add_argument("--acquirers", type=int, default=1, help="Number of acquiring clients")
+parser.add_argument("--acquire-interval", type=float, default=1.0, help="Seconds between the acquisitions of a client")
+parser.add_argument("--detector", type=str, default="CCD", help="Detector of the acquisitions")
+parser.add_argument("--controllers", type=int, default=1, help="Number of controlling clients")
+parser.add_argument("--control-interval", type=float, default=0.5, help="Seconds between the changes of a client")
+parser.add_argument("--listeners", type=int, default=0, help="Number of websocket clients")
+args = parser.parse_args()
+
+recorder = Recorder()
+stop = Event()
+pending = {}
+threads = [Thread(target=poller, args=(args, recorder, stop)) for n in range(args.pollers)]
+threads += [Thread(target=acquirer, args=(args, recorder, stop)) for n in range(args.acquirers)]
+threads += [Thread(target=controller, args=(args, recorder, stop, pending, n * CONTROL_STEPS // max(1, args.controllers)))
+            for n in range(args.controllers)]
+if args.listeners:
+    threads.append(Thread(target=run_listeners, args=(args, recorder, stop, pending)))
+for thread in threads:
+    thread.daemon = True
+    thread.start()
+
+print("%8s %10s %8s %10s %10s" % ("time s", "requests", "errors", "error %", "p95 ms"))
+start = time.time()
+try:
+    while time.time() - start < args.duration:
+        time.sleep(min(args.report_interval, max(0.0, args.duration - (time.time() - start))))
+        requests, errors, latencies = recorder.take_interval()
+        print("%8.1f %10d %8d %10.2f %10.2f" % (time.time() - start, requests, errors,
+                                                 100.0 * errors / requests if requests else 0.0,
+                                                 percentiles(latencies)[1] * 1e3))
+except KeyboardInterrupt:
+    pass
+stop.set()
+for thread in threads:
+    thread.join()
+
+print()
+print("%-32s %8s %8s %10s %10s %10s" % ("method", "calls", "errors", "p50 ms", "p95 ms", "p99 ms"))
+for name, latencies in sorted(recorder.latencies.items()):
+    p50, p95, p99 = percentiles(latencies)
+    print("%-32s %8d %8d %10.2f %10.2f %10.2f" % (name, len(latencies), recorder.errors.get(name, 0),
+                                                   p50 * 1e3, p95 * 1e3, p99 * 1e3))
+if args.listeners:
+    p50, p95, p99 = percentiles(recorder.event_lags)
+    print("%-32s %8d %8d %10.2f %10.2f %10.2f" % ("event lag (%s)" % CONTROL_KEY, len(recorder.event_lags),
+                                                   recorder.errors.get("websocket", 0), p50 * 1e3, p95 * 1e3, p99 * 1e3))
+    print("%d websocket messages, %d changes without matching set value" % (recorder.events, recorder.unmatched_changes))
@@ -0,0 +1,54 @@
+from temscript import server
+from temscript.null_microscope import NullMicroscope
+from temscript.remote_microscope import RemoteMicroscope
+from temscript.trace import read_trace, recorded_latency, replay
+from threading import Thread
+import argparse
+
+# Replays the microscope calls recorded by "temscript-server --trace FILE":
+#
+#   python scripts/replay-trace.py FILE                 against a NullMicroscope with the recorded latencies
+#   python scripts/replay-trace.py FILE --via-server    ... via a local dummy server (HTTP or RPC transport)
+#   python scripts/replay-trace.py FILE --host H --port P     against a running server
+
+
+class QuietHandler(server.MicroscopeHandler):
+    def log_message(self, format, *args):
+        pass
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument("trace", help="Trace file")
+parser.add_argument("--speed", type=float, default=1.0, help="Factor of the replay speed (0: as fast as possible)")
+parser.add_argument("--via-server", action="store_true", help="Replay via a local dummy server")
+parser.add_argument("--host", type=str, default=None, help="Replay against the server on this host")
+parser.add_argument("--port", type=int, default=8080, help="Port of the server")
+parser.add_argument("--transport", type=str, default="JSON", help="Transport of the RemoteMicroscope")
+args = parser.parse_args()
+
+header, records = read_trace(args.trace)
+latency = recorded_latency(records)
+null_latency = dict((method, seconds) for method, seconds in latency.items() if hasattr(NullMicroscope, method))
+make_null_microscope = lambda: NullMicroscope(wait_exposure=False, latency=null_latency)
+print("%d calls of %d methods, %.1f s" % (len(records), len(set(record.method for record in records)),
+                                          records[-1].start if records else 0.0))
+
+if args.host is not None:
+    microscope = lambda: RemoteMicroscope((args.host, args.port), transport=args.transport)
+elif args.via_server:
+    dummy_server = server.NullMicroscopeServer(("127.0.0.1", 0), QuietHandler, microscope_factory=make_null_microscope)
+    address = dummy_server.server_address
+    if args.transport == "RPC":
+        address = ("127.0.0.1", server.start_rpc_servers(dummy_server, "127.0.0.1", 0)[0].server_address[1])
+    Thread(target=dummy_server.serve_forever, daemon=True).start()
+    microscope = lambda: RemoteMicroscope(address, transport=args.transport)
+else:
+    microscope = make_null_microscope()
+
+stats = replay(records, microscope, speed=args.speed)
+
+print("%-32s %6s %6s %12s %12s %12s %12s" % ("method", "calls", "errors", "recorded ms", "mean ms", "max ms", "lag max ms"))
+for method, entry in sorted(stats.items()):
+    print("%-32s %6d %6d %12.2f %12.2f %12.2f %12.2f" % (method, entry["calls"], entry["errors"],
+                                                          entry["recorded_mean"] * 1e3, entry["mean"] * 1e3,
+                                                          entry["max"] * 1e3, entry["lag_max"] * 1e3))
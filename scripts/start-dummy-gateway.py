@@ -0,0 +1,23 @@
+from temscript import server
+from temscript import gateway
+from threading import Thread
+
+# for testing the gateway without actual microscopes: starts three dummy
+# microscope servers on localhost, ports 8081-8083, and the gateway on port 8080
+print("Starting temscripting DUMMY Microscope Gateway...")
+try:
+    backends = []
+    for n in range(3):
+        port = 8081 + n
+        temscripting_server = server.NullMicroscopeServer(("127.0.0.1", port), server.MicroscopeHandler)
+        Thread(target=temscripting_server.serve_forever, daemon=True).start()
+        backends.append("dummy%d=127.0.0.1:%d" % (n + 1, port))
+
+    argv = ["--port", "8080"]
+    for backend in backends:
+        argv += ["--backend", backend]
+    gateway.run_gateway(argv)
+except Exception as exc:
+    print("Caught exception %s" % exc)
+
+print("Done.")
@@ -20,36 +20,42 @@ log.info("Starting DUMMY temscripting Microscope HTTP Server with "
          "Websocket Events version %s..." % __version__)
 try:
     # start remote server with events on localhost with default port 8080
-    microscope = NullMicroscope()
+    # simulated specimen: frames depend on defocus (e.g. for "/v1/autofocus")
+    microscope = NullMicroscope(specimen=True)
 
     temscripting_server = server_with_events.MicroscopeServerWithEvents(
-        microscope=microscope, host="0.0.0.0", port=port)
+        microscope=microscope, host="0.0.0.0", port=port,
+        history=server_with_events.create_history(config),
+        coalesce_window=config["coalesce_window"],
+        server_timing=config["server_timing"],
+        slow_log=server_with_events.create_slow_log(config),
+        max_frames=config["max_frames"])
     # define all TEMScripting methods which should be polled
     # during one polling event via the web server.
     # value is a tuple consisting of a conversion method
-    # (e.g. "float()") and a scaling factor (for int/float)
-    # for the result of the method
+    # (e.g. "float()") and a deadband (None: any difference
+    # is a change) for the result of the method
     tem_scripting_method_config = {
         # for meta data key 'condenser.mode'
-        "instrument_mode_string": (str, 1),     # "TEM"/"STEM"
-        "illumination_mode":      (int, 1),     # e.g., 0 ("NANOPROBE"), 1: ("MICROPROBE")
-        "df_mode_string": (str, 1),             # e.g., "CARTESIAN", "OFF"
-        "spot_size_index": (int, 1),            # e.g., 3
-        "condenser_mode_string": (str, 1),      # e.g., "PROBE"
-        "beam_blanked": (bool, 1),              # True, False
+        "instrument_mode_string": (str, None),                                          # "TEM"/"STEM"
+        "illumination_mode": (int, None),                                               # e.g., 0 ("NANOPROBE"), 1: ("MICROPROBE")
+        "df_mode_string": (str, None),                                                  # e.g., "CARTESIAN", "OFF"
+        "spot_size_index": (int, None),                                                 # e.g., 3
+        "condenser_mode_string": (str, None),                                           # e.g., "PROBE"
+        "beam_blanked": (bool, None),                                                   # True, False
         # for meta data key 'electron_gun.voltage'
-        "voltage": (float, 1),                  # e.g., "200"
+        "voltage": (float, server_with_events.Deadband(relative=1e-6)),                 # e.g., "200"
         # for backend key 'microscope.elementValues.HTOffset'
-        "voltage_offset": (float, 1),           # e.g., "0.1"
+        "voltage_offset": (float, server_with_events.Deadband(absolute=1e-3)),          # e.g., "0.1"
         # for meta data key "objective.mode -> projector.camera_length"
-        "indicated_camera_length": (float, 1),  # e.g., "0.028999", in meters
+        "indicated_camera_length": (float, server_with_events.Deadband(relative=1e-3)), # e.g., "0.028999", in meters
         # for meta data key "objective.mode -> projector.magnification"
-        "indicated_magnification": (float, 1),  # e.g., 200000.0
+        "indicated_magnification": (float, server_with_events.Deadband(relative=1e-3)), # e.g., 200000.0
         # for meta data key "objective.mode -> projector.mode"
-        "projection_mode_string": (str, 1),     # e.g., "SA"
-        "projection_mode_type_string": (str, 1),# e.g., "IMAGING"
+        "projection_mode_string": (str, None),                                          # e.g., "SA"
+        "projection_mode_type_string": (str, None),                                     # e.g., "IMAGING"
         # for meta data key "objective.mode -> scan_driver.magnification"
-        "stem_magnification": (float, 1),       # e.g., "6000"
+        "stem_magnification": (float, server_with_events.Deadband(relative=1e-3)),      # e.g., "6000"
     }
 
     microscope_event_publisher = server_with_events.\
@@ -12,11 +12,27 @@ with open("temscript/version.py") as fp:
 
 # Only build _temscript c++ adapter on windows platforms
 if sys.platform == 'win32':
+    # Generate enum name tables (_temscript_module/enumnames.h) from temscript/enums.py
+    sys.path.insert(0, '_temscript_module')
+    import generate_enumnames
+    generate_enumnames.main()
+    del sys.path[0]
+
     py_includes = [os.path.join(get_python_inc(), '../Lib/site-packages/numpy/core/include/')]
     ext_modules = [Extension('_temscript', glob.glob(os.path.join('_temscript_module', '*.cpp')), include_dirs=py_includes)]
 else:
     ext_modules = []
 
+# Frame codec (no COM, built on all platforms, so clients can decode compressed frames).
+# Optional: without a C++ compiler the build is skipped, the package stays pure Python
+# and clients simply don't request compressed frames (see temscript.framecodec).
+if sys.platform == 'win32':
+    codec_args = []
+else:
+    codec_args = ['-std=c++11', '-pthread']
+ext_modules.append(Extension('_temscript_codec', [os.path.join('_temscript_codec', 'codec.cpp')],
+                             extra_compile_args=codec_args, extra_link_args=codec_args, optional=True))
+
 setup(name='temscript',
       version=__version__,
       description='TEM Scripting adapter for FEI microscopes',
@@ -0,0 +1,170 @@
+"""
+Multi-frame accumulation.
+
+Low dose acquisitions take many short exposures. Instead of transferring each frame, the
+frames are summed (or averaged) where they are acquired, optionally aligned to the first
+frame by the drift measurement (:mod:`temscript.drift`, shifts rounded to whole pixels).
+
+Uses the native :class:`_temscript.FrameAccumulator` where available, otherwise an equivalent
+numpy implementation.
+"""
+from __future__ import division, print_function
+import numpy as np
+from .drift import create_drift_kernel
+from .framepool import release_images
+
+try:
+    from _temscript import FrameAccumulator as _NativeFrameAccumulator
+except ImportError:
+    _NativeFrameAccumulator = None
+
+
+class NumpyFrameAccumulator(object):
+    """
+    Sum of frames (numpy implementation of the native FrameAccumulator, same interface).
+
+    :param height: Frame height (pixels)
+    :param width: Frame width (pixels)
+    :param dtype: dtype of the sum, int32 or float32
+    """
+    def __init__(self, height, width, dtype="int32"):
+        dtype = np.dtype(dtype)
+        if dtype not in (np.dtype(np.int32), np.dtype(np.float32)):
+            raise ValueError("Expected dtype int32 or float32")
+        self.Height, self.Width = int(height), int(width)
+        self.Sum = np.zeros((self.Height, self.Width), dtype=dtype)
+        self.Count = 0
+
+    def Add(self, frame, dx=0, dy=0):
+        """
+        Add frame shifted by (dx, dy) whole pixels: sum[y, x] += frame[y + dy, x + dx],
+        pixels outside the frame add nothing. Returns (mean, min, max) of the frame.
+        """
+        frame = np.asarray(frame)
+        if frame.shape != self.Sum.shape:
+            raise ValueError("Expected frame of shape (%d, %d)" % (self.Height, self.Width))
+        dx, dy = int(dx or 0), int(dy or 0)
+        h, w = self.Sum.shape
+        dst = self.Sum[max(0, -dy):min(h, h - dy), max(0, -dx):min(w, w - dx)]
+        src = frame[max(0, dy):min(h, h + dy), max(0, dx):min(w, w + dx)]
+        if dst.size:
+            dst += src.astype(self.Sum.dtype, copy=False)
+        self.Count += 1
+        return float(frame.mean()), float(frame.min()), float(frame.max())
+
+    def Reset(self):
+        """Clear sum"""
+        self.Sum.fill(0)
+        self.Count = 0
+
+
+def create_frame_accumulator(height, width, dtype="int32"):
+    """Create native FrameAccumulator if available, otherwise NumpyFrameAccumulator"""
+    if _NativeFrameAccumulator is not None:
+        return _NativeFrameAccumulator(height, width, dtype=dtype)
+    return NumpyFrameAccumulator(height, width, dtype=dtype)
+
+
+class FrameAccumulation(object):
+    """
+    Accumulation of 'frames' acquisitions from all detectors, one acquisition per :meth:`step`.
+
+    Servers run each step as a call of its own, so requests of higher priority get to the
+    microscope between the frames (see :mod:`temscript.scheduler`). Each frame is handed back
+    to the microscope (see :meth:`Microscope.release_images`) as soon as it is added.
+
+    :param microscope: Microscope-like object used for acquisition
+    :param detectors: Sequence of detector names
+    :param frames: Number of acquisitions (>= 1)
+    :param average: Whether to return the average (float32) instead of the sum (int32)
+    :param align: Whether to shift the frames onto the first frame before adding
+    :param stats: Whether to add per frame statistics to the result
+    """
+    def __init__(self, microscope, detectors, frames, average=False, align=False, stats=False):
+        self.frames = int(frames)
+        if self.frames < 1:
+            raise ValueError("Expected at least one frame")
+        self.microscope = microscope
+        self.detectors = list(detectors)
+        self.average = average
+        self.align = align
+        self.stats = stats
+        self.acquired = 0
+        self._dtype = "float32" if average else "int32"
+        self._accumulators = {}
+        self._kernels = {}
+        self._frame_stats = {}
+
+    @property
+    def done(self):
+        """Whether all frames are acquired"""
+        return self.acquired >= self.frames
+
+    def step(self):
+        """Acquire and add the next frame of all detectors. Returns whether frames remain."""
+        if self.done:
+            return False
+        images = self.microscope.acquire(*self.detectors)
+        try:
+            for name, frame in images.items():
+                acc = self._accumulators.get(name)
+                if acc is None:
+                    acc = self._accumulators[name] = create_frame_accumulator(frame.shape[0], frame.shape[1],
+                                                                              self._dtype)
+                    self._frame_stats[name] = []
+                dx = dy = 0
+                record = {}
+                if self.align:
+                    kernel = self._kernels.get(name)
+                    if kernel is None:
+                        self._kernels[name] = create_drift_kernel(frame)
+                        fx, fy, confidence = 0.0, 0.0, 1.0
+                    else:
+                        fx, fy, confidence = kernel.Measure(frame)
+                    dx, dy = int(round(fx)), int(round(fy))
+                    record = {"dx": fx, "dy": fy, "confidence": confidence}
+                mean, low, high = acc.Add(frame, dx, dy)
+                if self.stats:
+                    record.update(mean=mean, min=low, max=high)
+                    self._frame_stats[name].append(record)
+        finally:
+            release_images(self.microscope, images)
+        self.acquired += 1
+        return not self.done
+
+    def result(self):
+        """
+        :returns: dict detector name -> accumulated array, with entry "frame_stats" (if 'stats'):
+            dict detector name -> list of dicts with "mean", "min" and "max" of each frame
+            (and "dx", "dy", "confidence" of the alignment, if 'align')
+        """
+        result = {}
+        for name, acc in self._accumulators.items():
+            image = acc.Sum
+            if self.average:
+                image /= acc.Count
+            result[name] = image
+        if self.stats:
+            result["frame_stats"] = self._frame_stats
+        return result
+
+
+def accumulate_frames(microscope, detectors, frames, average=False, align=False, stats=False):
+    """
+    Acquire 'frames' times from all detectors and accumulate the frames per detector
+    (all steps of a :class:`FrameAccumulation` at once).
+
+    :param microscope: Microscope-like object used for acquisition
+    :param detectors: Sequence of detector names
+    :param frames: Number of acquisitions (>= 1)
+    :param average: Whether to return the average (float32) instead of the sum (int32)
+    :param align: Whether to shift the frames onto the first frame before adding
+    :param stats: Whether to add per frame statistics to the result
+    :returns: dict detector name -> accumulated array, with entry "frame_stats" (if 'stats'):
+        dict detector name -> list of dicts with "mean", "min" and "max" of each frame
+        (and "dx", "dy", "confidence" of the alignment, if 'align')
+    """
+    accumulation = FrameAccumulation(microscope, detectors, frames, average=average, align=align, stats=stats)
+    while accumulation.step():
+        pass
+    return accumulation.result()
@@ -0,0 +1,185 @@
+"""
+Autofocus by defocus sweep.
+
+The objective defocus (:attr:`Projection.Defocus`) is stepped through a range around the
+current value, a frame is acquired at each step and rated by a sharpness metric. The
+optimum is the vertex of a parabola fitted to the best rated steps and their neighbours
+(or the best step, where the fit fails). All metrics are evaluated on the whole frame with
+numpy operations, so a sweep costs little more than the acquisitions themselves.
+"""
+from __future__ import division, print_function
+import time
+import numpy as np
+from .framepool import release_images
+
+
+def _normalize(value, frame):
+    # independent of the intensity, so changing illumination is no change of focus
+    mean = float(frame.mean())
+    return value / (mean * mean) if mean != 0.0 else value
+
+
+def variance_sharpness(frame):
+    """Normalized variance of the frame"""
+    return _normalize(float(frame.var()), frame)
+
+
+def gradient_sharpness(frame):
+    """Normalized gradient energy: mean squared difference of neighbouring pixels"""
+    gx = np.diff(frame, axis=1)
+    gy = np.diff(frame, axis=0)
+    return _normalize(float((gx * gx).mean() + (gy * gy).mean()), frame)
+
+
+def fft_sharpness(frame, cutoff=0.1):
+    """
+    Fraction of the spectral power (without DC) above the spatial frequency 'cutoff'
+    (in units of the Nyquist frequency).
+    """
+    power = np.abs(np.fft.rfft2(frame - frame.mean()))
+    power *= power
+    fy = np.fft.fftfreq(frame.shape[0])[:, np.newaxis]
+    fx = np.fft.rfftfreq(frame.shape[1])[np.newaxis, :]
+    high = (fx * fx + fy * fy) > (0.5 * cutoff) ** 2
+    total = float(power.sum())
+    return float(power[high].sum()) / total if total > 0.0 else 0.0
+
+
+SHARPNESS_METRICS = {
+    "variance": variance_sharpness,
+    "gradient": gradient_sharpness,
+    "fft": fft_sharpness,
+}
+
+
+def sharpness(frame, metric="variance"):
+    """
+    Rate sharpness of frame (higher is sharper).
+
+    :param frame: 2D array
+    :param metric: "variance", "gradient" or "fft"
+    """
+    try:
+        func = SHARPNESS_METRICS[metric]
+    except KeyError:
+        raise ValueError("Unknown sharpness metric: %s" % metric)
+    return func(np.asarray(frame, dtype=np.float64))
+
+
+def fit_optimum(defoci, values, points=5):
+    """
+    Fit parabola through the best rated sample and its neighbours.
+
+    :returns: Tuple (defocus, fitted). fitted is False, if the fit gave no maximum
+        inside the fitted range and the defocus of the best sample was returned instead.
+    """
+    defoci = np.asarray(defoci, dtype=np.float64)
+    values = np.asarray(values, dtype=np.float64)
+    best = int(np.argmax(values))
+    if len(defoci) >= 3:
+        half = max(1, points // 2)
+        lo = max(0, min(best - half, len(defoci) - 2 * half - 1))
+        hi = min(len(defoci), lo + 2 * half + 1)
+        x, y = defoci[lo:hi], values[lo:hi]
+        # fit in scaled coordinates, defocus values are ~1e-6
+        x0, scale = x.mean(), np.ptp(x) or 1.0
+        a, b, c = np.polyfit((x - x0) / scale, y, 2)
+        if a < 0.0:
+            vertex = x0 - scale * b / (2.0 * a)
+            if x.min() <= vertex <= x.max():
+                return float(vertex), True
+    return float(defoci[best]), False
+
+
+class Autofocus(object):
+    """
+    Defocus sweep on a microscope-like object (Microscope, NullMicroscope, ...).
+
+    :param microscope: Microscope-like object with get_defocus/set_defocus/acquire
+    :param detector: Detector name used for acquisition
+    :param metric: Sharpness metric ("variance", "gradient" or "fft")
+    :param span: Width of the sweep (meters), centered on 'center'
+    :param steps: Number of frames in the sweep (>= 3)
+    :param center: Center defocus of the sweep (meters, None: current defocus)
+    :param settle_time: Time (seconds) to wait after each defocus change
+    """
+    def __init__(self, microscope, detector="CCD", metric="variance", span=2e-6, steps=9,
+                 center=None, settle_time=0.0):
+        if metric not in SHARPNESS_METRICS:
+            raise ValueError("Unknown sharpness metric: %s" % metric)
+        if int(steps) < 3:
+            raise ValueError("Autofocus needs at least 3 steps")
+        if not span > 0:
+            raise ValueError("Autofocus span must be positive")
+        self.microscope = microscope
+        self.detector = detector
+        self.metric = metric
+        self.span = float(span)
+        self.steps = int(steps)
+        self.center = float(center) if center is not None else None
+        self.settle_time = float(settle_time)
+
+    @classmethod
+    def from_dict(cls, microscope, params):
+        """Create from JSON parameters ("detector", "metric", "span", "steps", "center", "settle_time")"""
+        if params is None:
+            params = {}
+        if not isinstance(params, dict):
+            raise ValueError("Autofocus parameters must be an object")
+        unknown = set(params) - {"detector", "metric", "span", "steps", "center", "settle_time"}
+        if unknown:
+            raise ValueError("Unknown autofocus parameters: %s" % ", ".join(sorted(unknown)))
+        return cls(microscope, **params)
+
+    def sweep(self):
+        """
+        Generator running the sweep: yields a progress dict after each frame and
+        a final dict with "state" "done", when the optimum was set. On error, or when
+        the generator is closed before the end, the initial defocus is restored: close
+        it explicitly where microscope calls are allowed (e.g. in the scheduler lane).
+        """
+        initial = self.microscope.get_defocus()
+        center = initial if self.center is None else self.center
+        defoci = center + np.linspace(-0.5 * self.span, 0.5 * self.span, self.steps)
+        values = []
+        try:
+            for index, defocus in enumerate(defoci):
+                self.microscope.set_defocus(float(defocus))
+                if self.settle_time > 0:
+                    time.sleep(self.settle_time)
+                images = self.microscope.acquire(self.detector)
+                values.append(sharpness(images[self.detector], self.metric))
+                release_images(self.microscope, images)
+                yield {
+                    "state": "sweeping",
+                    "step": index + 1,
+                    "steps": self.steps,
+                    "defocus": float(defocus),
+                    "sharpness": values[-1],
+                }
+            best, fitted = fit_optimum(defoci, values)
+            self.microscope.set_defocus(best)
+        except (Exception, GeneratorExit):
+            self.microscope.set_defocus(initial)
+            raise
+        yield {
+            "state": "done",
+            "defocus": best,
+            "fitted": fitted,
+            "initial_defocus": initial,
+            "metric": self.metric,
+            "samples": [[float(d), v] for d, v in zip(defoci, values)],
+        }
+
+    def run(self, progress=None):
+        """
+        Run the sweep and set the optimal defocus.
+
+        :param progress: Optional callable receiving each progress dict
+        :returns: final dict (see sweep())
+        """
+        result = None
+        for result in self.sweep():
+            if progress is not None:
+                progress(result)
+        return result
@@ -0,0 +1,111 @@
+from __future__ import division, print_function
+import threading
+import time
+
+
+class _Entry(object):
+    __slots__ = ("done", "result", "error", "finished", "generation")
+
+    def __init__(self, generation):
+        self.done = threading.Event()
+        self.result = None
+        self.error = None
+        self.finished = None
+        self.generation = generation
+
+
+class RequestCoalescer(object):
+    """
+    Single-flight execution of identical read requests.
+
+    Requests with the same key share one call of the compute function: a request
+    arriving while the call is running waits for its result, a request arriving
+    less than 'window' seconds after the call finished gets the same result.
+    Failed calls are shared with the waiting requests, but not kept.
+
+    invalidate() starts a new generation: calls of older generations (which may have
+    read the microscope before a change) are neither joined nor kept.
+
+    :param window: Time in seconds a result is reused after the call finished (0: only share running calls)
+    :type window: float
+    """
+    def __init__(self, window=0.0):
+        if window < 0:
+            raise ValueError("Coalescing window must not be negative.")
+        self.window = float(window)
+        self._lock = threading.Lock()
+        self._entries = {}
+        self._generation = 0
+        self._requests = 0
+        self._hits = 0
+
+    def get(self, key, compute):
+        """
+        Return result of compute() for key, sharing it with identical concurrent requests.
+
+        :param key: Hashable request key (e.g. endpoint, query and accepted encodings)
+        :param compute: Callable without arguments computing the result
+        """
+        now = time.time()
+        with self._lock:
+            self._requests += 1
+            entry = self._entries.get(key)
+            if entry is not None and entry.finished is not None and now - entry.finished > self.window:
+                entry = None
+            if entry is not None and entry.generation != self._generation:
+                entry = None
+            if entry is not None:
+                self._hits += 1
+                owner = False
+            else:
+                entry = _Entry(self._generation)
+                self._entries[key] = entry
+                owner = True
+            if len(self._entries) > 256:
+                self._expire(now)
+
+        if owner:
+            try:
+                entry.result = compute()
+            except Exception as exc:
+                entry.error = exc
+            with self._lock:
+                entry.finished = time.time()
+                if entry.error is not None or self.window <= 0 or entry.generation != self._generation:
+                    if self._entries.get(key) is entry:
+                        del self._entries[key]
+            entry.done.set()
+        else:
+            entry.done.wait()
+
+        if entry.error is not None:
+            raise entry.error
+        return entry.result
+
+    def invalidate(self):
+        """
+        Forget results, e.g. after the microscope state was changed. Running calls are
+        not joined by later requests and their results are not kept.
+        """
+        with self._lock:
+            self._generation += 1
+            self._entries.clear()
+
+    def _expire(self, now):
+        """Drop finished entries older than the window (lock must be held)"""
+        for key in [key for key, entry in self._entries.items()
+                    if entry.finished is not None and now - entry.finished > self.window]:
+            del self._entries[key]
+
+    def stats(self):
+        """
+        Return dict with coalescing metrics: "window", "requests", "hits" (requests served
+        by another request's call) and "hit_rate".
+        """
+        with self._lock:
+            return {
+                "window": self.window,
+                "requests": self._requests,
+                "hits": self._hits,
+                "hit_rate": self._hits / self._requests if self._requests else 0.0,
+            }
@@ -0,0 +1,136 @@
+"""
+Drift measurement by phase correlation.
+
+Uses the native :class:`_temscript.DriftKernel` where available, otherwise an equivalent
+numpy implementation: Frames are converted to float, the mean is subtracted, a separable
+Hann window is applied and the frame is zero padded to power of two size. The shift is the
+position of the peak of the phase correlation, refined by parabolic fits along x and y.
+"""
+from __future__ import division, print_function
+import threading
+import numpy as np
+from .framepool import release_images
+
+try:
+    from _temscript import DriftKernel as _NativeDriftKernel
+except ImportError:
+    _NativeDriftKernel = None
+
+
+def _next_power_of_two(n):
+    p = 1
+    while p < n:
+        p <<= 1
+    return p
+
+
+def _hann(n, window):
+    if not window or n < 2:
+        return np.ones(n)
+    return 0.5 - 0.5 * np.cos(2.0 * np.pi * np.arange(n) / (n - 1))
+
+
+def _parabolic_offset(left, center, right):
+    denom = left - 2.0 * center + right
+    if denom == 0.0:
+        return 0.0
+    return min(0.5, max(-0.5, 0.5 * (left - right) / denom))
+
+
+class NumpyDriftKernel(object):
+    """
+    Phase correlation against a cached reference spectrum (numpy implementation of
+    the native DriftKernel, same interface).
+
+    :param reference: Reference frame (2D array)
+    :param window: Whether to apply a Hann window before the FFT
+    """
+    def __init__(self, reference, window=True):
+        self.Window = bool(window)
+        self.SetReference(reference)
+
+    def _transform(self, frame):
+        frame = np.asarray(frame, dtype=np.float64)
+        if frame.shape != (self.Height, self.Width):
+            raise ValueError("Expected frame of shape (%d, %d)" % (self.Height, self.Width))
+        padded = np.zeros((self._fft_height, self._fft_width))
+        padded[:self.Height, :self.Width] = (frame - frame.mean()) * self._wy[:, np.newaxis] * self._wx[np.newaxis, :]
+        return np.fft.fft2(padded)
+
+    def SetReference(self, reference):
+        reference = np.asarray(reference, dtype=np.float64)
+        if reference.ndim != 2:
+            raise ValueError("Expected 2D frame")
+        self.Height, self.Width = reference.shape
+        self._fft_height = _next_power_of_two(self.Height)
+        self._fft_width = _next_power_of_two(self.Width)
+        self._wx = _hann(self.Width, self.Window)
+        self._wy = _hann(self.Height, self.Window)
+        self._reference = self._transform(reference)
+
+    def Measure(self, frame):
+        """Returns tuple (dx, dy, confidence) of frame relative to reference"""
+        cross = self._transform(frame) * np.conj(self._reference)
+        mag = np.abs(cross)
+        cross = np.where(mag > 1e-300, cross / np.where(mag > 1e-300, mag, 1.0), 0.0)
+        corr = np.fft.ifft2(cross).real
+        py, px = np.unravel_index(np.argmax(corr), corr.shape)
+        h, w = corr.shape
+        peak = corr[py, px]
+        sx = px + _parabolic_offset(corr[py, (px - 1) % w], peak, corr[py, (px + 1) % w])
+        sy = py + _parabolic_offset(corr[(py - 1) % h, px], peak, corr[(py + 1) % h, px])
+        if sx >= w / 2.0:
+            sx -= w
+        if sy >= h / 2.0:
+            sy -= h
+        return float(sx), float(sy), float(peak)
+
+
+def create_drift_kernel(reference, window=True):
+    """Create native DriftKernel if available, otherwise NumpyDriftKernel"""
+    if _NativeDriftKernel is not None:
+        return _NativeDriftKernel(reference, window=window)
+    return NumpyDriftKernel(reference, window=window)
+
+
+class DriftTracker(object):
+    """
+    Drift measurement on frames of a microscope's detectors, with one reference frame per detector
+    kept in memory. Used by the servers for the "drift" endpoint.
+
+    :param microscope: Microscope-like object used for acquisition
+    """
+    def __init__(self, microscope):
+        self.microscope = microscope
+        self._kernels = {}
+        self._lock = threading.Lock()
+
+    def reset(self, detector=None):
+        """Drop reference frame of detector (or of all detectors)"""
+        with self._lock:
+            if detector is None:
+                self._kernels.clear()
+            else:
+                self._kernels.pop(detector, None)
+
+    def measure(self, detector, reset=False, window=True):
+        """
+        Acquire frame from detector and measure its shift relative to the reference frame.
+        The first frame (or any frame with reset=True) becomes the reference.
+
+        :returns: dict with entries "detector", "dx", "dy" (pixels), "confidence" (correlation
+            peak height, 0..1) and "reference" (whether the frame became the new reference)
+        """
+        images = self.microscope.acquire(detector)
+        frame = images[detector]
+        try:
+            with self._lock:
+                kernel = self._kernels.get(detector)
+                if kernel is None or reset or (kernel.Height, kernel.Width) != frame.shape:
+                    self._kernels[detector] = create_drift_kernel(frame, window=window)
+                    return {"detector": detector, "dx": 0.0, "dy": 0.0, "confidence": 1.0, "reference": True}
+                dx, dy, confidence = kernel.Measure(frame)
+        finally:
+            # the kernels keep the transformed frames only
+            release_images(self.microscope, images)
+        return {"detector": detector, "dx": dx, "dy": dy, "confidence": confidence, "reference": False}
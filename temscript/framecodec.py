@@ -0,0 +1,88 @@
+"""
+Compressed transfer of frames.
+
+The native :mod:`_temscript_codec` module compresses integer frames much faster than gzip:
+the differences of neighbouring pixels are split into bit planes (bitshuffle) and compressed
+by a LZ compressor, in blocks in parallel threads. Clients announce support by the token
+:data:`ENCODING` in the "Accept-Encoding" header, the servers then encode the arrays of the
+response with array encoding :data:`ARRAY_ENCODING` instead of gzip compressing the response.
+
+The codec module is built on all platforms (it doesn't need the COM interface). Without it,
+clients don't announce the encoding and servers ignore it.
+"""
+from __future__ import division, print_function
+import numpy as np
+from .timing import phase
+
+try:
+    from _temscript_codec import compress as _compress, decompress as _decompress
+except ImportError:
+    _compress = _decompress = None
+
+# Token in Accept-Encoding header
+ENCODING = "x-temscript-bslz"
+
+# "encoding" of arrays in responses
+ARRAY_ENCODING = "BSLZ"
+
+
+def available():
+    """Whether the native codec is available"""
+    return _compress is not None
+
+
+def accepts_encoding(accept_encoding):
+    """Whether value of Accept-Encoding header announces the frame codec (and it is available)"""
+    if not available() or not accept_encoding:
+        return False
+    return ENCODING in [x.split(';', 1)[0].strip() for x in accept_encoding.split(",")]
+
+
+def encode_frame(array, threads=0):
+    """Compress array (in native byte order), returns bytes"""
+    array = np.ascontiguousarray(array)
+    itemsize = array.dtype.itemsize
+    if itemsize not in (1, 2, 4, 8):
+        raise ValueError("Unsupported dtype: %s" % array.dtype)
+    # differences only make sense for integers
+    with phase("compress"):
+        return _compress(array, itemsize=itemsize, delta=array.dtype.kind in "iu", threads=threads)
+
+
+def decode_frame(data, dtype, shape, threads=0):
+    """Decompress bytes returned by encode_frame() into new array of dtype and shape"""
+    out = np.empty(shape, dtype=dtype)
+    if _decompress is None:
+        raise RuntimeError("Frame codec (_temscript_codec module) not available")
+    _decompress(data, out=out, threads=threads)
+    return out
+
+
+def encode_frames(response):
+    """
+    Replace the arrays of frames (2D, or stacks of frames) among the values of dict 'response' by
+    descriptors with the compressed data (as in JSON responses, but with bytes instead of BASE64).
+    For pickled responses.
+
+    :returns: tuple (response, number of encoded frames)
+    """
+    if not isinstance(response, dict):
+        return response, 0
+    import sys
+    result = {}
+    count = 0
+    for key, value in response.items():
+        if isinstance(value, np.ndarray) and value.ndim >= 2 and value.dtype.kind in "iuf":
+            byteorder = value.dtype.byteorder
+            value = {
+                'width': value.shape[-1],
+                'height': value.shape[-2],
+                'shape': list(value.shape),
+                'type': value.dtype.name.upper(),
+                'endianness': "BIG" if byteorder == '>' else ("LITTLE" if byteorder == '<' else sys.byteorder.upper()),
+                'encoding': ARRAY_ENCODING,
+                'data': encode_frame(value),
+            }
+            count += 1
+        result[key] = value
+    return result, count
@@ -0,0 +1,86 @@
+"""
+Pool of frame buffers for acquisition.
+
+Acquiring a frame allocates a new numpy array (and the memory allocator has to find a
+large block each time). The :class:`FramePool` keeps frames handed back after use and
+returns them for the next acquisition of the same shape and dtype, so that repeated
+acquisitions (the servers, drift measurement, autofocus sweeps) reuse a few buffers.
+"""
+from __future__ import division, print_function
+import threading
+import numpy as np
+
+
+class FramePool(object):
+    """
+    Free frame buffers by shape and dtype. Thread safe.
+
+    :param max_free: Maximum number of free buffers kept per shape and dtype
+    """
+    def __init__(self, max_free=4):
+        self.max_free = int(max_free)
+        self._free = {}
+        self._lock = threading.Lock()
+        self._allocated = 0
+        self._reused = 0
+        self._returned = 0
+
+    def take(self, shape, dtype):
+        """Return free buffer of shape and dtype (contents undefined), a new one if there is none"""
+        key = (tuple(shape), np.dtype(dtype))
+        with self._lock:
+            free = self._free.setdefault(key, [])
+            if free:
+                self._reused += 1
+                return free.pop()
+            self._allocated += 1
+        return np.empty(key[0], dtype=key[1])
+
+    def give(self, array):
+        """
+        Hand back buffer for reuse. The caller must not use the array afterwards.
+        Arrays not suitable as buffer (views, non-contiguous, read-only) and arrays of
+        a shape and dtype never taken from the pool are ignored.
+
+        :returns: Whether the array was kept
+        """
+        if not isinstance(array, np.ndarray) or array.base is not None \
+                or not array.flags.c_contiguous or not array.flags.writeable:
+            return False
+        key = (array.shape, array.dtype)
+        with self._lock:
+            free = self._free.get(key)
+            if free is None or len(free) >= self.max_free or any(a is array for a in free):
+                return False
+            free.append(array)
+            self._returned += 1
+        return True
+
+    def give_all(self, images):
+        """Hand back all arrays of dict (as returned by acquire()) or sequence 'images'"""
+        if isinstance(images, dict):
+            images = images.values()
+        for array in images:
+            self.give(array)
+
+    def clear(self):
+        """Drop all free buffers"""
+        with self._lock:
+            self._free.clear()
+
+    def stats(self):
+        """Return dict with numbers of allocated, reused, returned and currently free buffers"""
+        with self._lock:
+            return {
+                "allocated": self._allocated,
+                "reused": self._reused,
+                "returned": self._returned,
+                "free": sum(len(free) for free in self._free.values()),
+            }
+
+
+def release_images(microscope, images):
+    """Hand back frames acquired by microscope-like object, if it supports buffer reuse"""
+    release = getattr(microscope, "release_images", None)
+    if release is not None and images:
+        release(images)
@@ -0,0 +1,416 @@
+#!/usr/bin/python
+from __future__ import division, print_function
+
+# require python 3.8 for aiohttp
+import sys
+if sys.hexversion < 0x03080000:
+    sys.exit("Python 3.8 (32 bit) or newer is required to run this program.")
+
+import json
+import asyncio
+import argparse
+import aiohttp
+from aiohttp import web, WSMsgType
+
+from temscript import logger
+from temscript.server_with_events import ArrayJSONEncoder, Deadband, _value_changed
+
+# initialize logger
+log = logger.getLoggerForModule("TemscriptingGateway")
+
+
+# Endpoints which do not change while the microscope server is running
+STATIC_ENDPOINTS = ("family", "microscope_id", "version", "stage_limits", "detectors")
+
+# Values polled from the backends by default (same format as the
+# polling config of the MicroscopeEventPublisher)
+DEFAULT_POLLING_CONFIG = {
+    "instrument_mode_string": (str, None),
+    "illumination_mode": (int, None),
+    "df_mode_string": (str, None),
+    "spot_size_index": (int, None),
+    "condenser_mode_string": (str, None),
+    "beam_blanked": (bool, None),
+    "voltage": (float, Deadband(relative=1e-6)),
+    "indicated_camera_length": (float, Deadband(relative=1e-3)),
+    "indicated_magnification": (float, Deadband(relative=1e-3)),
+    "projection_mode_string": (str, None),
+    "projection_mode_type_string": (str, None),
+    "stem_magnification": (float, Deadband(relative=1e-3)),
+}
+
+# Request headers passed on to the backends
+FORWARDED_REQUEST_HEADERS = ("Accept", "Accept-Encoding", "Content-Type")
+# Response headers passed back to the clients
+FORWARDED_RESPONSE_HEADERS = ("Content-Type", "Content-Encoding")
+
+
+class GatewayBackend:
+    """
+    A microscope server behind the gateway.
+
+    The state of the backend is updated by a single task, independent of the number
+    of clients of the gateway. For backends running the server with events the change
+    events are received via its websocket, otherwise the backend is polled.
+    :param microscope_id: Id under which the microscope is addressed in the gateway
+    :type microscope_id str
+    :param host: Host of the microscope server
+    :type host str
+    :param port: Port of the microscope server
+    :type port int
+    :param events: Whether the backend is a server with events (websocket "/ws/v1")
+    :type events bool
+    """
+    def __init__(self, microscope_id, host, port, events=False):
+        self.microscope_id = microscope_id
+        self.host = host
+        self.port = port
+        self.events = events
+        self.base_url = "http://%s:%d" % (host, port)
+        # last known values of the polled keys
+        self.state = dict()
+        # responses of the static endpoints: endpoint -> (status, headers, body)
+        self.static_cache = dict()
+        self.connected = False
+        self._task = None
+
+    def info(self):
+        return {
+            "microscope_id": self.microscope_id,
+            "address": "%s:%d" % (self.host, self.port),
+            "events": self.events,
+            "connected": self.connected,
+        }
+
+    @classmethod
+    def parse(cls, spec):
+        """
+        Create backend from string "ID=HOST:PORT" or "ID=HOST:PORT,events"
+        :raises ValueError: on malformed string
+        """
+        microscope_id, sep, address = spec.partition("=")
+        if not sep or not microscope_id:
+            raise ValueError("Backend must be given as ID=HOST:PORT[,events]: %s" % spec)
+        address, _, flags = address.partition(",")
+        host, sep, port = address.rpartition(":")
+        if not sep:
+            raise ValueError("Backend address must be given as HOST:PORT: %s" % spec)
+        return cls(microscope_id, host or "127.0.0.1", int(port), events=(flags == "events"))
+
+
+class MicroscopeGateway:
+    """
+    Fronts several microscope servers (see server.py and server_with_events.py)
+    under a single HTTP+websocket API.
+
+    HTTP-URLs address the microscopes by their id
+        http://127.0.0.1:8080/microscopes/<id>/v1/...
+    and are forwarded to the respective server, so RemoteMicroscope can be used
+    with base_path="/microscopes/<id>". Responses of static endpoints are cached,
+    GETs of polled keys without query are answered from the cached state.
+        http://127.0.0.1:8080/v1/microscopes
+    lists the microscopes,
+        http://127.0.0.1:8080/microscopes/<id>/state
+    returns the cached state of a microscope.
+
+    Websocket connections to
+        ws://127.0.0.1:8080/ws/v1
+    receive the changes of all microscopes as {"microscope_id": <id>, "changes": {...}},
+        ws://127.0.0.1:8080/microscopes/<id>/ws/v1
+    receive the changes of a single microscope in the format of the server with events.
+    :param backends: the microscope servers
+    :type backends list of GatewayBackend
+    :param host IP the gateway is running under.
+    :type host str
+    :param port Port the gateway is running under.
+    :type port int
+    :param sleep_time: Polling interval for backends without events in seconds
+    :type sleep_time float
+    :param polling_config: Polled keys, see MicroscopeEventPublisher
+    :type polling_config dict
+    :param timeout: Timeout of backend requests in seconds
+    :type timeout float
+    """
+    # time in seconds a websocket client may take to accept a message before it is dropped
+    WEBSOCKET_SEND_TIMEOUT = 2.0
+
+    def __init__(self, backends, host="0.0.0.0", port=8080, sleep_time=1.0,
+                 polling_config=None, timeout=10.0):
+        self.backends = dict((backend.microscope_id, backend) for backend in backends)
+        if len(self.backends) != len(backends):
+            raise ValueError("Microscope ids must be unique.")
+        self.host = host
+        self.port = port
+        self.sleep_time = sleep_time
+        self.polling_config = polling_config if polling_config is not None else DEFAULT_POLLING_CONFIG
+        self.deadbands = dict((command, entry[1]) for command, entry in self.polling_config.items()
+                              if len(entry) > 1 and isinstance(entry[1], Deadband))
+        self.timeout = timeout
+        self.session = None
+        # client references: websocket -> microscope id (None for all microscopes)
+        self.clients = dict()
+        self.clients_lock = asyncio.Lock()
+
+    def _get_backend(self, request):
+        microscope_id = request.match_info['microscope_id']
+        try:
+            return self.backends[microscope_id]
+        except KeyError:
+            raise web.HTTPNotFound(text="Unknown microscope: %s" % microscope_id)
+
+    async def _forward(self, backend, method, endpoint, request, body=None):
+        """
+        Forward request to backend
+        :return: tuple (status, headers, body)
+        """
+        headers = dict((name, request.headers[name]) for name in FORWARDED_REQUEST_HEADERS
+                       if name in request.headers)
+        url = "%s/v1/%s" % (backend.base_url, endpoint)
+        try:
+            async with self.session.request(method, url, params=request.rel_url.query, data=body,
+                                            headers=headers, auto_decompress=False) as response:
+                content = await response.read()
+                response_headers = dict((name, response.headers[name]) for name in FORWARDED_RESPONSE_HEADERS
+                                        if name in response.headers)
+                return response.status, response_headers, content
+        except (aiohttp.ClientError, asyncio.TimeoutError) as exc:
+            log.warning("Request to microscope %s failed: %s" % (backend.microscope_id, exc))
+            raise web.HTTPBadGateway(text="Microscope %s not reachable" % backend.microscope_id)
+
+    async def http_list_handler(self, request):
+        """List the microscopes behind the gateway"""
+        return web.json_response([backend.info() for backend in self.backends.values()])
+
+    async def http_state_handler(self, request):
+        """Return the cached state of a microscope"""
+        backend = self._get_backend(request)
+        return web.Response(body=ArrayJSONEncoder().encode(backend.state).encode("utf-8"),
+                            content_type="application/json")
+
+    async def http_get_handler_v1(self, request):
+        """
+        aiohttp handler for GET requests of a microscope
+        :param request: the aiohttp GET request
+        :return:  the aiohttp response
+        """
+        backend = self._get_backend(request)
+        endpoint = request.match_info['name']
+        if endpoint in backend.state and not request.rel_url.query:
+            encoded_response = ArrayJSONEncoder().encode(backend.state[endpoint]).encode("utf-8")
+            return web.Response(body=encoded_response, content_type="application/json")
+
+        # Static endpoints are cached per encoding
+        cache_key = (endpoint, request.headers.get("Accept"), request.headers.get("Accept-Encoding"))
+        cached = backend.static_cache.get(cache_key)
+        if cached is None:
+            cached = await self._forward(backend, "GET", endpoint, request)
+            if endpoint in STATIC_ENDPOINTS and cached[0] == 200:
+                backend.static_cache[cache_key] = cached
+        status, headers, body = cached
+        return web.Response(body=body, status=status, headers=headers)
+
+    async def http_put_handler_v1(self, request):
+        """
+        aiohttp handler for PUT requests of a microscope
+        :param request: the aiohttp PUT request
+        :return:  the aiohttp response
+        """
+        backend = self._get_backend(request)
+        endpoint = request.match_info['name']
+        body = await request.read()
+        status, headers, content = await self._forward(backend, "PUT", endpoint, request, body=body)
+        if status in (200, 204):
+            # answer GETs from backend until the value is polled again
+            backend.state.pop(endpoint, None)
+        return web.Response(body=content, status=status, headers=headers)
+
+    async def websocket_handler_v1(self, request):
+        """
+        aiohttp websocket handler, for all microscopes or a single microscope
+        (if the route contains the microscope id)
+        """
+        microscope_id = None
+        if 'microscope_id' in request.match_info:
+            microscope_id = self._get_backend(request).microscope_id
+        ws = web.WebSocketResponse()
+        await ws.prepare(request)
+        async with self.clients_lock:
+            self.clients[ws] = microscope_id
+            log.debug("number of clients after adding new client: %s " % len(self.clients))
+            for backend in self.backends.values():
+                if backend.state and microscope_id in (None, backend.microscope_id):
+                    await self._send(ws, self._message(backend.microscope_id, backend.state, microscope_id))
+        try:
+            async for msg in ws:
+                if msg.type == WSMsgType.TEXT:
+                    if msg.data != 'close':
+                        log.warning('websocket connection received unsupported text message: "%s"' % msg.data)
+                    await ws.close()
+                elif msg.type == WSMsgType.ERROR:
+                    log.warning('websocket connection closed with exception %s' % ws.exception())
+        finally:
+            async with self.clients_lock:
+                self.clients.pop(ws, None)
+        return ws
+
+    @staticmethod
+    def _message(microscope_id, changes, subscribed_id):
+        if subscribed_id is None:
+            return {"microscope_id": microscope_id, "changes": changes}
+        return changes
+
+    async def _send(self, ws, message):
+        """Send message to a websocket client, drop the client if this fails or times out"""
+        try:
+            await asyncio.wait_for(ws.send_json(message), self.WEBSOCKET_SEND_TIMEOUT)
+        except (ConnectionError, RuntimeError, asyncio.TimeoutError) as exc:
+            log.warning("Dropping websocket client after failed send: %r" % exc)
+            self.clients.pop(ws, None)
+            asyncio.ensure_future(ws.close())
+
+    async def broadcast(self, microscope_id, changes):
+        """Send changes of a microscope to all interested websocket clients (concurrently)"""
+        async with self.clients_lock:
+            sends = [self._send(ws, self._message(microscope_id, changes, subscribed_id))
+                     for ws, subscribed_id in list(self.clients.items())
+                     if subscribed_id in (None, microscope_id)]
+            if sends:
+                await asyncio.gather(*sends)
+
+    async def update_state(self, backend, new_values, deadbands=None):
+        """Merge new values into the state of a backend and broadcast the changes"""
+        if deadbands is None:
+            deadbands = dict()
+        changes = dict()
+        for command, value in new_values.items():
+            if command not in backend.state or _value_changed(backend.state[command], value,
+                                                              deadbands.get(command)):
+                backend.state[command] = value
+                changes[command] = value
+        if changes:
+            log.info("microscope %s state changed: %s" % (backend.microscope_id, changes))
+            await self.broadcast(backend.microscope_id, changes)
+
+    async def _poll_value(self, backend, command):
+        url = "%s/v1/%s" % (backend.base_url, command)
+        async with self.session.get(url, headers={"Accept": "application/json"}) as response:
+            if response.status != 200:
+                raise ValueError("Failed remote call: %d, %s" % (response.status, response.reason))
+            result = await response.json()
+        return self.polling_config[command][0](result)
+
+    async def poll_backend(self, backend):
+        """Poll all configured values of a backend concurrently"""
+        commands = list(self.polling_config.keys())
+        results = await asyncio.gather(*[self._poll_value(backend, command) for command in commands],
+                                       return_exceptions=True)
+        new_values = dict()
+        for command, result in zip(commands, results):
+            if isinstance(result, (aiohttp.ClientConnectionError, asyncio.TimeoutError)):
+                raise result
+            elif isinstance(result, Exception):
+                log.debug("Polling %s of microscope %s failed: %s" % (command, backend.microscope_id, result))
+            else:
+                new_values[command] = result
+        await self.update_state(backend, new_values, self.deadbands)
+
+    async def _follow_events(self, backend):
+        """Receive the change events of a server with events"""
+        async with self.session.ws_connect("%s/ws/v1" % backend.base_url) as ws:
+            backend.connected = True
+            async for msg in ws:
+                if msg.type == WSMsgType.TEXT:
+                    await self.update_state(backend, json.loads(msg.data))
+                elif msg.type == WSMsgType.ERROR:
+                    break
+
+    async def _run_backend(self, backend):
+        log.info("Connecting microscope %s at %s (events=%s)" % (backend.microscope_id, backend.base_url,
+                                                                 backend.events))
+        while True:
+            try:
+                if backend.events:
+                    await self._follow_events(backend)
+                else:
+                    await self.poll_backend(backend)
+                    backend.connected = True
+            except asyncio.CancelledError:
+                raise
+            except Exception as exc:
+                if backend.connected:
+                    log.warning("Lost connection to microscope %s: %s" % (backend.microscope_id, exc))
+                backend.connected = False
+            await asyncio.sleep(self.sleep_time)
+
+    def run_server(self):
+        log.info("Starting gateway for %d microscopes under host=%s, port=%s" %
+                 (len(self.backends), self.host, self.port))
+        app = web.Application()
+        app.add_routes([web.get('/ws/v1', self.websocket_handler_v1),
+                        web.get('/v1/microscopes', self.http_list_handler),
+                        web.get('/microscopes/{microscope_id}/ws/v1', self.websocket_handler_v1),
+                        web.get('/microscopes/{microscope_id}/state', self.http_state_handler),
+                        web.get(r'/microscopes/{microscope_id}/v1/{name:.+}', self.http_get_handler_v1),
+                        web.put(r'/microscopes/{microscope_id}/v1/{name:.+}', self.http_put_handler_v1)])
+        loop = asyncio.get_event_loop()
+        loop.run_until_complete(self.start())
+
+        runner = web.AppRunner(app)
+        loop.run_until_complete(runner.setup())
+        site = web.TCPSite(runner, self.host, self.port)
+        loop.run_until_complete(site.start())
+
+    async def start(self):
+        """Open the client session and start the backend tasks (shared by all clients)"""
+        self.session = aiohttp.ClientSession(timeout=aiohttp.ClientTimeout(total=self.timeout))
+        for backend in self.backends.values():
+            backend._task = asyncio.ensure_future(self._run_backend(backend))
+
+    async def stop(self):
+        for backend in self.backends.values():
+            if backend._task is not None:
+                backend._task.cancel()
+                backend._task = None
+        if self.session is not None:
+            await self.session.close()
+            self.session = None
+
+
+def run_gateway(argv=None):
+    """
+    Main program for running the gateway
+
+    :param argv: Arguments
+    :type argv: List of str (see sys.argv)
+    :returns: Exit code
+    """
+    parser = argparse.ArgumentParser(
+        description='HTTP+Websocket gateway for several temscript microscope servers.')
+    parser.add_argument("-p", "--port", type=int, default=8080, help="Specify port on which the gateway is listening")
+    parser.add_argument("--host", type=str, default='0.0.0.0', help="Specify host address on which the the gateway is listening")
+    parser.add_argument("--pollsleep", type=float, default=1.0,
+                        help="Polling interval (in seconds) for microscope servers without events.")
+    parser.add_argument("--backend", action="append", default=[], metavar="ID=HOST:PORT[,events]",
+                        help="Microscope server to add (repeat for several microscopes). Add ',events' for "
+                             "servers with events.")
+    logger.add_logger_arguments(parser)
+    args = parser.parse_args(argv)
+    logger.configure_logger(log, args.loglevel or "INFO", args.logfile, args.silent)
+
+    if not args.backend:
+        parser.error("No microscope servers given.")
+    backends = [GatewayBackend.parse(spec) for spec in args.backend]
+    gateway = MicroscopeGateway(backends, host=args.host, port=args.port, sleep_time=args.pollsleep)
+    gateway.run_server()
+    loop = asyncio.get_event_loop()
+    try:
+        loop.run_forever()
+    except KeyboardInterrupt:
+        print('Ctrl+C received, shutting down the gateway')
+    finally:
+        loop.run_until_complete(gateway.stop())
+    return 0
+
+
+if __name__ == '__main__':
+    run_gateway()
@@ -0,0 +1,323 @@
+"""
+In-memory telemetry history for the polled microscope state.
+
+Each key gets its own columnar ring buffer (timestamps and values in separate
+arrays), so memory use is bounded by the ring capacity. Samples pushed out of
+a full ring can optionally be spilled to disk, one JSON-lines file per key.
+Spill files are written by a background thread and rotated at a maximum size,
+only the previous file is kept.
+"""
+import os
+import json
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+
+def _is_numeric(value):
+    """Whether value can be stored in a float64 column"""
+    return isinstance(value, (bool, int, float, np.integer, np.floating))
+
+
+def _object_array(values):
+    """Create 1D object array from list 'values' (without numpy interpreting nested sequences)"""
+    result = np.empty(len(values), dtype=object)
+    for n, value in enumerate(values):
+        result[n] = value
+    return result
+
+
+def downsample_minmax(t, v, max_points):
+    """
+    Reduce numeric series (t, v) to at most max_points samples.
+
+    The series is split into max_points // 2 buckets. From each bucket the minimum and
+    the maximum sample are kept (in time order), so peaks survive the downsampling.
+
+    :param t: Timestamps (1D array, ascending)
+    :param v: Values (1D float array)
+    :param max_points: Maximum number of returned samples
+    :return: tuple (t, v) of downsampled arrays
+    """
+    n = len(t)
+    if max_points is None or n <= max_points:
+        return t, v
+    buckets = max(1, max_points // 2)
+    bounds = np.linspace(0, n, buckets + 1).astype(np.intp)
+    indices = []
+    for start, stop in zip(bounds[:-1], bounds[1:]):
+        if stop <= start:
+            continue
+        segment = v[start:stop]
+        imin = start + int(np.argmin(segment))
+        imax = start + int(np.argmax(segment))
+        if imin == imax:
+            indices.append(imin)
+        else:
+            indices.extend(sorted((imin, imax)))
+    indices = np.asarray(indices[:max_points], dtype=np.intp)
+    return t[indices], v[indices]
+
+
+def downsample_stride(t, v, max_points):
+    """Reduce series (t, v) to at most max_points samples by striding, always keeping the last sample"""
+    n = len(t)
+    if max_points is None or n <= max_points:
+        return t, v
+    indices = np.linspace(0, n - 1, max_points).round().astype(np.intp)
+    return t[indices], v[indices]
+
+
+class HistoryRing(object):
+    """
+    Fixed-capacity ring buffer of (timestamp, value) samples of a single key.
+
+    Numeric values (bool, int, float) are stored in a float64 column. As soon as a
+    non-numeric value (e.g. a string or tuple) is seen, the column is converted to
+    an object column.
+
+    :param capacity: Maximum number of samples kept in memory
+    :param spill: Optional callable taking (t, v) lists of evicted samples
+    :param spill_block: Number of evicted samples collected before spill is called
+    """
+    def __init__(self, capacity, spill=None, spill_block=256):
+        if capacity < 1:
+            raise ValueError("Capacity must be positive.")
+        self.capacity = int(capacity)
+        self._t = np.empty(self.capacity, dtype=np.float64)
+        self._v = np.empty(self.capacity, dtype=np.float64)
+        self._start = 0
+        self._count = 0
+        self._spill = spill
+        self._spill_block = int(spill_block)
+        self._evicted_t = []
+        self._evicted_v = []
+
+    def __len__(self):
+        return self._count
+
+    @property
+    def numeric(self):
+        """Whether the values are stored in a numeric column"""
+        return self._v.dtype != object
+
+    def append(self, timestamp, value):
+        """
+        Append a sample. A timestamp older than the last one (e.g. a slow read committed
+        after a faster one) is raised to it, so the timestamps stay ascending.
+        """
+        if self._count:
+            last = self._t[(self._start + self._count - 1) % self.capacity]
+            if timestamp < last:
+                timestamp = last
+        if self.numeric and not _is_numeric(value):
+            self._v = self._v.astype(object)
+        elif self.numeric:
+            value = float(value)
+
+        pos = (self._start + self._count) % self.capacity
+        if self._count == self.capacity:
+            if self._spill is not None:
+                self._evict(pos)
+            self._start = (self._start + 1) % self.capacity
+        else:
+            self._count += 1
+        self._t[pos] = timestamp
+        self._v[pos] = value
+
+    def _evict(self, pos):
+        value = self._v[pos]
+        self._evicted_t.append(float(self._t[pos]))
+        self._evicted_v.append(value.item() if isinstance(value, np.generic) else value)
+        if len(self._evicted_t) >= self._spill_block:
+            self.flush()
+
+    def flush(self):
+        """Pass collected evicted samples to the spill callable"""
+        if self._evicted_t and self._spill is not None:
+            self._spill(self._evicted_t, self._evicted_v)
+        self._evicted_t = []
+        self._evicted_v = []
+
+    def oldest(self):
+        """Timestamp of oldest sample in memory (or None)"""
+        return float(self._t[self._start]) if self._count else None
+
+    def samples(self, since=None):
+        """
+        Return (t, v) arrays in time order with all samples newer or equal to 'since'.
+        The arrays are copies and can be used after further appends.
+        """
+        stop = self._start + self._count
+        if stop <= self.capacity:
+            t = self._t[self._start:stop]
+            v = self._v[self._start:stop]
+        else:
+            t = np.concatenate((self._t[self._start:], self._t[:stop - self.capacity]))
+            v = np.concatenate((self._v[self._start:], self._v[:stop - self.capacity]))
+        if since is not None:
+            first = int(np.searchsorted(t, since, side='left'))
+            t = t[first:]
+            v = v[first:]
+        return t.copy(), v.copy()
+
+
+class TelemetryHistory(object):
+    """
+    History of polled values, one :class:`HistoryRing` per key.
+
+    :param capacity: Maximum number of samples kept in memory per key
+    :param spill_dir: If given, samples pushed out of the rings are appended to
+        "<spill_dir>/<key>.jsonl" and are still available for queries.
+    :param spill_block: Number of evicted samples written to disk at once
+    :param spill_max_bytes: Size at which a spill file is renamed to "<key>.1.jsonl"
+        (replacing the former one), so at most twice this size is kept per key
+    """
+    def __init__(self, capacity=86400, spill_dir=None, spill_block=256, spill_max_bytes=64 << 20):
+        self.capacity = int(capacity)
+        self.spill_dir = spill_dir
+        self.spill_block = spill_block
+        self.spill_max_bytes = int(spill_max_bytes)
+        self._rings = {}
+        self._lock = threading.Lock()
+        # spill files are written by a single thread (blocks stay in order, appends do not
+        # wait for the disk), _spill_lock guards the file sizes against a rotation
+        self._spill_lock = threading.Lock()
+        self._spill_executor = None
+        self._spill_pending = None
+        # number of queries reading spill files (no rotation meanwhile)
+        self._spill_readers = 0
+        if spill_dir:
+            if not os.path.isdir(spill_dir):
+                os.makedirs(spill_dir)
+            self._spill_executor = ThreadPoolExecutor(max_workers=1, thread_name_prefix="HistorySpill")
+
+    def _spill_file(self, key, generation=0):
+        if generation:
+            return os.path.join(self.spill_dir, "%s.%d.jsonl" % (key, generation))
+        return os.path.join(self.spill_dir, "%s.jsonl" % key)
+
+    def _make_spill(self, key):
+        def spill(t, v):
+            # called with _lock held: only queue the block
+            self._spill_pending = self._spill_executor.submit(self._write_spill, key, t, v)
+        return spill
+
+    def _write_spill(self, key, t, v):
+        """Append a block of evicted samples to the spill file of 'key' (in the spill thread)"""
+        filename = self._spill_file(key)
+        rotated = self._spill_file(key, 1)
+        line = json.dumps({"t": t, "v": v}) + "\n"
+        with self._spill_lock:
+            with open(filename, 'a') as f:
+                f.write(line)
+                size = f.tell()
+            # while a query reads the files, the rotation waits for a later block
+            if size >= self.spill_max_bytes and not self._spill_readers:
+                if os.path.exists(rotated):
+                    os.remove(rotated)
+                os.rename(filename, rotated)
+
+    def _wait_spilled(self):
+        """Wait until the queued blocks are written"""
+        pending = self._spill_pending
+        if pending is not None:
+            pending.result()
+
+    def keys(self):
+        with self._lock:
+            return sorted(self._rings.keys())
+
+    def append(self, timestamp, values):
+        """
+        Append one sample per key of dict 'values'.
+        :param timestamp: UNIX time of all samples or dict with the time of each key
+        """
+        timestamps = timestamp if isinstance(timestamp, dict) else None
+        with self._lock:
+            for key, value in values.items():
+                ring = self._rings.get(key)
+                if ring is None:
+                    spill = self._make_spill(key) if self.spill_dir else None
+                    ring = HistoryRing(self.capacity, spill=spill, spill_block=self.spill_block)
+                    self._rings[key] = ring
+                ring.append(timestamps[key] if timestamps is not None else timestamp, value)
+
+    def flush(self):
+        """Write all pending evicted samples to disk"""
+        with self._lock:
+            for ring in self._rings.values():
+                ring.flush()
+        self._wait_spilled()
+
+    def _read_spilled(self, key, since, until):
+        """Read spilled samples of 'key' with since <= t < until from disk (rotated file first)"""
+        t = []
+        v = []
+        # the lock is held only to take the file sizes: the spill thread appends behind
+        # them while the files are parsed and does not rotate them until the query is done
+        with self._spill_lock:
+            files = [(filename, os.path.getsize(filename))
+                     for filename in (self._spill_file(key, 1), self._spill_file(key))
+                     if os.path.exists(filename)]
+            self._spill_readers += 1
+        try:
+            for filename, size in files:
+                with open(filename, 'rb') as f:
+                    for line in f:
+                        size -= len(line)
+                        if size < 0:
+                            break
+                        block = json.loads(line)
+                        if block["t"] and block["t"][-1] < since:
+                            continue
+                        for ts, value in zip(block["t"], block["v"]):
+                            if since <= ts < until:
+                                t.append(ts)
+                                v.append(value)
+        finally:
+            with self._spill_lock:
+                self._spill_readers -= 1
+        return t, v
+
+    def query(self, key, since=None, max_points=None):
+        """
+        Return samples of 'key' newer or equal to timestamp 'since'.
+
+        Numeric series are reduced to at most 'max_points' samples with min/max preserving
+        downsampling, other series by striding. Queries reaching into spilled samples read
+        from disk: call them off the event loop.
+
+        :return: dict with entries "key", "t" (list of timestamps) and "v" (list of values)
+        :raises KeyError: If there is no history for 'key'
+        """
+        with self._lock:
+            ring = self._rings[key]
+            t, v = ring.samples(since)
+            numeric = ring.numeric
+            oldest = ring.oldest()
+            spilled = self.spill_dir and since is not None and oldest is not None and since < oldest
+            if spilled:
+                ring.flush()
+        if spilled:
+            # appends go on while the file is read
+            self._wait_spilled()
+            spilled_t, spilled_v = self._read_spilled(key, since, oldest)
+            if spilled_t:
+                t = np.concatenate((np.asarray(spilled_t, dtype=np.float64), t))
+                if numeric:
+                    spilled_v = np.asarray(spilled_v, dtype=np.float64)
+                else:
+                    spilled_v = _object_array(spilled_v)
+                v = np.concatenate((spilled_v, v))
+
+        if numeric:
+            t, v = downsample_minmax(t, v, max_points)
+        else:
+            t, v = downsample_stride(t, v, max_points)
+        return {
+            "key": key,
+            "t": t.tolist(),
+            "v": v.tolist(),
+        }
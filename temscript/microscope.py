@@ -1,14 +1,45 @@
 from __future__ import division, print_function
 from .enums import *
+from .framepool import FramePool
 import math
+import threading
+import time
 
 # Get imports from library
 try:
     # Python 3.X
-    from urllib.parse import quote
+    from urllib.parse import quote, unquote
 except ImportError:
     # Python 2.X
-    from urllib import quote
+    from urllib import quote, unquote
+
+
+def _enum_tables():
+    """
+    Return tables (enum type -> dict value -> name, enum type -> dict name -> value) for all enums,
+    using the interned names of the native module if available.
+    """
+    from . import enums
+    types = dict((name, getattr(enums, name)) for name in enums.__all__)
+    try:
+        from _temscript import EnumNames, EnumValues
+        return (dict((types[name], table) for name, table in EnumNames.items() if name in types),
+                dict((types[name], table) for name, table in EnumValues.items() if name in types))
+    except ImportError:
+        return (dict((type, dict((int(member), member.name) for member in type)) for type in types.values()),
+                dict((type, dict((name, int(member)) for name, member in type.__members__.items()))
+                     for type in types.values()))
+
+
+_ENUM_NAMES, _ENUM_VALUES = _enum_tables()
+
+
+def _enum_name(type, value):
+    """Return name of 'value' in enum 'type' (like type(value).name, without creating the enum)"""
+    try:
+        return _ENUM_NAMES[type][value]
+    except KeyError:
+        return type(value).name
 
 
 def _parse_enum(type, item):
@@ -23,34 +54,166 @@ def _parse_enum(type, item):
 STAGE_AXES = frozenset(('x', 'y', 'z', 'a', 'b'))
 
 
+def _enum_value(type):
+    """Return converter from enum name or value to the integer value of enum 'type'"""
+    # accepts names and (valid) values
+    values = dict(_ENUM_VALUES[type])
+    values.update((value, value) for value in _ENUM_NAMES[type])
+
+    def convert(item):
+        try:
+            return values[item]
+        except (KeyError, TypeError):
+            return int(type(item))
+    return convert
+
+
+# Detector parameter keys: key -> (property name, converter), grouped by the object holding the property
+_CAMERA_ACQ_PARAM_FIELDS = {
+    "image_size": ("ImageSize", _enum_value(AcqImageSize)),
+    "exposure(s)": ("ExposureTime", float),
+    "binning": ("Binning", int),
+    "correction": ("ImageCorrection", _enum_value(AcqImageCorrection)),
+    "exposure_mode": ("ExposureMode", _enum_value(AcqExposureMode)),
+    "pre_exposure(s)": ("PreExposureTime", float),
+    "pre_exposure_pause(s)": ("PreExposurePauseTime", float),
+}
+_CAMERA_INFO_FIELDS = {
+    "shutter_mode": ("ShutterMode", _enum_value(AcqShutterMode)),
+}
+_STEM_DETECTOR_INFO_FIELDS = {
+    "brightness": ("Brightness", float),
+    "contrast": ("Contrast", float),
+}
+_STEM_ACQ_PARAM_FIELDS = {
+    "image_size": ("ImageSize", _enum_value(AcqImageSize)),
+    "binning": ("Binning", int),
+    "dwelltime(s)": ("DwellTime", float),
+}
+
+
+def _apply_param(obj, fields, values, result):
+    """
+    Apply all keys from 'values' handled by 'fields' with a single Apply() call on 'obj'.
+    Per-key results are stored into 'result'; keys not handled by any field set are reported as "UNKNOWN".
+    """
+    props = {}
+    keys = {}
+    for key, value in values.items():
+        try:
+            prop, convert = fields[key]
+        except KeyError:
+            result.setdefault(key, "UNKNOWN")
+            continue
+        try:
+            props[prop] = convert(value)
+            keys[prop] = key
+        except Exception as exc:
+            result[key] = "FAILED: %s" % exc
+    if not props:
+        return
+    for prop, status in obj.Apply(props).items():
+        if status is True:
+            status = "WRITTEN"
+        elif status is False:
+            status = "UNCHANGED"
+        else:
+            status = "FAILED: %s" % status
+        result[keys[prop]] = status
+
+
+class _LazyInterface(object):
+    """
+    Attribute of Microscope, which is fetched from the instrument on first access (one COM
+    round trip) and then stored in the instance, replacing this descriptor.
+    """
+    def __init__(self, name, fetch):
+        self.name = name
+        self.fetch = fetch
+
+    def __get__(self, obj, owner=None):
+        if obj is None:
+            return self
+        value = self.fetch(obj._tem)
+        obj.__dict__[self.name] = value
+        return value
+
+
 class Microscope(object):
     """
     A more pythonic interface to the microscope.
 
-    Creating an instance of this class, already queries the COM interface for the instrument
+    Creating an instance of this class, already queries the COM interface for the instrument. The interfaces
+    of the subsystems (Gun, Illumination, Projection, ...) are queried when they are used first.
 
         >>> microscope = Microscope()
         >>> microscope.get_family()
         "TITAN"
-    """
 
-    def __init__(self):
+    :param warm_up: Whether to query the subsystem interfaces and static data (product family, stage limits,
+        detector table) in a background thread, so the first requests of a server are served without delay.
+    :type warm_up: bool
+
+    .. versionchanged:: 2.2.0
+        Subsystem interfaces are queried on first use, "warm_up" keyword added.
+    """
+    _tem_gun = _LazyInterface("_tem_gun", lambda tem: tem.Gun)
+    _tem_illumination = _LazyInterface("_tem_illumination", lambda tem: tem.Illumination)
+    _tem_projection = _LazyInterface("_tem_projection", lambda tem: tem.Projection)
+    _tem_stage = _LazyInterface("_tem_stage", lambda tem: tem.Stage)
+    _tem_acquisition = _LazyInterface("_tem_acquisition", lambda tem: tem.Acquisition)
+    _tem_vacuum = _LazyInterface("_tem_vacuum", lambda tem: tem.Vacuum)
+    _family = _LazyInterface("_family", lambda tem: tem.Configuration.ProductFamily)
+
+    def __init__(self, warm_up=False):
         from .instrument import GetInstrument
+        start = time.time()
         tem = GetInstrument()
         self._tem = tem
         self._tem_instrument = tem
-        self._tem_gun = tem.Gun
         self._tem_gun1 = None
-        self._tem_illumination = tem.Illumination
-        self._tem_projection = tem.Projection
-        self._tem_stage = tem.Stage
-        self._tem_acquisition = tem.Acquisition
-        self._tem_vacuum = tem.Vacuum
-        self._family = tem.Configuration.ProductFamily
+        # (holder, limits) of last get_stage_limits() call
+        self._stage_limits = None
+        # Buffers for acquire() and acquire_stack(), (shape, dtype) of last frame by detector name
+        # and of last stack by tuple of detector names
+        self.frame_pool = FramePool()
+        self._frame_layouts = {}
+        self.startup_times = {"instrument": time.time() - start}
+        self._warm_up_thread = None
+        if warm_up:
+            self._warm_up_thread = threading.Thread(target=self._warm_up, name="MicroscopeWarmUp")
+            self._warm_up_thread.daemon = True
+            self._warm_up_thread.start()
+
+    def _warm_up(self):
+        start = time.time()
+        try:
+            for name in ("_tem_gun", "_tem_illumination", "_tem_projection", "_tem_stage",
+                         "_tem_acquisition", "_tem_vacuum", "_family"):
+                getattr(self, name)
+            self.startup_times["interfaces"] = time.time() - start
+            self.get_stage_limits()
+            self.get_detectors()
+        except Exception as exc:
+            # the same error is raised again by the first request needing the data
+            self.startup_times["warm_up_error"] = str(exc)
+        self.startup_times["warm_up"] = time.time() - start
+
+    def wait_warm_up(self, timeout=None):
+        """
+        Wait for the background warm up (see "warm_up" parameter) and return the startup times: dict with
+        entries "instrument" (connecting to instrument), "interfaces" (querying the subsystem interfaces)
+        and "warm_up" (whole warm up) in seconds.
+
+        .. versionadded:: 2.2.0
+        """
+        if self._warm_up_thread is not None:
+            self._warm_up_thread.join(timeout)
+        return dict(self.startup_times)
 
     def get_family(self):
         """Return product family (see :class:`ProductFamily`): "TITAN", "TECNAI", ..."""
-        return ProductFamily(self._family).name
+        return _enum_name(ProductFamily, self._family)
 
     def get_microscope_id(self):
         """
@@ -148,7 +311,7 @@ class Microscope(object):
             elif status == GaugeStatus.VALID:
                 gauges[g.Name] = g.Pressure
         return {
-            "status" : VacuumStatus(self._tem_vacuum.Status).name,
+            "status" : _enum_name(VacuumStatus, self._tem_vacuum.Status),
             "column_valves_open" : self._tem_vacuum.ColumnValvesOpen,
             "pvp_running" : self._tem_vacuum.PVPRunning,
             "gauges(Pa)" : gauges,
@@ -156,11 +319,11 @@ class Microscope(object):
 
     def get_stage_holder(self):
         """Return holder currently in stage (see :class:`StageHolderType`)"""
-        return StageHolderType(self._tem_stage.Holder).name
+        return _enum_name(StageHolderType, self._tem_stage.Holder)
 
     def get_stage_status(self):
         """Return status of stage (see :class:`StageStatus`)"""
-        return StageStatus(self._tem_stage.Status).name
+        return _enum_name(StageStatus, self._tem_stage.Status)
 
     def get_stage_limits(self):
         """
@@ -169,11 +332,17 @@ class Microscope(object):
         For axes "x", "y", "z" the unit is meters
         For axes "a", "b" the unit is radians
         """
+        # the limits only change with the holder
+        holder = self._tem_stage.Holder
+        cached = self._stage_limits
+        if cached is not None and cached[0] == holder:
+            return dict(cached[1])
         result = {}
         for axis in ('x', 'y', 'z', 'a', 'b'):
             mn, mx, unit = self._tem_stage.AxisData(axis)
             result[axis] = (mn, mx)
-        return result
+        self._stage_limits = (holder, result)
+        return dict(result)
 
     def get_stage_position(self):
         """
@@ -244,12 +413,13 @@ class Microscope(object):
                 "width": info.Width,
                 "pixel_size(um)": tuple(size / 1e-6 for size in info.PixelSize),
                 "binnings": [int(b) for b in info.Binnings],
-                "shutter_modes": [AcqShutterMode(x).name for x in info.ShutterModes],
+                "shutter_modes": [_enum_name(AcqShutterMode, x) for x in info.ShutterModes],
                 "pre_exposure_limits(s)": (param.MinPreExposureTime, param.MaxPreExposureTime),
                 "pre_exposure_pause_limits(s)": (param.MinPreExposurePauseTime, param.MaxPreExposurePauseTime)
             }
         for stem in self._tem_acquisition.Detectors:
             info = stem.Info
+            name = quote(info.Name)
             detectors[name] = {
                 "type": "STEM_DETECTOR",
                 "binnings": [int(b) for b in info.Binnings],
@@ -257,67 +427,43 @@ class Microscope(object):
         return detectors
 
     def _find_detector(self, name):
-        """Find detector object by name"""
-        for cam in self._tem_acquisition.Cameras:
-            if quote(cam.Info.Name) == name:
-                return cam
-        for stem in self._tem_acquisition.Detectors:
-            if quote(stem.Info.Name) == name:
-                return stem
-        raise KeyError("No detector with name %s" % name)
+        """
+        Find detector object by (quoted) name.
+
+        The lookup uses the device table cached by the Acquisition instance. If the name is unknown, the
+        table is rebuilt once, since the detector selection might have been changed in the UI.
+        """
+        device_name = unquote(name)
+        try:
+            return self._tem_acquisition.FindDevice(device_name)
+        except KeyError:
+            self._tem_acquisition.InvalidateDevices()
+        try:
+            return self._tem_acquisition.FindDevice(device_name)
+        except KeyError:
+            raise KeyError("No detector with name %s" % name)
 
     def _get_camera_param(self, det):
         """Create dict with camera parameters"""
         info = det.Info
         param = det.AcqParams
         return {
-            "image_size": AcqImageSize(param.ImageSize).name,
+            "image_size": _enum_name(AcqImageSize, param.ImageSize),
             "exposure(s)": param.ExposureTime,
             "binning": param.Binning,
-            "correction": AcqImageCorrection(param.ImageCorrection).name,
-            "exposure_mode": AcqExposureMode(param.ExposureMode).name,
-            "shutter_mode": AcqShutterMode(info.ShutterMode).name,
+            "correction": _enum_name(AcqImageCorrection, param.ImageCorrection),
+            "exposure_mode": _enum_name(AcqExposureMode, param.ExposureMode),
+            "shutter_mode": _enum_name(AcqShutterMode, info.ShutterMode),
             "pre_exposure(s)": param.PreExposureTime,
             "pre_exposure_pause(s)": param.PreExposurePauseTime
         }
 
     def _set_camera_param(self, det, values):
         """Set camera parameters"""
-        info = det.Info
-        param = det.AcqParams
-        # Silently ignore failures
-        try:
-            param.ImageSize = _parse_enum(AcqImageSize, values["image_size"])
-        except Exception:
-            pass
-        try:
-            param.ExposureTime = values["exposure(s)"]
-        except Exception:
-            pass
-        try:
-            param.Binning = values["binning"]
-        except Exception:
-            pass
-        try:
-            param.ImageCorrection = _parse_enum(AcqImageCorrection, values["correction"])
-        except Exception:
-            pass
-        try:
-            param.ExposureMode = _parse_enum(AcqExposureMode, values["exposure_mode"])
-        except Exception:
-            pass
-        try:
-            info.ShutterMode = _parse_enum(AcqShutterMode, values["shutter_mode"])
-        except Exception:
-            pass
-        try:
-            param.PreExposureTime = values["pre_exposure(s)"]
-        except Exception:
-            pass
-        try:
-            param.PreExposurePauseTime = values["pre_exposure_pause(s)"]
-        except Exception:
-            pass
+        result = {}
+        _apply_param(det.AcqParams, _CAMERA_ACQ_PARAM_FIELDS, values, result)
+        _apply_param(det.Info, _CAMERA_INFO_FIELDS, values, result)
+        return result
 
     def _get_stem_detector_param(self, det):
         """Create dict with STEM detector parameters"""
@@ -326,36 +472,17 @@ class Microscope(object):
         return {
             "brightness": info.Brightness,
             "contrast": info.Contrast,
-            "image_size": AcqImageSize(param.ImageSize).name,
+            "image_size": _enum_name(AcqImageSize, param.ImageSize),
             "binning": param.Binning,
             "dwelltime(s)": param.DwellTime
         }
 
     def _set_stem_detector_param(self, det, values):
         """Set STEM detector parameters"""
-        info = det.Info
-        param = det.AcqParams
-        # Silently ignore failures
-        try:
-            info.Brightness = values["brightness"]
-        except Exception:
-            pass
-        try:
-            info.Contrast = values["contrast"]
-        except Exception:
-            pass
-        try:
-            param.ImageSize = _parse_enum(AcqImageSize, values["image_size"])
-        except Exception:
-            pass
-        try:
-            param.Binning = values["binning"]
-        except Exception:
-            pass
-        try:
-            param.DwellTime = values["dwelltime(s)"]
-        except Exception:
-            pass
+        result = {}
+        _apply_param(det.Info, _STEM_DETECTOR_INFO_FIELDS, values, result)
+        _apply_param(det.AcqParams, _STEM_ACQ_PARAM_FIELDS, values, result)
+        return result
 
     def get_detector_param(self, name):
         """
@@ -393,35 +520,108 @@ class Microscope(object):
         """
         Set parameters for detector `name`. The parameters should be given as a dictionary.
         Allowed keys are described in the :meth:`get_detector_param` method.
-        If setting a parameter fails, no error is given.
+
+        Only parameters which differ from the current settings are written. If setting a parameter fails,
+        no error is raised. Instead a dict with the result for each given key is returned:
+
+            * "WRITTEN": The parameter was changed
+            * "UNCHANGED": The parameter already had the requested value
+            * "FAILED: <reason>": The parameter could not be set
+            * "UNKNOWN": The key is not supported by the detector
         """
         from .instrument import CCDCamera, STEMDetector
         det = self._find_detector(name)
         if isinstance(det, CCDCamera):
-            self._set_camera_param(det, param)
+            return self._set_camera_param(det, param)
         elif isinstance(det, STEMDetector):
-            self._set_stem_detector_param(det, param)
+            return self._set_stem_detector_param(det, param)
         else:
             raise TypeError("Unknown detector type.")
 
-    def acquire(self, *args):
+    def acquire(self, *args, **kw):
         """
         Acquire images for all detectors given as argument.
         The images are returned in an dict indexed by detector name.
+
+        The images are read into buffers of :attr:`frame_pool`, hand them back with :meth:`release_images`
+        when they are not used anymore. Alternatively the keyword argument "out" gives a dict of arrays
+        (detector name -> array of the image's shape and dtype) to read the images into.
+
+        .. versionchanged:: 2.2.0
+            Images are read into reusable buffers, "out" keyword added.
         """
-        self._tem_acquisition.RemoveAllAcqDevices()
-        for det in args:
-            try:
-                self._tem_acquisition.AddAcqDeviceByName(det)
-            except Exception:
-                pass
+        out = kw.pop("out", None)
+        if kw:
+            raise TypeError("Unexpected keyword arguments: %s" % ", ".join(sorted(kw)))
+        self._select_detectors(args)
         # Read as dict of numpy arrays
         images = self._tem_acquisition.AcquireImages()
         result = {}
         for img in images:
-            result[quote(img.Name)] = img.Array
+            name = quote(img.Name)
+            result[name] = self._read_image(img, name, out)
         return result
 
+    def acquire_stack(self, *args, **kw):
+        """
+        Acquire images for all detectors given as argument, which have the same shape and dtype
+        (e.g. several STEM detectors). The images are read in a single pass into one contiguous array.
+
+        Returns tuple (names, stack): the tuple of detector names and the array of shape
+        (len(names), height, width), with the image of detector names[i] in stack[i]. Without
+        images (names, stack) is ((), None).
+
+        The stack is read into a buffer of :attr:`frame_pool`, hand it back with :meth:`release_images`
+        (e.g. ``release_images(acquire_stack(...))``) when it is not used anymore. Alternatively the keyword
+        argument "out" gives the array to read the images into. If it does not fit, a new array is returned.
+
+        .. versionadded:: 2.2.0
+        """
+        out = kw.pop("out", None)
+        if kw:
+            raise TypeError("Unexpected keyword arguments: %s" % ", ".join(sorted(kw)))
+        self._select_detectors(args)
+        if out is None:
+            layout = self._frame_layouts.get(args)
+            if layout is not None:
+                out = self.frame_pool.take(*layout)
+        names, stack = self._tem_acquisition.AcquireStack(out=out)
+        if stack is not None:
+            self._frame_layouts[args] = (stack.shape, stack.dtype)
+        return tuple(quote(name) for name in names), stack
+
+    def _select_detectors(self, names):
+        self._tem_acquisition.RemoveAllAcqDevices()
+        for det in names:
+            try:
+                self._tem_acquisition.AddAcqDeviceByName(det)
+            except Exception:
+                pass
+
+    def _read_image(self, img, name, out):
+        if out is not None and name in out:
+            return img.ReadInto(out[name])
+        layout = self._frame_layouts.get(name)
+        if layout is not None:
+            buffer = self.frame_pool.take(*layout)
+            try:
+                return img.ReadInto(buffer)
+            except ValueError:
+                # detector settings changed the frame size, buffer is dropped
+                pass
+        array = img.Array
+        self._frame_layouts[name] = (array.shape, array.dtype)
+        return array
+
+    def release_images(self, images):
+        """
+        Hand back images returned by :meth:`acquire` (dict or sequence of arrays) or
+        :meth:`acquire_stack` for reuse by later acquisitions. The arrays must not be used afterwards.
+
+        .. versionadded:: 2.2.0
+        """
+        self.frame_pool.give_all(images)
+
     def get_image_shift(self):
         """
         Return image shift as (x,y) tuple in meters.
@@ -504,7 +704,7 @@ class Microscope(object):
         Return illumination mode as a string.
         See class IlluminationMode: possible values are "TEM" and "STEM"
         """
-        return InstrumentMode(self._tem_instrument.InstrumentModeControl.InstrumentMode).name
+        return _enum_name(InstrumentMode, self._tem_instrument.InstrumentModeControl.InstrumentMode)
 
     def get_df_mode(self):
         """
@@ -521,7 +721,7 @@ class Microscope(object):
         Return dark field mode as a string.
         See class DarkFieldMode: possible values are "OFF", "CARTESIAN", "CONICAL"
         """
-        return DarkFieldMode(self._tem_illumination.DFMode).name
+        return _enum_name(DarkFieldMode, self._tem_illumination.DFMode)
 
     def set_df_mode(self, df_mode):
         """
@@ -546,7 +746,7 @@ class Microscope(object):
         Return illumination mode as a string.
         See class IlluminationMode: possible values are "NANOPROBE" and "MICROPROBE"
         """
-        return IlluminationMode(self._tem_illumination.Mode).name
+        return _enum_name(IlluminationMode, self._tem_illumination.Mode)
 
     def get_illuminated_area(self):
         """
@@ -575,7 +775,7 @@ class Microscope(object):
         Return condenser mode as a string.
         See class CondenserMode: possible values are "PARALLEL", "PROBE"
         """
-        return CondenserMode(self._tem_illumination.CondenserMode).name
+        return _enum_name(CondenserMode, self._tem_illumination.CondenserMode)
 
     def get_spot_size_index(self):
         """
@@ -632,7 +832,7 @@ class Microscope(object):
 
         .. versionadded:: 1.0.10
         """
-        return ProjectionSubMode(self._tem_projection.SubMode).name
+        return _enum_name(ProjectionSubMode, self._tem_projection.SubMode)
 
     def get_projection_mode(self):
         """
@@ -640,7 +840,7 @@ class Microscope(object):
 
         .. versionadded:: 1.0.9
         """
-        return ProjectionMode(self._tem_projection.Mode).name
+        return _enum_name(ProjectionMode, self._tem_projection.Mode)
 
     def set_projection_mode(self, mode):
         """
@@ -660,7 +860,7 @@ class Microscope(object):
 
         .. versionadded:: 1.0.9
         """
-        return ProjectionSubMode(self._tem_projection.SubMode).name
+        return _enum_name(ProjectionSubMode, self._tem_projection.SubMode)
 
     def get_projection_mode_type_string(self):
         """
@@ -668,7 +868,7 @@ class Microscope(object):
 
         .. versionadded:: 1.0.15
         """
-        return ProjectionMode(self._tem_projection.Mode).name
+        return _enum_name(ProjectionMode, self._tem_projection.Mode)
 
     def get_magnification_index(self):
         """
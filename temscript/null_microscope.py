@@ -4,6 +4,7 @@ from math import pi
 
 from .enums import *
 from .microscope import _parse_enum
+from .framepool import FramePool
 
 
 class NullMicroscope(object):
@@ -14,6 +15,15 @@ class NullMicroscope(object):
     :type wait_exposure: bool
     :param voltage: High tension value the microscope report in kV
     :type voltage: float
+    :param specimen: Whether acquired frames show a simulated specimen, blurred according to the
+        distance of the defocus from SPECIMEN_FOCUS (otherwise frames are zero)
+    :type specimen: bool
+    :param latency: Additional duration in seconds of the method calls, emulating a slow microscope:
+        either for all public methods, or a dict method name -> seconds (e.g. ``{"normalize": 2.0}``)
+    :type latency: float or dict
+
+    .. versionadded:: 2.2.0
+        The `latency` parameter.
     """
     STAGE_XY_RANGE = 1e-3       # meters
     STAGE_Z_RANGE = 0.3e-3      # meters
@@ -22,7 +32,10 @@ class NullMicroscope(object):
     CCD_SIZE = 2048
     CCD_BINNINGS = [1, 2, 4, 8]
 
-    def __init__(self, wait_exposure=None, voltage=200.0):
+    SPECIMEN_FOCUS = 1.5e-6     # meters, defocus at which the simulated specimen is sharp
+    SPECIMEN_BLUR = 2e6         # pixels of blur (sigma) per meter of defocus error
+
+    def __init__(self, wait_exposure=None, voltage=200.0, specimen=False, latency=None):
         self._column_valves = False
         self._stage_pos = { 'x': 0.0, 'y': 0.0, 'z': 0.0, 'a': 0.0, 'b': 0.0 }
         self._wait_exposure = bool(wait_exposure) if wait_exposure is not None else True
@@ -58,6 +71,32 @@ class NullMicroscope(object):
         self._intensity = 0.0
         self._beam_blanked = False
         self._voltage_offset = 0.0
+        self._specimen = bool(specimen)
+        self._specimen_spectra = {}
+        self.frame_pool = FramePool()
+        if latency:
+            self._inject_latency(latency)
+
+    def _inject_latency(self, latency):
+        """Replace the methods by wrappers sleeping 'latency' seconds before the call"""
+        import time
+        if not isinstance(latency, dict):
+            latency = dict((name, latency) for name in dir(self)
+                           if not name.startswith("_") and callable(getattr(self, name)))
+
+        def delayed(func, seconds):
+            def wrapper(*args, **kw):
+                time.sleep(seconds)
+                return func(*args, **kw)
+            wrapper.__name__ = func.__name__
+            wrapper.__doc__ = func.__doc__
+            return wrapper
+
+        for name, seconds in latency.items():
+            func = getattr(self, name)
+            if not callable(func):
+                raise ValueError("Not a method: %s" % name)
+            setattr(self, name, delayed(func, float(seconds)))
 
     def get_family(self):
         return "NULL"
@@ -146,29 +185,35 @@ class NullMicroscope(object):
             raise ValueError("Unknown detector")
 
     def set_detector_param(self, name, param):
-        if name == "CCD":
-            try:
-                self._ccd_param["image_size"] = _parse_enum(AcqImageSize, param["image_size"]).name
-            except Exception:
-                pass
-            try:
-                self._ccd_param["exposure(s)"] = max(0.0, float(param["exposure(s)"]))
-            except Exception:
-                pass
-            try:
-                binning = int(param["exposure(s)"])
-                if binning in self.CCD_BINNINGS:
-                    self._ccd_param["binning"] = binning
-            except Exception:
-                pass
-            try:
-                self._ccd_param["correction"] = _parse_enum(AcqImageCorrection, param["correction"]).name
-            except Exception:
-                pass
-        else:
+        if name != "CCD":
             raise TypeError("Unknown detector type.")
+        converters = {
+            "image_size": lambda x: _parse_enum(AcqImageSize, x).name,
+            "exposure(s)": lambda x: max(0.0, float(x)),
+            "binning": lambda x: self.CCD_BINNINGS[self.CCD_BINNINGS.index(int(x))],
+            "correction": lambda x: _parse_enum(AcqImageCorrection, x).name,
+        }
+        result = {}
+        for key, value in param.items():
+            if key not in converters:
+                result[key] = "UNKNOWN"
+                continue
+            try:
+                value = converters[key](value)
+            except Exception as exc:
+                result[key] = "FAILED: %s" % exc
+                continue
+            if self._ccd_param[key] == value:
+                result[key] = "UNCHANGED"
+            else:
+                self._ccd_param[key] = value
+                result[key] = "WRITTEN"
+        return result
 
-    def acquire(self, *args):
+    def acquire(self, *args, **kw):
+        out = kw.pop("out", None)
+        if kw:
+            raise TypeError("Unexpected keyword arguments: %s" % ", ".join(sorted(kw)))
         result = {}
         detectors = set(args)
         for det in detectors:
@@ -181,9 +226,57 @@ class NullMicroscope(object):
                 if self._wait_exposure:
                     import time
                     time.sleep(self._ccd_param["exposure(s)"])
-                result["CCD"] = np.zeros((size, size), dtype=np.int16)
+                if out is not None and "CCD" in out:
+                    frame = out["CCD"]
+                    if not isinstance(frame, np.ndarray) or frame.shape != (size, size) or frame.dtype != np.int16:
+                        raise ValueError("Output array must have shape (%d, %d) and dtype int16" % (size, size))
+                else:
+                    frame = self.frame_pool.take((size, size), np.int16)
+                if self._specimen:
+                    frame[...] = self._specimen_frame(size)
+                else:
+                    frame.fill(0)
+                result["CCD"] = frame
         return result
 
+    def acquire_stack(self, *args, **kw):
+        out = kw.pop("out", None)
+        if kw:
+            raise TypeError("Unexpected keyword arguments: %s" % ", ".join(sorted(kw)))
+        images = self.acquire(*args)
+        names = tuple(det for n, det in enumerate(args) if det in images and det not in args[:n])
+        if not names:
+            return (), None
+        first = images[names[0]]
+        shape = (len(names),) + first.shape
+        if isinstance(out, np.ndarray) and out.shape == shape and out.dtype == first.dtype \
+                and out.flags.c_contiguous and out.flags.writeable:
+            stack = out
+        else:
+            stack = self.frame_pool.take(shape, first.dtype)
+        for n, name in enumerate(names):
+            stack[n] = images[name]
+        self.release_images(images)
+        return names, stack
+
+    def release_images(self, images):
+        self.frame_pool.give_all(images)
+
+    def _specimen_frame(self, size):
+        """Frame of random particles, gaussian blurred by the defocus error"""
+        spectrum = self._specimen_spectra.get(size)
+        if spectrum is None:
+            rng = np.random.RandomState(size)
+            specimen = np.zeros((size, size))
+            specimen[rng.randint(0, size, size=size * size // 64), rng.randint(0, size, size=size * size // 64)] = 1.0
+            spectrum = self._specimen_spectra[size] = np.fft.rfft2(specimen)
+        sigma = abs(self._defocus - self.SPECIMEN_FOCUS) * self.SPECIMEN_BLUR + 0.5
+        fy = np.fft.fftfreq(size)[:, np.newaxis]
+        fx = np.fft.rfftfreq(size)[np.newaxis, :]
+        blur = np.exp(-2.0 * (pi * sigma) ** 2 * (fx * fx + fy * fy))
+        frame = np.fft.irfft2(spectrum * blur, s=(size, size))
+        return (1000.0 + 4000.0 * frame).astype(np.int16)
+
     def get_image_shift(self):
         return tuple(self._image_shift)
 
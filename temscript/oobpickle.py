@@ -0,0 +1,86 @@
+"""
+Pickle transport with out-of-band buffers (pickle protocol 5, Python 3.8+).
+
+The data of contiguous numpy arrays is not copied into the pickle stream, but sent as separate
+parts of the response body after the pickle stream:
+
+    header:     b"TPK5", buffer count (u32), pickle length (u64), buffer lengths (u64 each)
+    pickle:     pickle stream (protocol 5)
+    buffers:    each starting at a multiple of ALIGNMENT bytes (relative to the body start)
+
+The server writes the parts without joining them, the client reads the body into one writeable
+buffer and unpickles the arrays as views of it (see :func:`loads`).
+"""
+from __future__ import division, print_function
+import pickle
+import struct
+
+CONTENT_TYPE = "application/x-python-pickle5"
+
+MAGIC = b"TPK5"
+ALIGNMENT = 16
+
+
+def available():
+    """Whether pickle protocol 5 is available (Python 3.8+)"""
+    return pickle.HIGHEST_PROTOCOL >= 5
+
+
+def _padding(offset):
+    return -offset % ALIGNMENT
+
+
+def dumps(obj):
+    """
+    Pickle obj with out-of-band buffers.
+
+    :returns: list of parts (bytes or memoryview), to be sent one after another
+    """
+    buffers = []
+    data = pickle.dumps(obj, protocol=5, buffer_callback=buffers.append)
+    views = [buffer.raw() for buffer in buffers]
+    header = MAGIC + struct.pack("<IQ", len(views), len(data)) + b"".join(struct.pack("<Q", v.nbytes) for v in views)
+    # small parts are joined (one write each)
+    parts = [header + data]
+    offset = len(parts[0])
+    for view in views:
+        padding = _padding(offset)
+        if padding and isinstance(parts[-1], bytes):
+            parts[-1] += b"\0" * padding
+        elif padding:
+            parts.append(b"\0" * padding)
+        parts.append(view)
+        offset += padding + view.nbytes
+    return parts
+
+
+def body_length(parts):
+    """Total length (bytes) of parts"""
+    return sum(memoryview(part).nbytes for part in parts)
+
+
+def loads(body):
+    """
+    Unpickle body (bytes, or bytearray for writeable arrays) written by dumps().
+    The arrays are views of the body, their data is not copied.
+    """
+    view = memoryview(body)
+    if view[:4].tobytes() != MAGIC or len(view) < 16:
+        raise ValueError("Not a pickle 5 body")
+    count, length = struct.unpack_from("<IQ", view, 4)
+    offset = 16 + 8 * count
+    if offset > len(view):
+        raise ValueError("Truncated pickle 5 body")
+    sizes = struct.unpack_from("<%dQ" % count, view, 16)
+    if offset + length > len(view):
+        raise ValueError("Truncated pickle 5 body")
+    data = view[offset:offset + length]
+    offset += length
+    buffers = []
+    for size in sizes:
+        offset += _padding(offset)
+        if offset + size > len(view):
+            raise ValueError("Truncated pickle 5 body")
+        buffers.append(view[offset:offset + size])
+        offset += size
+    return pickle.loads(data, buffers=buffers)
@@ -3,16 +3,20 @@ from __future__ import division, print_function
 import numpy as np
 import json
 import socket
+import time
+from . import framecodec
+from . import oobpickle
+from .timing import parse_server_timing
 
 # Get imports from library
 try:
     # Python 3.X
-    from http.client import HTTPConnection
+    from http.client import HTTPConnection, BadStatusLine
     from urllib.parse import urlencode
     from io import BytesIO
 except ImportError:
     # Python 2.X
-    from httplib import HTTPConnection
+    from httplib import HTTPConnection, BadStatusLine
     from urllib import urlencode
     from cStringIO import StringIO as BytesIO
 
@@ -24,47 +28,111 @@ class RemoteMicroscope(object):
     Use the ``temscript-server`` command line script to run a microscope server.
 
     :param address: (host, port) combination for the remote microscope.
-    :param transport: Underlying transport protocol, either 'JSON' (default) or 'pickle'
+    :param transport: Underlying transport protocol, either 'JSON' (default), 'PICKLE', 'PICKLE5' or 'RPC'.
+        'PICKLE5' (Python 3.8+) transfers the array data without copies into the pickle stream
+        (see :mod:`temscript.oobpickle`), older servers answer with 'PICKLE'. For 'RPC', address is the RPC port of the server (see ``--rpc-port``) or the path
+        of its Unix socket (see ``--rpc-socket``), and all methods are called via
+        :class:`temscript.rpc.RpcClient`. The methods served by the HTTP server only
+        (history, drift measurement and autofocus) raise NotImplementedError then.
+    :param base_path: Path prefix of the API, e.g. "/microscopes/<id>" for a microscope behind
+        the gateway (see :mod:`temscript.gateway`)
+
+    After each HTTP request, :attr:`last_timing` holds a dict with durations in seconds: the phases
+    reported by the server in the Server-Timing header (e.g. "queue", "microscope", "encode",
+    "compress" and "total", see :mod:`temscript.timing`; only if enabled on the server) and the
+    client phases "response" (from sending the request until the response headers arrived),
+    "read" (of the body) and "decode".
+
+    .. versionadded:: 2.2.0
+        The attribute `last_timing`.
     """
-    def __init__(self, address, transport=None, timeout=None):
+    # Methods of the HTTP server, which have no counterpart in Microscope (not served via RPC)
+    HTTP_ONLY_METHODS = {"get_history", "get_drift", "autofocus"}
+
+    def __init__(self, address, transport=None, timeout=None, base_path=""):
         self.address = address
         self.timeout = timeout
+        self.base_path = base_path.rstrip("/")
         self._conn = None
+        self.last_timing = None
+        # frames compressed with the frame codec, if it is available
+        self.accepted_encoding = "gzip"
+        if framecodec.available():
+            self.accepted_encoding += ", " + framecodec.ENCODING
         if transport is None:
             transport = "JSON"
         if transport == "JSON":
             self.accepted_content = ["application/json"]
         elif transport == "PICKLE":
             self.accepted_content = ["application/python-pickle"]
+        elif transport == "PICKLE5":
+            if not oobpickle.available():
+                raise ValueError("PICKLE5 transport needs Python 3.8 or newer.")
+            # legacy pickle from older servers
+            self.accepted_content = [oobpickle.CONTENT_TYPE, "application/python-pickle"]
+        elif transport == "RPC":
+            from functools import partial
+            from .rpc import RpcClient
+            self.accepted_content = []
+            self._rpc = RpcClient(address, timeout=timeout)
+            # Mirror the microscope methods over the RPC connection
+            for name in dir(type(self)):
+                if name in self.HTTP_ONLY_METHODS:
+                    setattr(self, name, partial(self._http_only, name))
+                elif not name.startswith("_") and callable(getattr(type(self), name)):
+                    setattr(self, name, partial(self._rpc.call, name))
         else:
             raise ValueError("Unknown transport protocol.")
 
-    def _request(self, method, endpoint, query={}, body=None, headers={}, accepted_response=[200]):
-        # Make connection
-        if self._conn is None:
-            self._conn = HTTPConnection(self.address[0], self.address[1], timeout=self.timeout)
+    @staticmethod
+    def _http_only(name, *args, **kw):
+        raise NotImplementedError("%s() is not available with the RPC transport" % name)
 
+    def _request(self, method, endpoint, query={}, body=None, headers={}, accepted_response=[200]):
         # Create request
         if len(query) > 0:
-            url = "%s?%s" % (endpoint, urlencode(query))
+            url = "%s%s?%s" % (self.base_path, endpoint, urlencode(query))
         else:
-            url = endpoint
+            url = self.base_path + endpoint
         headers = dict(headers)
         if "Accept" not in headers:
             headers["Accept"] = ",".join(self.accepted_content)
         if "Accept-Encoding" not in headers:
-            headers["Accept-Encoding"] = "gzip"
-        self._conn.request(method, url, body, headers)
-
-        # Get response
-        try:
-            response = self._conn.getresponse()
-        except socket.timeout:
-            self._conn.close()
-            self._conn = None
-            raise
-
-        body = response.read()
+            headers["Accept-Encoding"] = self.accepted_encoding
+        # Send request and get response (connection is kept open between requests)
+        start = time.time()
+        while True:
+            reused = self._conn is not None
+            if not reused:
+                self._conn = HTTPConnection(self.address[0], self.address[1], timeout=self.timeout)
+            sent = False
+            try:
+                self._conn.request(method, url, body, headers)
+                sent = True
+                response = self._conn.getresponse()
+                break
+            except socket.timeout:
+                self._conn.close()
+                self._conn = None
+                raise
+            except (socket.error, BadStatusLine):
+                self._conn.close()
+                self._conn = None
+                # Server might have closed the persistent connection (e.g. idle timeout): reconnect once.
+                # A sent PUT might have been carried out already (e.g. a stage move), it is not repeated.
+                if not reused or (sent and method != "GET"):
+                    raise
+
+        received = time.time()
+        if response.getheader("Content-Type") == oobpickle.CONTENT_TYPE and response.status == 200:
+            body = self._read_writeable(response)
+        else:
+            body = response.read()
+        read = time.time()
+        timing = parse_server_timing(response.getheader("Server-Timing"))
+        timing["response"] = received - start
+        timing["read"] = read - received
+        self.last_timing = timing
         if response.status not in accepted_response:
             raise ValueError("Failed remote call: %d, %s" % (response.status, response.reason))
         if response.status == 204:
@@ -82,10 +150,27 @@ class RemoteMicroscope(object):
         elif content_type == "application/python-pickle":
             import pickle
             body = pickle.loads(body)
+        elif content_type == oobpickle.CONTENT_TYPE:
+            body = oobpickle.loads(body)
         else:
             raise ValueError("Unsupported response type: %s", content_type)
+        timing["decode"] = time.time() - read
         return response, body
 
+    @staticmethod
+    def _read_writeable(response):
+        """Read body into bytearray (the unpickled arrays are writeable views of it)"""
+        length = int(response.getheader("Content-Length"))
+        body = bytearray(length)
+        view = memoryview(body)
+        pos = 0
+        while pos < length:
+            count = response.readinto(view[pos:])
+            if not count:
+                raise ValueError("Incomplete response body")
+            pos += count
+        return body
+
     def get_family(self):
         response, body = self._request("GET", "/v1/family")
         return body
@@ -151,8 +236,9 @@ class RemoteMicroscope(object):
 
     def set_detector_param(self, name, param):
         content = json.dumps(param).encode("utf-8")
-        self._request("PUT", "/v1/detector_param/" + name, body=content, accepted_response=[200, 204],
-                      headers={"Content-Type": "application/json"})
+        response, body = self._request("PUT", "/v1/detector_param/" + name, body=content,
+                                       accepted_response=[200, 204], headers={"Content-Type": "application/json"})
+        return body if response.status == 200 else None
 
     def get_image_shift(self):
         response, body = self._request("GET", "/v1/image_shift")
@@ -210,31 +296,106 @@ class RemoteMicroscope(object):
     allowed_types = {"INT8", "INT16", "INT32", "INT64", "UINT8", "UINT16", "UINT32", "UINT64", "FLOAT32", "FLOAT64"}
     allowed_endianness = {"LITTLE", "BIG"}
 
-    def acquire(self, *detectors):
+    def acquire(self, *detectors, **kw):
+        """
+        Acquire images for all detectors given as argument, see :meth:`Microscope.acquire`.
+
+        With the keyword argument "frames", the server acquires the given number of frames and
+        returns only their sum (int32) per detector. Further keywords: "average" (return the average
+        as float32 instead), "align" (align the frames to the first one before adding) and "stats"
+        (adds entry "frame_stats" with per frame statistics, see :func:`temscript.accumulate.accumulate_frames`).
+
+        .. versionchanged:: 2.2.0
+            Keywords "frames", "average", "align" and "stats" added.
+        """
         query = [("detectors", det) for det in detectors]
+        frames = kw.pop("frames", None)
+        if frames is not None:
+            query.append(("frames", str(int(frames))))
+        for flag in ("average", "align", "stats"):
+            if kw.pop(flag, False):
+                query.append((flag, "true"))
+        if kw:
+            raise TypeError("Unexpected keyword arguments: %s" % ", ".join(sorted(kw)))
         response, body = self._request("GET", "/v1/acquire", query=query)
-        if response.getheader("Content-Type") == "application/json":
-            # Unpack array
-            import sys
-            import base64
-            endianness = sys.byteorder.upper()
-            result = {}
-            for k, v in body.items():
-                shape = int(v["height"]), int(v["width"])
-                if v["type"] not in self.allowed_types:
-                    raise ValueError("Unsupported array type in JSON stream: %s" % str(v["type"]))
-                if v["endianness"] not in self.allowed_endianness:
-                    raise ValueError("Unsupported endianness in JSON stream: %s" % str(v["endianness"]))
-                dtype = np.dtype(v["type"].lower())
-                if v["encoding"] == "BASE64":
-                    data = base64.b64decode(v["data"])
-                else:
-                    raise ValueError("Unsupported encoding of array in JSON stream: %s" % str(v["encoding"]))
-                data = np.frombuffer(data, dtype=dtype).reshape(*shape)
-                if v["endianness"] != endianness:
-                    data = data.byteswap()
-                result[k] = data
-            body = result
+        result = {}
+        for k, v in body.items():
+            # arrays are encoded in JSON responses, and in pickled responses with compressed frames
+            if k != "frame_stats" and isinstance(v, dict):
+                v = self._decode_array(v)
+            result[k] = v
+        return result
+
+    def acquire_stack(self, *detectors):
+        """
+        Acquire images for all detectors given as argument as one stack, see :meth:`Microscope.acquire_stack`.
+
+        .. versionadded:: 2.2.0
+        """
+        query = [("detectors", det) for det in detectors] + [("stacked", "true")]
+        response, body = self._request("GET", "/v1/acquire", query=query)
+        stack = body["stack"]
+        if isinstance(stack, dict):
+            stack = self._decode_array(stack)
+        return tuple(body["names"]), stack
+
+    def _decode_array(self, v):
+        import sys
+        import base64
+        if "shape" in v:
+            shape = tuple(int(n) for n in v["shape"])
+        else:
+            shape = int(v["height"]), int(v["width"])
+        if v["type"] not in self.allowed_types:
+            raise ValueError("Unsupported array type in JSON stream: %s" % str(v["type"]))
+        if v["endianness"] not in self.allowed_endianness:
+            raise ValueError("Unsupported endianness in JSON stream: %s" % str(v["endianness"]))
+        dtype = np.dtype(v["type"].lower())
+        data = v["data"]
+        if not isinstance(data, bytes):
+            data = base64.b64decode(data)
+        if v["encoding"] == "BASE64":
+            data = np.frombuffer(data, dtype=dtype).reshape(shape)
+        elif v["encoding"] == framecodec.ARRAY_ENCODING:
+            data = framecodec.decode_frame(data, dtype, shape)
+        else:
+            raise ValueError("Unsupported encoding of array in JSON stream: %s" % str(v["encoding"]))
+        if v["endianness"] != sys.byteorder.upper():
+            data = data.byteswap()
+        return data
+
+    def get_drift(self, detector, reset=False):
+        """
+        Acquire a frame on the server and measure its shift relative to the reference frame
+        of the detector kept by the server (only the shift is transferred).
+
+        :param detector: Detector name
+        :param reset: Whether the frame becomes the new reference frame
+        :returns: dict with entries "detector", "dx", "dy" (shift in pixels), "confidence"
+            (phase correlation peak height, 0..1) and "reference" (whether the frame became the reference)
+        """
+        query = {"detector": detector}
+        if reset:
+            query["reset"] = "true"
+        response, body = self._request("GET", "/v1/drift", query=query)
+        return body
+
+    def autofocus(self, detector="CCD", metric="variance", span=2e-6, steps=9, center=None, settle_time=0.0):
+        """
+        Run a defocus sweep on the server and set the defocus of the sharpest frame
+        (see :class:`temscript.autofocus.Autofocus`). Returns after the sweep; a server with
+        events publishes the progress to its websocket clients under the key "autofocus".
+
+        :returns: dict with entries "defocus" (the new defocus), "fitted", "initial_defocus",
+            "metric" and "samples" (list of [defocus, sharpness] pairs)
+        """
+        params = {"detector": detector, "metric": metric, "span": span, "steps": steps,
+                  "settle_time": settle_time}
+        if center is not None:
+            params["center"] = center
+        content = json.dumps(params).encode("utf-8")
+        response, body = self._request("PUT", "/v1/autofocus", body=content,
+                                       headers={"Content-Type": "application/json"})
         return body
 
     def normalize(self, mode="ALL"):
@@ -386,6 +547,23 @@ class RemoteMicroscope(object):
         response, body = self._request("GET", "/v1/optics_state")
         return body
 
+    def get_history(self, key, since=None, max_points=None):
+        """
+        Return history of polled value `key` (only supported by the server with events).
+
+        :param key: Polled key, e.g. "defocus"
+        :param since: UNIX timestamp of the oldest sample to return
+        :param max_points: Maximum number of samples returned (downsampled by the server)
+        :return: dict with entries "key", "t" (list of timestamps), and "v" (list of values)
+        """
+        query = [("key", key)]
+        if since is not None:
+            query.append(("since", repr(float(since))))
+        if max_points is not None:
+            query.append(("max_points", str(int(max_points))))
+        response, body = self._request("GET", "/v1/history", query=query)
+        return body
+
 
 if __name__ == '__main__':
     SERVER_PORT = 8080
@@ -0,0 +1,426 @@
+"""
+Binary RPC transport for the microscope methods.
+
+Each message is a frame consisting of a little endian uint32 length and the payload. A request
+payload is a uint32 request id followed by the encoded tuple (method name, args, kwargs), a response
+payload is the uint32 request id, a uint8 status and the encoded result (or for errors the encoded
+tuple (exception type name, message)).
+
+Values are encoded with a one byte type tag:
+
+    ``N`` None, ``T``/``F`` bool, ``i`` int64, ``d`` float64, ``s`` UTF-8 string, ``b`` bytes,
+    ``t`` tuple, ``l`` list, ``m`` dict, ``e`` enum (name of the enum class and int64 value) and
+    ``a`` numpy array (dtype string, shape and raw data in C order).
+
+Strings, bytes and containers are prefixed with their uint32 length. A client can have several calls
+in flight on one connection (pipelining): the server runs them one after the other and answers in
+order of arrival, the request id assigns each response to its call.
+"""
+from __future__ import division, print_function
+import socket
+import struct
+import threading
+import numpy as np
+
+from . import enums
+from .scheduler import MicroscopeScheduler, lane_for_method
+
+try:
+    # Python 3.X
+    from socketserver import ThreadingMixIn, TCPServer, StreamRequestHandler
+    try:
+        from socketserver import UnixStreamServer
+    except ImportError:
+        UnixStreamServer = None
+except ImportError:
+    # Python 2.X
+    from SocketServer import ThreadingMixIn, TCPServer, StreamRequestHandler
+    try:
+        from SocketServer import UnixStreamServer
+    except ImportError:
+        UnixStreamServer = None
+
+
+STATUS_OK = 0
+STATUS_ERROR = 1
+
+_LENGTH = struct.Struct('<I')
+_INT = struct.Struct('<q')
+_FLOAT = struct.Struct('<d')
+_REQUEST = struct.Struct('<I')
+_RESPONSE = struct.Struct('<IB')
+
+MAX_FRAME_SIZE = 1 << 30
+
+
+def _encode(value, out):
+    """Append encoding of value to list of bytes 'out'"""
+    if value is None:
+        out.append(b'N')
+    elif value is True:
+        out.append(b'T')
+    elif value is False:
+        out.append(b'F')
+    elif isinstance(value, enums.IntEnum):
+        name = type(value).__name__.encode("utf-8")
+        out.extend((b'e', _LENGTH.pack(len(name)), name, _INT.pack(int(value))))
+    elif isinstance(value, (int, np.integer)) and not isinstance(value, np.bool_):
+        out.extend((b'i', _INT.pack(int(value))))
+    elif isinstance(value, (float, np.floating)):
+        out.extend((b'd', _FLOAT.pack(float(value))))
+    elif isinstance(value, np.bool_):
+        out.append(b'T' if value else b'F')
+    elif isinstance(value, type(u"")):
+        data = value.encode("utf-8")
+        out.extend((b's', _LENGTH.pack(len(data)), data))
+    elif isinstance(value, (bytes, bytearray)):
+        out.extend((b'b', _LENGTH.pack(len(value)), bytes(value)))
+    elif isinstance(value, (tuple, list)):
+        out.extend((b't' if isinstance(value, tuple) else b'l', _LENGTH.pack(len(value))))
+        for item in value:
+            _encode(item, out)
+    elif isinstance(value, dict):
+        out.extend((b'm', _LENGTH.pack(len(value))))
+        for key, item in value.items():
+            _encode(key, out)
+            _encode(item, out)
+    elif isinstance(value, np.ndarray):
+        if value.dtype.hasobject:
+            raise TypeError("Object arrays can't be encoded.")
+        dtype = value.dtype.str.encode("ascii")
+        out.extend((b'a', _LENGTH.pack(len(dtype)), dtype, struct.pack('<B', value.ndim)))
+        out.append(struct.pack('<%dQ' % value.ndim, *value.shape))
+        out.append(np.ascontiguousarray(value).tobytes())
+    else:
+        raise TypeError("Type can't be encoded: %s" % type(value).__name__)
+
+
+def encode(value):
+    """Return encoding of value as bytes"""
+    out = []
+    _encode(value, out)
+    return b''.join(out)
+
+
+def _decode(buf, pos):
+    """Decode value from buffer 'buf' at 'pos', returns tuple (value, new pos)"""
+    tag = bytes(buf[pos:pos + 1])
+    pos += 1
+    if tag == b'N':
+        return None, pos
+    elif tag == b'T':
+        return True, pos
+    elif tag == b'F':
+        return False, pos
+    elif tag == b'i':
+        return _INT.unpack_from(buf, pos)[0], pos + _INT.size
+    elif tag == b'd':
+        return _FLOAT.unpack_from(buf, pos)[0], pos + _FLOAT.size
+    elif tag in (b's', b'b'):
+        length = _LENGTH.unpack_from(buf, pos)[0]
+        pos += _LENGTH.size
+        data = bytes(buf[pos:pos + length])
+        return (data.decode("utf-8") if tag == b's' else data), pos + length
+    elif tag in (b't', b'l'):
+        length = _LENGTH.unpack_from(buf, pos)[0]
+        pos += _LENGTH.size
+        items = []
+        for n in range(length):
+            item, pos = _decode(buf, pos)
+            items.append(item)
+        return (tuple(items) if tag == b't' else items), pos
+    elif tag == b'm':
+        length = _LENGTH.unpack_from(buf, pos)[0]
+        pos += _LENGTH.size
+        result = {}
+        for n in range(length):
+            key, pos = _decode(buf, pos)
+            result[key], pos = _decode(buf, pos)
+        return result, pos
+    elif tag == b'e':
+        length = _LENGTH.unpack_from(buf, pos)[0]
+        pos += _LENGTH.size
+        name = bytes(buf[pos:pos + length]).decode("utf-8")
+        pos += length
+        value = _INT.unpack_from(buf, pos)[0]
+        enum_type = getattr(enums, name, None) if name in enums.__all__ else None
+        return (enum_type(value) if enum_type is not None else value), pos + _INT.size
+    elif tag == b'a':
+        length = _LENGTH.unpack_from(buf, pos)[0]
+        pos += _LENGTH.size
+        dtype = np.dtype(bytes(buf[pos:pos + length]).decode("ascii"))
+        pos += length
+        ndim = struct.unpack_from('<B', buf, pos)[0]
+        pos += 1
+        shape = struct.unpack_from('<%dQ' % ndim, buf, pos)
+        pos += 8 * ndim
+        count = int(np.prod(shape))
+        # Array shares memory with the (writable) frame buffer
+        array = np.frombuffer(buf, dtype=dtype, count=count, offset=pos).reshape(shape)
+        return array, pos + count * dtype.itemsize
+    else:
+        raise ValueError("Unknown type tag in RPC message: %r" % tag)
+
+
+def decode(buf, pos=0):
+    """Decode value from buffer"""
+    return _decode(buf, pos)[0]
+
+
+def _read_exactly(stream, length):
+    """Read 'length' bytes into new bytearray, returns None on EOF"""
+    if not hasattr(stream, "readinto"):
+        # Python 2 socket files
+        data = stream.read(length)
+        return bytearray(data) if len(data) == length else None
+    buf = bytearray(length)
+    view = memoryview(buf)
+    pos = 0
+    while pos < length:
+        count = stream.readinto(view[pos:])
+        if not count:
+            return None
+        pos += count
+    return buf
+
+
+def read_frame(stream):
+    """Read frame from binary file-like stream. Returns payload as bytearray or None on EOF"""
+    header = _read_exactly(stream, _LENGTH.size)
+    if header is None:
+        return None
+    length = _LENGTH.unpack(bytes(header))[0]
+    if length > MAX_FRAME_SIZE:
+        raise ValueError("RPC frame too large.")
+    return _read_exactly(stream, length)
+
+
+def frame(*parts):
+    """Create frame (bytes) from payload parts"""
+    payload = b''.join(parts)
+    return _LENGTH.pack(len(payload)) + payload
+
+
+class RpcHandler(StreamRequestHandler):
+    """Handles the calls of one RPC connection, in order of arrival"""
+    disable_nagle_algorithm = True
+
+    def handle(self):
+        while True:
+            try:
+                request = read_frame(self.rfile)
+            except (socket.error, ValueError):
+                return
+            if request is None:
+                return
+            try:
+                request_id = _REQUEST.unpack_from(request)[0]
+            except struct.error:
+                # no request id to answer
+                return
+            try:
+                method, args, kwargs = decode(request, _REQUEST.size)
+                result = self.server.call(method, args, kwargs)
+                response = frame(_RESPONSE.pack(request_id, STATUS_OK), encode(result))
+            except Exception as exc:
+                response = frame(_RESPONSE.pack(request_id, STATUS_ERROR), encode((type(exc).__name__, str(exc))))
+            self.wfile.write(response)
+
+
+class _RpcServerMixIn(object):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def _setup(self, microscope, microscope_lock, coalescer):
+        self.microscope = microscope
+        self.microscope_lock = microscope_lock if microscope_lock is not None else threading.Lock()
+        self.coalescer = coalescer
+
+    def call(self, method, args, kwargs):
+        """Call public method of the microscope"""
+        if not isinstance(method, type(u"")) or method.startswith("_"):
+            raise AttributeError("Unknown method: %s" % method)
+        func = getattr(self.microscope, method)
+        if not callable(func):
+            raise AttributeError("Unknown method: %s" % method)
+        if isinstance(self.microscope_lock, MicroscopeScheduler):
+            result = self.microscope_lock.call(lane_for_method(method), func, *args, **kwargs)
+        else:
+            with self.microscope_lock:
+                result = func(*args, **kwargs)
+        if self.coalescer is not None and not method.startswith("get_"):
+            # results of HTTP GETs must not be reused after a change
+            self.coalescer.invalidate()
+        return result
+
+
+class RpcServer(_RpcServerMixIn, ThreadingMixIn, TCPServer, object):
+    """
+    Serves the methods of 'microscope' via binary RPC on a TCP socket.
+
+    :param address: (host, port) to listen on
+    :param microscope: Microscope-like object
+    :param microscope_lock: Lock or MicroscopeScheduler serializing the microscope calls (e.g. shared with the HTTP server)
+    :param coalescer: RequestCoalescer of the HTTP server, invalidated after changes
+    """
+    def __init__(self, address, microscope, microscope_lock=None, coalescer=None):
+        self._setup(microscope, microscope_lock, coalescer)
+        super(RpcServer, self).__init__(address, RpcHandler)
+
+
+if UnixStreamServer is not None:
+    class RpcUnixServer(_RpcServerMixIn, ThreadingMixIn, UnixStreamServer, object):
+        """Like RpcServer, but listening on a Unix socket at 'path'"""
+        def __init__(self, path, microscope, microscope_lock=None, coalescer=None):
+            self._setup(microscope, microscope_lock, coalescer)
+            super(RpcUnixServer, self).__init__(path, _RpcUnixHandler)
+
+    class _RpcUnixHandler(RpcHandler):
+        disable_nagle_algorithm = False
+
+
+class RpcError(Exception):
+    """Remote call raised exception, which has no builtin equivalent"""
+    pass
+
+
+class RpcCall(object):
+    """Pending remote call, see RpcClient.submit()"""
+    def __init__(self):
+        self._done = threading.Event()
+        self._result = None
+        self._error = None
+
+    def _set(self, result=None, error=None):
+        self._result = result
+        self._error = error
+        self._done.set()
+
+    def done(self):
+        return self._done.is_set()
+
+    def result(self, timeout=None):
+        """Wait for the call to complete and return its result (or raise its exception)"""
+        if not self._done.wait(timeout):
+            raise socket.timeout("Remote call timed out")
+        if self._error is not None:
+            raise self._error
+        return self._result
+
+
+def _remote_exception(name, message):
+    try:
+        import builtins
+    except ImportError:
+        import __builtin__ as builtins
+    exc_type = getattr(builtins, name, None)
+    if isinstance(exc_type, type) and issubclass(exc_type, Exception):
+        return exc_type(message)
+    return RpcError("%s: %s" % (name, message))
+
+
+class RpcClient(object):
+    """
+    Thread-safe client for RpcServer.
+
+    Calls can be issued from several threads, or submitted without waiting for the result,
+    so several calls are in flight on the same connection:
+
+        pending = [client.submit("set_beam_shift", shift), client.submit("get_image_shift")]
+        image_shift = pending[1].result()
+
+    :param address: (host, port) of the server or path of a Unix socket
+    :param timeout: Timeout in seconds for connecting and for call() (None: wait forever)
+    """
+    def __init__(self, address, timeout=None):
+        self.address = address
+        self.timeout = timeout
+        # _lock guards connection and pending calls, _send_lock the writes: the reader
+        # never waits for a send blocked by a full server buffer
+        self._lock = threading.Lock()
+        self._send_lock = threading.Lock()
+        self._sock = None
+        self._pending = {}
+        self._next_id = 0
+
+    def _connect(self):
+        if isinstance(self.address, str):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.settimeout(self.timeout)
+            sock.connect(self.address)
+        else:
+            sock = socket.create_connection(tuple(self.address), timeout=self.timeout)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        sock.settimeout(None)
+        reader = threading.Thread(target=self._read_responses, args=(sock,))
+        reader.daemon = True
+        reader.start()
+        return sock
+
+    def _read_responses(self, sock):
+        stream = sock.makefile('rb')
+        error = None
+        try:
+            while True:
+                response = read_frame(stream)
+                if response is None:
+                    break
+                request_id, status = _RESPONSE.unpack_from(response)
+                value = decode(response, _RESPONSE.size)
+                with self._lock:
+                    call = self._pending.pop(request_id, None)
+                if call is None:
+                    continue
+                if status == STATUS_OK:
+                    call._set(result=value)
+                else:
+                    call._set(error=_remote_exception(*value))
+        except Exception as exc:
+            # includes malformed responses (e.g. struct.error)
+            error = exc
+        finally:
+            stream.close()
+        # Connection lost: fail calls still waiting
+        with self._lock:
+            if self._sock is sock:
+                self._sock = None
+            pending = self._pending
+            self._pending = {}
+        sock.close()
+        for call in pending.values():
+            call._set(error=socket.error("RPC connection closed%s" % (": %s" % error if error else "")))
+
+    def submit(self, method, *args, **kwargs):
+        """Send call of 'method' and return RpcCall without waiting for the result"""
+        call = RpcCall()
+        body = encode((method, args, kwargs))
+        with self._lock:
+            if self._sock is None:
+                self._sock = self._connect()
+            sock = self._sock
+            self._next_id = (self._next_id + 1) & 0xffffffff
+            request_id = self._next_id
+            self._pending[request_id] = call
+        with self._send_lock:
+            try:
+                sock.sendall(frame(_REQUEST.pack(request_id), body))
+            except socket.error:
+                with self._lock:
+                    self._pending.pop(request_id, None)
+                    if self._sock is sock:
+                        self._sock = None
+                sock.close()
+                raise
+        return call
+
+    def call(self, method, *args, **kwargs):
+        """Call 'method' and return its result"""
+        return self.submit(method, *args, **kwargs).result(self.timeout)
+
+    def close(self):
+        with self._lock:
+            sock = self._sock
+            self._sock = None
+        if sock is not None:
+            sock.shutdown(socket.SHUT_RDWR)
+            sock.close()
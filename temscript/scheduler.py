@@ -0,0 +1,199 @@
+"""
+Priority lanes for the microscope calls.
+
+The servers handle requests in parallel, but call the microscope one at a time. Instead of
+a lock, where any call queues behind whatever runs, the calls are queued in lanes:
+
+    safety:     sample protection (blanking the beam)
+    control:    interactive changes and queries
+    poll:       polling of the event publisher
+    bulk:       long running calls (acquisitions, normalization)
+
+When the microscope becomes free, the longest waiting call of the highest lane with waiting
+calls goes next. A running call is never interrupted: a blanking request waits at most for
+the call in progress, not for the queued acquisitions. Per lane wait times are reported by
+:meth:`MicroscopeScheduler.stats` (see "/v1/scheduler_stats").
+"""
+from __future__ import division, print_function
+from collections import deque
+from contextlib import contextmanager
+import threading
+import time
+
+from .timing import phase
+
+# Lanes in order of priority
+LANES = ("safety", "control", "poll", "bulk")
+
+# GET endpoints which are not scheduled (they don't call the microscope; the
+# events server runs "history" queries, which may read from disk, in an executor)
+UNSCHEDULED_ENDPOINTS = {"coalescing_stats", "scheduler_stats", "poll_stats", "history", "autofocus"}
+
+# PUT endpoints for sample protection
+SAFETY_ENDPOINTS = {"beam_blanked"}
+
+# Long running GET and PUT endpoints
+BULK_ENDPOINTS = {"acquire", "drift"}
+BULK_PUT_ENDPOINTS = {"normalize", "autofocus"}
+
+# Microscope methods (RPC) for sample protection and long running methods
+SAFETY_METHODS = {"set_beam_blanked"}
+BULK_METHODS = {"acquire", "acquire_stack", "normalize"}
+
+
+def lane_for(endpoint, put=False):
+    """
+    Lane of a request to the V1 endpoint, None for endpoints which don't call the microscope.
+
+    :param put: Whether the request is a PUT (otherwise a GET)
+    """
+    if put:
+        if endpoint in SAFETY_ENDPOINTS:
+            return "safety"
+        if endpoint in BULK_PUT_ENDPOINTS:
+            return "bulk"
+    elif endpoint in UNSCHEDULED_ENDPOINTS:
+        return None
+    elif endpoint in BULK_ENDPOINTS:
+        return "bulk"
+    return "control"
+
+
+def lane_for_method(method):
+    """Lane of a call of the microscope method (by name)"""
+    if method in SAFETY_METHODS:
+        return "safety"
+    if method in BULK_METHODS:
+        return "bulk"
+    return "control"
+
+
+class _LaneStats(object):
+    __slots__ = ("calls", "wait_total", "wait_max", "wait_last")
+
+    def __init__(self):
+        self.calls = 0
+        self.wait_total = 0.0
+        self.wait_max = 0.0
+        self.wait_last = None
+
+    def add(self, wait):
+        self.calls += 1
+        self.wait_total += wait
+        self.wait_max = max(self.wait_max, wait)
+        self.wait_last = wait
+
+
+class MicroscopeScheduler(object):
+    """
+    Exclusive access to the microscope, granted by priority lane (see :data:`LANES`)
+    and in order of arrival within a lane.
+
+    Can be used in place of a lock (e.g. by :class:`temscript.rpc.RpcServer`), then
+    the calls go through 'default_lane'.
+
+    Usage:
+        with scheduler.lane("safety"):
+            microscope.set_beam_blanked(True)
+
+    :param default_lane: Lane of acquire() without lane and of the lock interface
+    :type default_lane: str
+    """
+    def __init__(self, default_lane="control"):
+        if default_lane not in LANES:
+            raise ValueError("Unknown lane: %s" % default_lane)
+        self.default_lane = default_lane
+        self._cond = threading.Condition(threading.Lock())
+        self._busy = False
+        self._queues = dict((name, deque()) for name in LANES)
+        self._stats = dict((name, _LaneStats()) for name in LANES)
+
+    def _head(self):
+        """Next waiting call (called with the condition held)"""
+        for name in LANES:
+            queue = self._queues[name]
+            if queue:
+                return queue[0]
+        return None
+
+    def acquire(self, lane=None):
+        """Wait until the microscope is free and no call of a higher lane (or earlier in the same lane) waits"""
+        lane = lane if lane is not None else self.default_lane
+        queue = self._queues.get(lane)
+        if queue is None:
+            raise ValueError("Unknown lane: %s" % lane)
+        start = time.time()
+        with self._cond:
+            if self._busy or self._head() is not None:
+                ticket = object()
+                queue.append(ticket)
+                try:
+                    while self._busy or self._head() is not ticket:
+                        self._cond.wait()
+                except BaseException:
+                    queue.remove(ticket)
+                    self._cond.notify_all()
+                    raise
+                queue.popleft()
+            self._busy = True
+            self._stats[lane].add(time.time() - start)
+        return True
+
+    def release(self):
+        """Release the microscope to the next waiting call"""
+        with self._cond:
+            if not self._busy:
+                raise RuntimeError("Release of unacquired scheduler")
+            self._busy = False
+            self._cond.notify_all()
+
+    @contextmanager
+    def lane(self, lane):
+        """Context manager for exclusive access through 'lane'"""
+        self.acquire(lane)
+        try:
+            yield
+        finally:
+            self.release()
+
+    def call(self, lane, func, *args, **kw):
+        """
+        Call func(*args, **kw) with exclusive access through 'lane' (no scheduling if lane is None).
+        The wait and the call are timed as phases "queue" and "microscope" (see temscript.timing).
+        """
+        if lane is None:
+            return func(*args, **kw)
+        with phase("queue"):
+            self.acquire(lane)
+        try:
+            with phase("microscope"):
+                return func(*args, **kw)
+        finally:
+            self.release()
+
+    # Lock interface (default lane)
+    def __enter__(self):
+        self.acquire()
+        return self
+
+    def __exit__(self, exc_type, exc_value, tb):
+        self.release()
+
+    def stats(self):
+        """
+        Return dict with "busy" (whether a call runs) and "lanes": dict lane -> dict with
+        "calls", "waiting" (queued calls), "wait_mean", "wait_max" and "wait_last" (seconds
+        from the request of access until it was granted, None without calls).
+        """
+        with self._cond:
+            lanes = {}
+            for name in LANES:
+                stats = self._stats[name]
+                lanes[name] = {
+                    "calls": stats.calls,
+                    "waiting": len(self._queues[name]),
+                    "wait_mean": stats.wait_total / stats.calls if stats.calls else None,
+                    "wait_max": stats.wait_max if stats.calls else None,
+                    "wait_last": stats.wait_last,
+                }
+            return {"busy": self._busy, "lanes": lanes}
@@ -3,18 +3,31 @@ from __future__ import division, print_function
 import numpy as np
 import json
 import traceback
+import threading
+from contextlib import contextmanager
 
 from .microscope import STAGE_AXES
+from .coalescing import RequestCoalescer
+from .scheduler import MicroscopeScheduler, lane_for
+from .accumulate import FrameAccumulation
+from .drift import DriftTracker
+from .framepool import release_images
+from . import framecodec
+from . import oobpickle
+from .timing import RequestTiming, SlowRequestLog, phase
+from .autofocus import Autofocus
 
 # Get imports from library
 try:
     # Python 3.X
     from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
     from urllib.parse import urlparse, parse_qs, quote
     from io import BytesIO
 except ImportError:
     # Python 2.X
     from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
     from urlparse import urlparse, parse_qs
     from urllib import pathname2url as quote
     from cStringIO import StringIO as BytesIO
@@ -24,6 +37,12 @@ except ImportError:
 class ArrayJSONEncoder(json.JSONEncoder):
     allowed_dtypes = {"INT8", "INT16", "INT32", "INT64", "UINT8", "UINT16", "UINT32", "UINT64", "FLOAT32", "FLOAT64"}
 
+    def __init__(self, *args, **kw):
+        # compress arrays with the frame codec (see temscript.framecodec)
+        self.frame_codec = kw.pop("frame_codec", False)
+        self.encoded_frames = 0
+        super(ArrayJSONEncoder, self).__init__(*args, **kw)
+
     def default(self, obj):
         if isinstance(obj, np.ndarray):
             import sys, base64
@@ -39,13 +58,20 @@ class ArrayJSONEncoder(json.JSONEncoder):
             else:
                 endian = sys.byteorder.upper()
 
+            if self.frame_codec:
+                self.encoded_frames += 1
+                encoding, data = framecodec.ARRAY_ENCODING, framecodec.encode_frame(obj)
+            else:
+                encoding, data = "BASE64", obj
+            # width and height are the last two dimensions, "shape" gives all (e.g. stacks of frames)
             return {
-                'width': obj.shape[1],
-                'height': obj.shape[0],
+                'width': obj.shape[-1] if obj.ndim else 1,
+                'height': obj.shape[-2] if obj.ndim >= 2 else 1,
+                'shape': list(obj.shape),
                 'type': dtype_name,
                 'endianness': endian,
-                'encoding': "BASE64",
-                'data': base64.b64encode(obj).decode("ascii")
+                'encoding': encoding,
+                'data': base64.b64encode(data).decode("ascii")
             }
         return json.JSONEncoder.default(self, obj)
 
@@ -68,39 +94,207 @@ def _parse_enum(type, item):
         return type(item)
 
 
+class RequestError(Exception):
+    """Request failed with HTTP status 'code'"""
+    def __init__(self, code, message):
+        super(RequestError, self).__init__(message)
+        self.code = code
+        self.message = message
+
+
+# GET endpoints, which are never shared between requests
+UNCOALESCED_ENDPOINTS = {"acquire", "drift", "coalescing_stats", "scheduler_stats"}
+
+
 class MicroscopeHandler(BaseHTTPRequestHandler):
-    def build_response(self, response):
+    # Persistent connections: every response is framed by Content-Length (or is a 204),
+    # so clients can keep the connection open and pipeline requests.
+    protocol_version = "HTTP/1.1"
+    # Small responses are sent in two writes (headers, body), don't let Nagle delay the second
+    disable_nagle_algorithm = True
+    # Default idle timeout of persistent connections in seconds (see MicroscopeServer)
+    timeout = 30
+    # Default maximum number of accumulated frames per acquisition request (see MicroscopeServer)
+    max_frames = 1000
+
+    def setup(self):
+        self.timeout = getattr(self.server, "idle_timeout", self.timeout)
+        self.max_frames = getattr(self.server, "max_frames", self.max_frames)
+        self.timing = None
+        self.response_status = None
+        BaseHTTPRequestHandler.setup(self)
+
+    @contextmanager
+    def timed_request(self):
+        """
+        Time the phases of the request (see temscript.timing) for the Server-Timing
+        header (if server.server_timing) and the slow request log (server.slow_log)
+        """
+        self.timing = RequestTiming()
+        self.response_status = None
+        try:
+            with self.timing.activate():
+                yield
+        finally:
+            slow_log = getattr(self.server, "slow_log", None)
+            if slow_log is not None:
+                slow_log.record(self.timing, self.command, self.path, self.response_status)
+            self.timing = None
+
+    def send_response(self, code, message=None):
+        self.response_status = code
+        BaseHTTPRequestHandler.send_response(self, code, message)
+
+    def end_headers(self):
+        if self.timing is not None and getattr(self.server, "server_timing", False):
+            self.send_header("Server-Timing", self.timing.header())
+        BaseHTTPRequestHandler.end_headers(self)
+
+    def call_microscope(self, func, *args, **kw):
+        """
+        Call func with exclusive access to the microscope (connections are handled in parallel threads).
+        With a MicroscopeScheduler, the call waits in lane kw["lane"] (default "control", None: not scheduled).
+        """
+        lane = kw.pop("lane", "control")
+        lock = getattr(self.server, "microscope_lock", None)
+        if lock is None:
+            with phase("microscope"):
+                return func(*args)
+        if isinstance(lock, MicroscopeScheduler):
+            return lock.call(lane, func, *args)
+        with phase("queue"):
+            lock.acquire()
+        try:
+            with phase("microscope"):
+                return func(*args)
+        finally:
+            lock.release()
+
+    def invalidate_coalesced(self):
+        """Drop shared GET results (after a change of the microscope state)"""
+        coalescer = getattr(self.server, "coalescer", None)
+        if coalescer is not None:
+            coalescer.invalidate()
+
+    def send_request_error(self, code, message):
+        """
+        Send error reply for a completely read request. Unlike send_error(), the
+        connection is kept open.
+        """
+        self.log_error("code %d, message %s", code, message)
+        body = message.encode("utf-8", "replace")
+        self.send_response(code, message)
+        self.send_header('Content-Type', 'text/plain; charset=utf-8')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def encode_response(self, response):
+        """
+        Encode response as accepted by the client.
+
+        :returns: None for empty responses, otherwise tuple (content_type, content_encoding, encoded_response).
+            encoded_response is a list of parts for the pickle 5 transport (see temscript.oobpickle).
+        """
         if response is None:
-            self.send_response(204)
-            self.end_headers()
-            return
-        self.send_response(200)
+            return None
 
-        # Transport encoding
+        # Transport encoding, arrays compressed with the frame codec if accepted
         accept_type = [x.split(';', 1)[0].strip() for x in self.headers.get("Accept", "").split(",")]
-        if "application/python-pickle" in accept_type:
+        frame_codec = framecodec.accepts_encoding(self.headers.get("Accept-Encoding", ""))
+        if oobpickle.CONTENT_TYPE in accept_type and oobpickle.available():
+            # array data is sent out-of-band without copies, no compression
+            with phase("encode"):
+                if frame_codec:
+                    response, encoded_frames = framecodec.encode_frames(response)
+                return oobpickle.CONTENT_TYPE, None, oobpickle.dumps(response)
+        elif "application/python-pickle" in accept_type:
             import pickle
-            encoded_response = pickle.dumps(response, protocol=2)
+            with phase("encode"):
+                encoded_frames = 0
+                if frame_codec:
+                    response, encoded_frames = framecodec.encode_frames(response)
+                encoded_response = pickle.dumps(response, protocol=2)
             content_type = "application/python-pickle"
         else:
-            encoded_response = ArrayJSONEncoder().encode(response).encode("utf-8")
+            with phase("encode"):
+                encoder = ArrayJSONEncoder(frame_codec=frame_codec)
+                encoded_response = encoder.encode(response).encode("utf-8")
+            encoded_frames = encoder.encoded_frames
             content_type = "application/json"
 
-        # Compression?
+        # Compression? (not for compressed frames)
+        content_encoding = None
         accept_encoding = [x.split(';', 1)[0].strip() for x in self.headers.get("Accept-Encoding", "").split(",")]
-        if len(encoded_response) > 256 and 'gzip' in accept_encoding:
-            encoded_response = _gzipencode(encoded_response)
-            self.send_header('Content-Encoding', 'gzip')
+        if len(encoded_response) > 256 and 'gzip' in accept_encoding and not encoded_frames:
+            with phase("compress"):
+                encoded_response = _gzipencode(encoded_response)
+            content_encoding = 'gzip'
+        return content_type, content_encoding, encoded_response
+
+    def write_response(self, encoded):
+        """Send response encoded by encode_response()"""
+        if encoded is None:
+            self.send_response(204)
+            self.end_headers()
+            return
+        content_type, content_encoding, encoded_response = encoded
+        self.send_response(200)
+        if content_encoding is not None:
+            self.send_header('Content-Encoding', content_encoding)
         self.send_header('Content-Type', content_type)
         # add content length of the body to avoid accidental "partial download error" with twisted.web.client which
         # assumes the body to be chunk-encoded
-        self.send_header('Content-Length', str(len(encoded_response)))
-        self.end_headers()
-        self.wfile.write(encoded_response)
-        return
+        if isinstance(encoded_response, list):
+            self.send_header('Content-Length', str(oobpickle.body_length(encoded_response)))
+            self.end_headers()
+            with phase("send"):
+                for part in encoded_response:
+                    self.wfile.write(part)
+        else:
+            self.send_header('Content-Length', str(len(encoded_response)))
+            self.end_headers()
+            with phase("send"):
+                self.wfile.write(encoded_response)
+
+    def build_response(self, response):
+        self.write_response(self.encode_response(response))
 
     # Handler for V1 GETs
     def do_GET_V1(self, endpoint, query):
+        coalescer = getattr(self.server, "coalescer", None)
+        frames = None
+        try:
+            if endpoint == "acquire":
+                response = self.acquire_V1(query)
+                encoded = self.encode_response(response)
+                frames = response
+            elif coalescer is None or endpoint in UNCOALESCED_ENDPOINTS:
+                response = self.call_microscope(self.get_V1, endpoint, query, lane=lane_for(endpoint))
+                encoded = self.encode_response(response)
+            else:
+                # identical requests share the microscope call and the encoded response
+                key = (endpoint, tuple(sorted((k, tuple(v)) for k, v in query.items())),
+                       self.headers.get("Accept", ""), self.headers.get("Accept-Encoding", ""))
+                encoded = coalescer.get(key, lambda: self.encode_response(
+                    self.call_microscope(self.get_V1, endpoint, query, lane=lane_for(endpoint))))
+        except RequestError as exc:
+            self.send_request_error(exc.code, exc.message)
+            return
+        try:
+            self.write_response(encoded)
+        finally:
+            if frames is not None:
+                # frames are sent (the pickle 5 transport sends them without copy), reuse buffers
+                release_images(self.server.microscope, frames)
+
+    def get_V1(self, endpoint, query):
+        """
+        Execute V1 GET request
+
+        :returns: response object (None for empty response)
+        :raises RequestError: on invalid request
+        """
         # Check for known endpoints
         response = None
         if endpoint == "family":
@@ -188,29 +382,99 @@ class MicroscopeHandler(BaseHTTPRequestHandler):
                 name = endpoint[15:]
                 response = self.server.microscope.get_detector_param(name)
             except KeyError:
-                self.send_error(404, 'Unknown detector: %s' % self.path)
-                return
-        elif endpoint == "acquire":
+                raise RequestError(404, 'Unknown detector: %s' % self.path)
+        elif endpoint == "drift":
             try:
-                detectors = query["detectors"]
+                detector = query["detector"][0]
             except KeyError:
-                self.send_error(404, 'No detectors: %s' % self.path)
-                return
-            response = self.server.microscope.acquire(*detectors)
+                raise RequestError(404, 'No detector: %s' % self.path)
+            reset = query.get("reset", ["false"])[0].lower() in ("1", "true")
+            response = self.server.drift_tracker.measure(detector, reset=reset)
+        elif endpoint == "coalescing_stats":
+            coalescer = getattr(self.server, "coalescer", None)
+            response = coalescer.stats() if coalescer is not None else None
+        elif endpoint == "scheduler_stats":
+            lock = getattr(self.server, "microscope_lock", None)
+            response = lock.stats() if isinstance(lock, MicroscopeScheduler) else None
         else:
-            self.send_error(404, 'Unknown endpoint: %s' % self.path)
-            return
-        self.build_response(response)
+            raise RequestError(404, 'Unknown endpoint: %s' % self.path)
+        return response
+
+    def acquire_V1(self, query):
+        """
+        Execute V1 acquisition request. Single acquisitions and stacks are one bulk call,
+        accumulations one bulk call per frame: requests of higher lanes go through between frames.
+
+        :returns: response object
+        :raises RequestError: on invalid request
+        """
+        try:
+            detectors = query["detectors"]
+        except KeyError:
+            raise RequestError(404, 'No detectors: %s' % self.path)
+        try:
+            frames = int(query.get("frames", ["1"])[0])
+        except ValueError:
+            raise RequestError(400, 'Invalid number of frames: %s' % self.path)
+        flags = dict((k, query.get(k, ["false"])[0].lower() in ("1", "true")) for k in ("average", "align", "stats"))
+        stacked = query.get("stacked", ["false"])[0].lower() in ("1", "true")
+        if stacked and (frames != 1 or any(flags.values())):
+            raise RequestError(400, 'Stacked acquisition of single frames only: %s' % self.path)
+        elif stacked:
+            names, stack = self.call_microscope(self.server.microscope.acquire_stack, *detectors, lane="bulk")
+            return {"names": list(names), "stack": stack}
+        elif frames == 1 and not any(flags.values()):
+            return self.call_microscope(self.server.microscope.acquire, *detectors, lane="bulk")
+        elif frames < 1:
+            raise RequestError(400, 'Invalid number of frames: %s' % self.path)
+        elif frames > self.max_frames:
+            raise RequestError(400, 'Too many frames (maximum %d): %s' % (self.max_frames, self.path))
+        accumulation = FrameAccumulation(self.server.microscope, detectors, frames, **flags)
+        while self.call_microscope(accumulation.step, lane="bulk"):
+            pass
+        return accumulation.result()
 
     # Handler for V1 PUTs
     def do_PUT_V1(self, endpoint, query):
-        # Read content
+        # Read content (before scheduling: the microscope is not held during socket I/O)
         length = int(self.headers['Content-Length'])
         if length > 4096:
             raise ValueError("Too much content...")
         content = self.rfile.read(length)
         decoded_content = json.loads(content.decode("utf-8"))
 
+        try:
+            if endpoint == "autofocus":
+                response = self.run_autofocus(decoded_content)
+            else:
+                response = self.call_microscope(self.put_V1, endpoint, decoded_content,
+                                                lane=lane_for(endpoint, put=True))
+        except RequestError as exc:
+            self.send_request_error(exc.code, exc.message)
+            return
+        # results of GETs must not be reused after a change, before the client sees the reply
+        self.invalidate_coalesced()
+        self.build_response(response)
+
+    def run_autofocus(self, params):
+        """Run autofocus sweep, each step is a bulk call: requests of higher lanes go through between frames"""
+        try:
+            autofocus = Autofocus.from_dict(self.server.microscope, params)
+        except (ValueError, TypeError) as exc:
+            raise RequestError(404, 'Invalid autofocus parameters: %s' % exc)
+        sweep = autofocus.sweep()
+        progress = None
+        try:
+            while True:
+                step = self.call_microscope(next, sweep, None, lane="bulk")
+                if step is None:
+                    break
+                progress = step
+        finally:
+            self.call_microscope(sweep.close, lane="bulk")
+        return progress
+
+    def put_V1(self, endpoint, decoded_content):
         # Check for known endpoints
         response = None
         if endpoint == "stage_position":
@@ -256,58 +520,79 @@ class MicroscopeHandler(BaseHTTPRequestHandler):
                 name = endpoint[15:]
                 response = self.server.microscope.set_detector_param(name, decoded_content)
             except KeyError:
-                self.send_error(404, 'Unknown detector: %s' % self.path)
-                return
+                raise RequestError(404, 'Unknown detector: %s' % self.path)
         elif endpoint == "normalize":
             mode = decoded_content
             try:
                 self.server.microscope.normalize(mode)
             except ValueError:
-                self.send_error(404, 'Unknown mode.' % mode)
-                return
+                raise RequestError(404, 'Unknown mode: %s' % mode)
         else:
-            self.send_error(404, 'Unknown endpoint: %s' % self.path)
-            return
-        self.build_response(response)
+            raise RequestError(404, 'Unknown endpoint: %s' % self.path)
+        return response
 
     # Handler for the GET requests
     def do_GET(self):
-        try:
-            request = urlparse(self.path)
-            if request.path.startswith("/v1/"):
-                self.do_GET_V1(request.path[4:], parse_qs(request.query))
-            else:
-                self.send_error(404, 'Unknown API version: %s' % self.path)
-            return
-        except Exception as exc:
-            self.log_error("Exception raised during handling of GET request: %s\n%s",
-                           self.path, traceback.format_exc())
-            self.send_error(500, "Error handling request: %s" % self.path)
+        with self.timed_request():
+            try:
+                request = urlparse(self.path)
+                if request.path.startswith("/v1/"):
+                    self.do_GET_V1(request.path[4:], parse_qs(request.query))
+                else:
+                    self.send_request_error(404, 'Unknown API version: %s' % self.path)
+                return
+            except Exception as exc:
+                self.log_error("Exception raised during handling of GET request: %s\n%s",
+                               self.path, traceback.format_exc())
+                self.send_error(500, "Error handling request: %s" % self.path)
 
     # Handler for the PUT requests
     def do_PUT(self):
-        try:
-            request = urlparse(self.path)
-            if request.path.startswith("/v1/"):
-                self.do_PUT_V1(request.path[4:], parse_qs(request.query))
-            else:
-                self.send_error(404, 'Unknown API version: %s' % self.path)
-            return
-        except Exception as exc:
-            self.log_error("Exception raised during handling of PUT request: %s\n%s",
-                           self.path, traceback.format_exc())
-            self.send_error(500, "Error handling request: %s" % self.path)
+        with self.timed_request():
+            try:
+                request = urlparse(self.path)
+                if request.path.startswith("/v1/"):
+                    self.do_PUT_V1(request.path[4:], parse_qs(request.query))
+                else:
+                    # content was not read: send_error closes the connection
+                    self.send_error(404, 'Unknown API version: %s' % self.path)
+                return
+            except Exception as exc:
+                self.log_error("Exception raised during handling of PUT request: %s\n%s",
+                               self.path, traceback.format_exc())
+                self.send_error(500, "Error handling request: %s" % self.path)
+
+class MicroscopeServer(ThreadingMixIn, HTTPServer, object):
+    """
+    HTTP server for a microscope.
+
+    Each (persistent) connection is handled in its own thread, calls to the microscope
+    are serialized by priority lane (see :mod:`temscript.scheduler`). Connections idle
+    for more than idle_timeout seconds are closed. Acquisition requests accumulating
+    more than max_frames frames are rejected.
+
+    With server_timing=True, responses carry a Server-Timing header with the durations of the
+    request phases, slow requests are logged to slow_log (see :mod:`temscript.timing`).
+    """
+    daemon_threads = True
 
-class MicroscopeServer(HTTPServer, object):
     def __init__(self, *args, **kw):
         microscope_factory = kw.pop("microscope_factory", None)
         if microscope_factory is None:
             from .microscope import Microscope
-            microscope_factory = Microscope
+            microscope_factory = lambda: Microscope(warm_up=True)
+        coalesce_window = kw.pop("coalesce_window", 0.0)
+        self.idle_timeout = kw.pop("idle_timeout", MicroscopeHandler.timeout)
+        self.max_frames = kw.pop("max_frames", MicroscopeHandler.max_frames)
+        self.server_timing = kw.pop("server_timing", False)
+        self.slow_log = kw.pop("slow_log", None)
         super(MicroscopeServer, self).__init__(*args, **kw)
         self.microscope = microscope_factory()
+        self.microscope_lock = MicroscopeScheduler()
+        self.coalescer = RequestCoalescer(coalesce_window)
+        self.drift_tracker = DriftTracker(self.microscope)
 
-class NullMicroscopeServer(HTTPServer, object):
+class NullMicroscopeServer(ThreadingMixIn, HTTPServer, object):
     """
     For testing the RemoteMicroscope class against a NullMicroscope
     via the remote interface.
@@ -317,13 +602,68 @@ class NullMicroscopeServer(HTTPServer, object):
         temscripting_server = server.NullMicroscopeServer(("127.0.0.1", 8080), server.MicroscopeHandler)
         temscripting_server.serve_forever()
     """
+    daemon_threads = True
+
     def __init__(self, *args, **kw):
         microscope_factory = kw.pop("microscope_factory", None)
         if microscope_factory is None:
             from .null_microscope import NullMicroscope
             microscope_factory = NullMicroscope
+        coalesce_window = kw.pop("coalesce_window", 0.0)
+        self.idle_timeout = kw.pop("idle_timeout", MicroscopeHandler.timeout)
+        self.max_frames = kw.pop("max_frames", MicroscopeHandler.max_frames)
+        self.server_timing = kw.pop("server_timing", False)
+        self.slow_log = kw.pop("slow_log", None)
         super(NullMicroscopeServer, self).__init__(*args, **kw)
         self.microscope = microscope_factory()
+        self.microscope_lock = MicroscopeScheduler()
+        self.coalescer = RequestCoalescer(coalesce_window)
+        self.drift_tracker = DriftTracker(self.microscope)
+
+
+def report_startup_times(microscope, report):
+    """
+    Pass the startup times of the microscope (see :meth:`Microscope.wait_warm_up`) to 'report'
+    as message, when its warm up finished. Does nothing for microscopes without warm up.
+    """
+    wait_warm_up = getattr(microscope, "wait_warm_up", None)
+    if wait_warm_up is None:
+        return
+
+    def wait():
+        times = wait_warm_up()
+        report("Microscope startup times: %s" % ", ".join("%s=%s" % (key, ("%.3fs" % value) if isinstance(value, float) else value)
+                                                          for key, value in sorted(times.items())))
+    thread = threading.Thread(target=wait, name="MicroscopeStartupReport")
+    thread.daemon = True
+    thread.start()
+
+
+def start_rpc_servers(server, host, port=None, path=None):
+    """
+    Serve the microscope of the HTTP server additionally via binary RPC (see :mod:`temscript.rpc`),
+    in background threads. The microscope calls of both transports are serialized.
+
+    :param server: MicroscopeServer or NullMicroscopeServer
+    :param host: Host address for the RPC TCP socket
+    :param port: Port for the RPC TCP socket (None: no TCP socket)
+    :param path: Path for the RPC Unix socket (None: no Unix socket)
+    :returns: List of started RPC servers
+    """
+    from .rpc import RpcServer
+    rpc_servers = []
+    if port is not None:
+        rpc_servers.append(RpcServer((host, port), server.microscope, server.microscope_lock, server.coalescer))
+        print("Started RPC server on host '%s' port %d." % (host, port))
+    if path is not None:
+        from .rpc import RpcUnixServer
+        rpc_servers.append(RpcUnixServer(path, server.microscope, server.microscope_lock, server.coalescer))
+        print("Started RPC server on socket '%s'." % path)
+    for rpc_server in rpc_servers:
+        thread = threading.Thread(target=rpc_server.serve_forever)
+        thread.daemon = True
+        thread.start()
+    return rpc_servers
 
 
 def run_server(argv=None, microscope_factory=None):
@@ -340,12 +680,46 @@ def run_server(argv=None, microscope_factory=None):
     parser = argparse.ArgumentParser()
     parser.add_argument("-p", "--port", type=int, default=8080, help="Specify port on which the server is listening")
     parser.add_argument("--host", type=str, default='', help="Specify host address on which the the server is listening")
+    parser.add_argument("--coalesce-window", type=float, default=0.05,
+                        help="Time in seconds identical GET requests share one microscope call")
+    parser.add_argument("--idle-timeout", type=float, default=30.0,
+                        help="Time in seconds after which idle persistent connections are closed")
+    parser.add_argument("--max-frames", type=int, default=MicroscopeHandler.max_frames,
+                        help="Maximum number of frames accumulated per acquisition request")
+    parser.add_argument("--rpc-port", type=int, default=None,
+                        help="Additionally serve the binary RPC transport on this port")
+    parser.add_argument("--rpc-socket", type=str, default=None,
+                        help="Additionally serve the binary RPC transport on this Unix socket")
+    parser.add_argument("--trace", type=str, default=None,
+                        help="Record the microscope calls into this trace file (see scripts/replay-trace.py)")
+    parser.add_argument("--server-timing", action="store_true",
+                        help="Send the durations of the request phases in a Server-Timing header")
+    parser.add_argument("--slow-log", type=str, default=None,
+                        help="Log requests slower than the slow threshold into this file")
+    parser.add_argument("--slow-threshold", type=float, default=1.0,
+                        help="Time in seconds from which requests are logged as slow")
     args = parser.parse_args(argv)
 
+    if args.trace is not None:
+        from .trace import TracingMicroscope
+        if microscope_factory is None:
+            from .microscope import Microscope
+            microscope_factory = lambda: Microscope(warm_up=True)
+        traced_factory = microscope_factory
+        microscope_factory = lambda: TracingMicroscope(traced_factory(), args.trace)
+
     try:
         # Create a web server and define the handler to manage the incoming request
-        server = MicroscopeServer((args.host, args.port), MicroscopeHandler, microscope_factory=microscope_factory)
+        server = MicroscopeServer((args.host, args.port), MicroscopeHandler, microscope_factory=microscope_factory,
+                                  coalesce_window=args.coalesce_window, idle_timeout=args.idle_timeout,
+                                  max_frames=args.max_frames,
+                                  server_timing=args.server_timing,
+                                  slow_log=SlowRequestLog(args.slow_log, args.slow_threshold) if args.slow_log else None)
         print("Started httpserver on host '%s' port %d." % (args.host, args.port))
+        start_rpc_servers(server, args.host, args.rpc_port, args.rpc_socket)
+        if args.trace is not None:
+            print("Recording microscope calls into '%s'." % args.trace)
+        report_startup_times(server.microscope, print)
         print("Press Ctrl+C to stop server.")
         # Wait forever for incoming htto requests
         server.serve_forever()
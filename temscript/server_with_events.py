@@ -7,18 +7,32 @@ if sys.hexversion < 0x03080000:
     sys.exit("Python 3.8 (32 bit) or newer is required to run this program.")
 
 import os
+import time
+import math
 import argparse
 
 import numpy as np
 import json
 from io import BytesIO
 import asyncio
+import threading
+from concurrent.futures import ThreadPoolExecutor, wait, FIRST_COMPLETED
 from aiohttp import web, WSMsgType
 # import traceback
 
 # from functools import partial
 from temscript import server_config
 from temscript import logger
+from temscript.history import TelemetryHistory
+from temscript.coalescing import RequestCoalescer
+from temscript.scheduler import MicroscopeScheduler, lane_for
+from temscript.timing import RequestTiming, SlowRequestLog, phase
+from temscript.drift import DriftTracker
+from temscript.accumulate import FrameAccumulation
+from temscript.autofocus import Autofocus
+from temscript.framepool import release_images
+from temscript import framecodec
+from temscript.server import report_startup_times
 
 # initialize logger
 log = logger.getLoggerForModule("TemscriptingServer")
@@ -33,7 +47,9 @@ class MicroscopeServerWithEvents:
     HTTP-URLs are supposed to follow the format
         http://127.0.0.1:8080/v1/...
     Websocket connections are initialized via the websocket URL
-        ws://127.0.0.1:8080/ws/
+        ws://127.0.0.1:8080/ws/v1
+    By default a websocket client receives all changes. It can restrict
+    them by sending a subscribe message (see WebsocketSubscription).
     :param host IP the webserver is running under. Default is "0.0.0.0"
                 (run on all interfaces)
     :type host str
@@ -43,9 +59,63 @@ class MicroscopeServerWithEvents:
     :param microscope the Microscope to use (either NullMicroscope()
                 or Microscope())
     :type microscope Microscope
+    :param history History of polled values, served via "/v1/history".
+                Default is an in-memory history with default capacity.
+    :type history TelemetryHistory
+    :param coalesce_window Time in seconds identical GET requests share one
+                microscope call and encoded response (see "/v1/coalescing_stats").
+    :type coalesce_window float
+    :param server_timing Whether responses carry a Server-Timing header with
+                the durations of the request phases (see temscript.timing).
+    :type server_timing bool
+    :param slow_log Log of slow requests (None: no log).
+    :type slow_log SlowRequestLog
+    :param max_frames Maximum number of frames accumulated per acquisition
+                request, requests for more are rejected with status 400.
+    :type max_frames int
+
+    The microscope calls of GET and PUT requests run in worker threads of their
+    lane (see temscript.scheduler), polling calls in the lane "poll". The
+    scheduler serializes them, waiting calls of higher lanes go first.
     """
+    # GET commands, which are never shared between requests
+    UNCOALESCED_COMMANDS = {"acquire", "drift", "autofocus", "coalescing_stats", "poll_stats",
+                            "scheduler_stats"}
+
+    # worker threads per lane for the calls of requests
+    LANE_WORKERS = {"safety": 2, "control": 4, "bulk": 4}
+
+    # time in seconds a websocket client may take to accept a message before it is dropped
+    WEBSOCKET_SEND_TIMEOUT = 2.0
+
+    # polled commands whose values may change by a PUT command: they are read back
+    # and published right after the PUT instead of with the next poll
+    PUT_AFFECTED_COMMANDS = {
+        "stage_position": ("stage_position", "stage_status"),
+        "image_shift": ("image_shift",),
+        "beam_shift": ("beam_shift",),
+        "beam_tilt": ("beam_tilt",),
+        "df_mode": ("df_mode", "df_mode_string"),
+        "illuminated_area": ("illuminated_area", "intensity"),
+        "projection_mode": ("projection_mode", "projection_mode_string", "projection_mode_type_string",
+                            "projection_sub_mode", "magnification_index", "indicated_magnification",
+                            "indicated_camera_length"),
+        "magnification_index": ("magnification_index", "projection_sub_mode", "indicated_magnification",
+                                "indicated_camera_length"),
+        "stem_magnification": ("stem_magnification",),
+        "defocus": ("defocus", "objective_excitation"),
+        "probe_defocus": ("probe_defocus",),
+        "intensity": ("intensity", "illuminated_area"),
+        "diffraction_shift": ("diffraction_shift",),
+        "objective_stigmator": ("objective_stigmator",),
+        "condenser_stigmator": ("condenser_stigmator",),
+        "beam_blanked": ("beam_blanked",),
+        "voltage_offset": ("voltage_offset", "voltage"),
+        "autofocus": ("defocus", "objective_excitation"),
+    }
 
-    def __init__(self, microscope, host="0.0.0.0", port=8080):
+    def __init__(self, microscope, host="0.0.0.0", port=8080, history=None, coalesce_window=0.0,
+                 server_timing=False, slow_log=None, max_frames=1000):
         self.host = host
         self.port = port
         self.microscope = microscope
@@ -53,9 +123,29 @@ class MicroscopeServerWithEvents:
 
         # a dict for storing polling results
         self.microscope_state = dict()
+        # time series of polling results
+        self.history = history if history is not None else TelemetryHistory()
+        self.coalescer = RequestCoalescer(coalesce_window)
+        self.server_timing = server_timing
+        self.slow_log = slow_log
+        self.max_frames = max_frames
+        # priority lanes of the microscope calls, each lane with its own worker
+        # threads (a blanking request does not wait for a thread busy with acquisitions)
+        self.scheduler = MicroscopeScheduler()
+        self.lane_executors = dict((lane, ThreadPoolExecutor(max_workers=workers, thread_name_prefix="MicroscopeLane-" + lane))
+                                   for lane, workers in self.LANE_WORKERS.items())
+        # history queries (may read spill files) run off the event loop, outside the lanes
+        self.history_executor = ThreadPoolExecutor(max_workers=2, thread_name_prefix="History")
+        # reference frames for "/v1/drift"
+        self.drift_tracker = DriftTracker(microscope)
+        # last progress of "/v1/autofocus" (None: never run)
+        self.autofocus_status = None
+        self.autofocus_running = False
+        # the running MicroscopeEventPublisher (None: no polling)
+        self.event_publisher = None
         self.microscope_state_lock = asyncio.Lock()
-        # set of client references
-        self.clients = set()
+        # client references: websocket -> WebsocketSubscription
+        self.clients = dict()
         self.clients_lock = asyncio.Lock()
 
 
@@ -67,25 +157,100 @@ class MicroscopeServerWithEvents:
         """
         command = request.match_info['name']
         parameter = request.rel_url.query
+        frame_codec = framecodec.accepts_encoding(request.headers.get("Accept-Encoding"))
+        lane = lane_for(command)
         try:
-            response = self.do_GET_V1(command, parameter)
-            if response is None:
+            if command in self.UNCOALESCED_COMMANDS:
+                compute = lambda: self.encode_GET_V1(command, parameter, frame_codec, lane)
+            else:
+                # identical requests share the microscope call and the encoded response
+                key = (command, tuple(sorted(parameter.items())), frame_codec)
+                compute = lambda: self.coalescer.get(
+                    key, lambda: self.encode_GET_V1(command, parameter, frame_codec, lane))
+            if command == "history":
+                loop = asyncio.get_event_loop()
+                encoded_response = await loop.run_in_executor(self.history_executor,
+                                                              request["timing"].bind(compute))
+            elif command == "acquire" and self.is_accumulation(parameter):
+                encoded_response = await self.run_accumulation(parameter, frame_codec, request["timing"])
+            else:
+                encoded_response = await self.run_in_lane(lane, request["timing"].bind(compute))
+            if encoded_response is None:
                 # unsupported command: send status 204
                 return web.Response(body="Unsupported command {}"
                                     .format(command),
                                     status=204)
             else:
                 # send JSON response and (default) status 200
-                encoded_response = ArrayJSONEncoder()\
-                    .encode(response).encode("utf-8")
                 return web.Response(body=encoded_response,
                                     content_type="application/json")
         except MicroscopeException as e:
-            # regular exception due to misconfigurations etc.: send error status 404
-            return web.Response(body=e, status=404)
+            # regular exception due to misconfigurations etc.: send error status 404 (or as given)
+            return web.Response(text=str(e), status=e.status)
         except Exception as e:
             # any exception beyond that: send error status 500
-            return web.Response(body=e, status=500)
+            return web.Response(text=str(e), status=500)
+
+    @staticmethod
+    def is_accumulation(parameter):
+        """Whether the "acquire" query asks for several frames or accumulation flags"""
+        return (parameter.get("frames", "1") != "1" or
+                any(parameter.get(k, "false").lower() in ("1", "true") for k in ("average", "align", "stats")))
+
+    async def run_accumulation(self, parameter, frame_codec, timing):
+        """
+        Accumulate frames (see temscript.accumulate.FrameAccumulation), each frame is a bulk
+        call: requests of higher lanes go through between frames.
+        :return: JSON encoded result
+        """
+        detectors = parameter.getall("detectors", [])
+        if not detectors:
+            raise MicroscopeException('No detectors: acquire')
+        try:
+            frames = int(parameter.get("frames", "1"))
+        except ValueError:
+            raise MicroscopeException('Invalid number of frames: acquire')
+        flags = {k: parameter.get(k, "false").lower() in ("1", "true") for k in ("average", "align", "stats")}
+        if parameter.get("stacked", "false").lower() in ("1", "true"):
+            raise MicroscopeException('Stacked acquisition of single frames only: acquire')
+        elif frames < 1:
+            raise MicroscopeException('Invalid number of frames: acquire')
+        elif frames > self.max_frames:
+            raise MicroscopeException('Too many frames (maximum %d): acquire' % self.max_frames, status=400)
+        accumulation = FrameAccumulation(self.microscope, detectors, frames, **flags)
+        while await self.run_in_lane("bulk", timing.bind(self.scheduler.call), "bulk", accumulation.step):
+            pass
+        response = accumulation.result()
+        with timing.phase("encode"):
+            return ArrayJSONEncoder(frame_codec=frame_codec).encode(response).encode("utf-8")
+
+    async def run_in_lane(self, lane, func, *args):
+        """
+        Run func in a worker thread of 'lane', so the event loop keeps serving
+        while it waits for the microscope. Without lane (no microscope call) func
+        runs directly.
+        """
+        if lane is None:
+            return func(*args)
+        loop = asyncio.get_event_loop()
+        return await loop.run_in_executor(self.lane_executors[lane], func, *args)
+
+    def encode_GET_V1(self, command, parameter, frame_codec=False, lane=None):
+        """
+        Execute GET command and return JSON encoded response (or None)
+        :param frame_codec: Whether to compress arrays with the frame codec
+        :param lane: Lane of the command's microscope call (see temscript.scheduler),
+                     the encoding runs after the microscope is released
+        """
+        response = self.scheduler.call(lane, self.do_GET_V1, command, parameter)
+        if response is None:
+            return None
+        with phase("encode"):
+            encoded = ArrayJSONEncoder(frame_codec=frame_codec).encode(response).encode("utf-8")
+        if command == "acquire":
+            # frames are encoded, reuse buffers for next acquisition
+            release_images(self.microscope, response)
+        return encoded
 
     def do_GET_V1(self, command, parameter):
         """
@@ -186,16 +351,69 @@ class MicroscopeServerWithEvents:
             except KeyError:
                 raise MicroscopeException('Unknown detector: %s' % command)
         elif command == "acquire":
-            try:
-                detectors = parameter["detectors"]
-            except KeyError:
+            detectors = parameter.getall("detectors", [])
+            if not detectors:
                 raise MicroscopeException('No detectors: %s' % command)
-            response = self.microscope.acquire(*detectors)
+            try:
+                frames = int(parameter.get("frames", "1"))
+            except ValueError:
+                raise MicroscopeException('Invalid number of frames: %s' % command)
+            flags = {k: parameter.get(k, "false").lower() in ("1", "true") for k in ("average", "align", "stats")}
+            stacked = parameter.get("stacked", "false").lower() in ("1", "true")
+            if frames != 1 or any(flags.values()):
+                # accumulation runs one bulk call per frame, see run_accumulation()
+                raise MicroscopeException('Accumulation is not a single call: %s' % command)
+            elif stacked:
+                names, stack = self.microscope.acquire_stack(*detectors)
+                response = {"names": list(names), "stack": stack}
+            else:
+                response = self.microscope.acquire(*detectors)
+        elif command == "history":
+            response = self.get_history(parameter)
+        elif command == "drift":
+            detector = parameter.get("detector")
+            if detector is None:
+                raise MicroscopeException('No detector: %s' % command)
+            reset = parameter.get("reset", "false").lower() in ("1", "true")
+            response = self.drift_tracker.measure(detector, reset=reset)
+        elif command == "autofocus":
+            response = self.autofocus_status
+        elif command == "coalescing_stats":
+            response = self.coalescer.stats()
+        elif command == "scheduler_stats":
+            response = self.scheduler.stats()
+        elif command == "poll_stats":
+            if self.event_publisher is None:
+                raise MicroscopeException('Polling not running')
+            response = self.event_publisher.stats()
         else:
             raise MicroscopeException('Unknown endpoint: %s' % command)
         # log.debug('Returning response %s for command %s...' % (response, command))
         return response
 
+    def get_history(self, parameter):
+        """
+        Query the history of a polled value.
+        :param parameter: query parameters "key" (required), "since" (UNIX
+                          timestamp, optional) and "max_points" (optional)
+        :return: dict with "key", timestamps "t", and values "v"
+        """
+        try:
+            key = parameter["key"]
+        except (KeyError, TypeError):
+            raise MicroscopeException('No history key given')
+        try:
+            since = float(parameter["since"]) if "since" in parameter else None
+            max_points = int(parameter["max_points"]) if "max_points" in parameter else None
+        except ValueError:
+            raise MicroscopeException('Invalid history query: %s' % dict(parameter))
+        if max_points is not None and max_points < 1:
+            raise MicroscopeException('Invalid history query: max_points=%s' % max_points)
+        try:
+            return self.history.query(key, since=since, max_points=max_points)
+        except KeyError:
+            raise MicroscopeException('No history for key: %s' % key)
+
     async def http_put_handler_v1(self, request):
         """
         aiohttp handler fur PUT request for V1
@@ -211,7 +429,18 @@ class MicroscopeServerWithEvents:
             # get JSON content
             text_content = await request.text()
             json_content = json.loads(text_content)
-            response = self.do_PUT_V1(command, json_content)
+            if command == "autofocus":
+                response = await self.run_autofocus(json_content)
+            else:
+                lane = lane_for(command, put=True)
+                response = await self.run_in_lane(lane, request["timing"].bind(self.scheduler.call), lane,
+                                                  self.do_PUT_V1, command, json_content)
+            # results of GETs must not be reused after a change
+            self.coalescer.invalidate()
+            # publish the changed values now instead of with the next poll
+            # (in the background: the reply does not wait for the poll lane or the clients)
+            if self.event_publisher is not None:
+                self.event_publisher.schedule_refresh(self.PUT_AFFECTED_COMMANDS.get(command, ()))
             if response is None:
                 # unsupported command: send status 204
                 return web.Response(body="Unsupported command {}"
@@ -219,16 +448,52 @@ class MicroscopeServerWithEvents:
                                     status=204)
             else:
                 # send JSON response and (default) status 200
-                encoded_response = ArrayJSONEncoder()\
-                    .encode(response).encode("utf-8")
+                with request["timing"].phase("encode"):
+                    encoded_response = ArrayJSONEncoder()\
+                        .encode(response).encode("utf-8")
                 return web.Response(body=encoded_response,
                                     content_type="application/json")
         except MicroscopeException as e:
             # regular exception due to misconfigurations etc.: send error status 404
-            return web.Response(body=e, status=404)
+            return web.Response(text=str(e), status=404)
         except Exception as e:
             # any exception beyond that: send error status 500
-            return web.Response(body=e, status=500)
+            return web.Response(text=str(e), status=500)
+
+    async def run_autofocus(self, params):
+        """
+        Run a defocus sweep (see temscript.autofocus.Autofocus) and publish
+        its progress to the websocket clients under the key "autofocus".
+        :param params: JSON parameters of the sweep
+        :return: the final result of the sweep
+        """
+        if self.autofocus_running:
+            raise MicroscopeException('Autofocus already running')
+        try:
+            autofocus = Autofocus.from_dict(self.microscope, params)
+        except (ValueError, TypeError) as exc:
+            raise MicroscopeException('Invalid autofocus parameters: %s' % exc)
+        self.autofocus_running = True
+        sweep = autofocus.sweep()
+        try:
+            progress = None
+            while True:
+                # each step is a bulk call: requests of higher lanes go through between frames
+                step = await self.run_in_lane("bulk", self.scheduler.call, "bulk", next, sweep, None)
+                if step is None:
+                    break
+                progress = self.autofocus_status = step
+                await self.broadcast_to_websocket_clients({"autofocus": progress})
+        except Exception as exc:
+            self.autofocus_status = {"state": "failed", "error": str(exc)}
+            await self.broadcast_to_websocket_clients({"autofocus": self.autofocus_status})
+            raise
+        finally:
+            # an aborted sweep (e.g. cancelled request) restores the defocus in the bulk lane,
+            # not whenever the garbage collector closes the generator
+            await self.run_in_lane("bulk", self.scheduler.call, "bulk", sweep.close)
+            self.autofocus_running = False
+        return progress
 
     def do_PUT_V1(self, command, json_content):
         """
@@ -315,9 +580,17 @@ class MicroscopeServerWithEvents:
         try:
             async for msg in ws:
                 if msg.type == WSMsgType.TEXT:
+                    subscription = None
                     if msg.data != 'close':
-                        log.warn('websocket connection received unsupported text message: "%s"' % msg.data)
-                    await ws.close()
+                        try:
+                            subscription = WebsocketSubscription.from_message(json.loads(msg.data))
+                        except ValueError as exc:
+                            log.warn('websocket connection received unsupported text message: "%s" (%s)' %
+                                     (msg.data, exc))
+                    if subscription is not None:
+                        await self.subscribe_websocket_client(ws, subscription)
+                    else:
+                        await ws.close()
                 elif msg.type == WSMsgType.PING:
                     pass
                     # log.debug('websocket connection received PING')
@@ -343,42 +616,135 @@ class MicroscopeServerWithEvents:
         async with self.clients_lock:
             # log.debug('number of clients before adding new client: %s ' %
             #       len(self.clients))
-            self.clients.add(ws)
+            # new clients get all changes until they subscribe otherwise
+            subscription = self.clients[ws] = WebsocketSubscription()
             log.debug('number of clients after adding new client: %s ' %
                   len(self.clients))
-        async with self.microscope_state_lock:
-            if self.microscope_state:
+            async with self.microscope_state_lock:
+                state = dict(self.microscope_state)
+            if state:
                 log.info('Sending microscope state to new client: %s :' %
-                      self.microscope_state)
-                await ws.send_json(self.microscope_state)
+                      state)
+                subscription.pending = state
+                await self.send_to_websocket_client(ws, subscription)
+
+    async def subscribe_websocket_client(self, ws, subscription):
+        """
+        Replace the subscription of a websocket client and send
+        the current values of the subscribed keys.
+        :param ws: the websocket of the client
+        :param subscription: the new subscription
+        :type subscription: WebsocketSubscription
+        """
+        async with self.clients_lock:
+            if ws not in self.clients:
+                return
+            self.clients[ws].cancel_flush()
+            self.clients[ws] = subscription
+            log.info('Websocket client subscribed: %s' % subscription)
+            async with self.microscope_state_lock:
+                state = subscription.select(self.microscope_state)
+            if state:
+                subscription.pending = state
+                await self.send_to_websocket_client(ws, subscription)
 
     async def remove_websocket_client(self, ws):
         async with self.clients_lock:
             # log.debug("number of clients before removing client: %s " %
             #       len(self.clients))
-            self.clients.remove(ws)
+            subscription = self.clients.pop(ws, None)
+            if subscription is not None:
+                subscription.cancel_flush()
             log.debug("number of clients after removing client: %s " %
                   len(self.clients))
 
     async def broadcast_to_websocket_clients(self, obj):
         """
-        Converts obj to JSON string and sends the string to all connected websocket clients.
-        :param obj: JSON-serializable object
+        Sends the changes in obj as JSON string to all connected websocket clients,
+        filtered and rate limited according to each client's subscription.
+        :param obj: JSON-serializable dict with changed values
         :return:
         """
         async with self.clients_lock:
-            for ws in self.clients:
-                # send object as JSON to websocket client
-                await ws.send_json(obj)
+            # the clients receive concurrently, a slow one does not hold up the others
+            # (clients failing to receive in time are dropped)
+            sends = []
+            for ws, subscription in list(self.clients.items()):
+                selected = subscription.select(obj)
+                if not selected:
+                    continue
+                subscription.pending.update(selected)
+                delay = subscription.min_interval - (time.monotonic() - subscription.last_sent)
+                if delay > 0:
+                    # rate cap reached: send accumulated changes later
+                    if subscription.flush_handle is None:
+                        subscription.flush_handle = asyncio.get_event_loop().call_later(
+                            delay, lambda ws=ws: asyncio.ensure_future(self.flush_websocket_client(ws)))
+                    continue
+                sends.append(self.send_to_websocket_client(ws, subscription))
+            if sends:
+                await asyncio.gather(*sends)
 
-    async def change_microscope_state(self, new_values):
+    async def flush_websocket_client(self, ws):
+        """
+        Send the changes held back by the rate cap of a websocket client.
+        :param ws: the websocket of the client
+        """
+        async with self.clients_lock:
+            subscription = self.clients.get(ws)
+            if subscription is None:
+                return
+            subscription.flush_handle = None
+            if subscription.pending:
+                await self.send_to_websocket_client(ws, subscription)
+
+    async def send_to_websocket_client(self, ws, subscription):
+        """
+        Send pending changes (mode "delta") or all subscribed values (mode "snapshot")
+        to a websocket client. The caller must hold the clients lock. A client which
+        disconnected or did not accept the message within WEBSOCKET_SEND_TIMEOUT is
+        dropped, the sender (e.g. an autofocus sweep) is not affected.
+        :return: whether the message was sent
+        """
+        if subscription.mode == "snapshot":
+            # pending events outside the polled state (e.g. autofocus progress) are kept
+            message = subscription.pending
+            message.update(subscription.select(self.microscope_state))
+        else:
+            message = subscription.pending
+        subscription.pending = dict()
+        subscription.last_sent = time.monotonic()
+        # send object as JSON to websocket client
+        try:
+            await asyncio.wait_for(ws.send_json(message), self.WEBSOCKET_SEND_TIMEOUT)
+        except (ConnectionError, RuntimeError, asyncio.TimeoutError) as exc:
+            log.info("Dropping websocket client after failed send: %r" % exc)
+            subscription.cancel_flush()
+            self.clients.pop(ws, None)
+            asyncio.ensure_future(ws.close())
+            return False
+        return True
+
+    async def change_microscope_state(self, new_values, timestamp=None, deadbands=None):
         """
         Change a set of entries in the microscope state
         and notify websocket clients in case of changes
         :param changes: A dict with command-result values
         :type changes: dict
+        :param timestamp: UNIX time of the poll (default: now) or dict with the
+                UNIX time of each value, used for the history
+        :type timestamp: float or dict
+        :param deadbands: Optional dict of Deadband instances by command. Values
+                within the deadband of the last published value are no change.
+        :type deadbands: dict
         :return:
         """
+        if deadbands is None:
+            deadbands = dict()
+        if timestamp is None:
+            timestamp = time.time()
+        # evicted samples are queued to the spill thread, the event loop does not write them
+        self.history.append(timestamp, new_values)
         changes = dict()
         async with self.microscope_state_lock:
             for command in new_values:
@@ -388,7 +754,8 @@ class MicroscopeServerWithEvents:
                     changes[command] = new_result
                     # update value
                     self.microscope_state[command] = new_result
-                elif new_result != self.microscope_state[command]:
+                elif _value_changed(self.microscope_state[command], new_result,
+                                    deadbands.get(command)):
                     # results differ: add new result to changes
                     changes[command] = new_result
                     # update value
@@ -401,9 +768,29 @@ class MicroscopeServerWithEvents:
     def reset_microscope_state(self):
         self.microscope_state = dict()
 
+    @web.middleware
+    async def timing_middleware(self, request, handler):
+        """
+        Time the phases of HTTP requests (see temscript.timing) for the Server-Timing
+        header and the slow request log. The handlers find the timing in request["timing"].
+        """
+        if request.path.startswith("/ws/"):
+            return await handler(request)
+        timing = request["timing"] = RequestTiming()
+        response = await handler(request)
+        if self.server_timing:
+            response.headers["Server-Timing"] = timing.header()
+        if self.slow_log is not None:
+            # send here to include the phase "send" in the log
+            with timing.phase("send"):
+                await response.prepare(request)
+                await response.write_eof()
+            self.slow_log.record(timing, request.method, request.path_qs, response.status)
+        return response
+
     def run_server(self):
         log.info("Starting HTTP+websocket server with events under host=%s, port=%s" % (self.host, self.port))
-        app = web.Application()
+        app = web.Application(middlewares=[self.timing_middleware])
         # add routes for
         # - HTTP-GET/PUT, e.g. http://127.0.0.1:8080/v1/projection_mode
         # - websocket connection ws://127.0.0.1:8080/ws/v1
@@ -418,23 +805,148 @@ class MicroscopeServerWithEvents:
         asyncio.ensure_future(runner.setup())
         loop = asyncio.get_event_loop()
         loop.run_until_complete(runner.setup())
-        site = web.TCPSite(runner)
+        site = web.TCPSite(runner, self.host, self.port)
         loop.run_until_complete(site.start())
+        report_startup_times(self.microscope, log.info)
+
+
+class WebsocketSubscription:
+    """
+    Selection of the change events a websocket client receives.
+
+    Clients subscribe by sending a JSON text message like
+        {"type": "subscribe", "keys": ["beam_blanked", "stem_magnification"],
+         "max_rate": 2.0, "mode": "delta"}
+    All entries besides "type" are optional.
+    :param keys: polled keys to receive (None: all keys)
+    :type keys iterable of str
+    :param max_rate: maximum number of messages per second (None: unlimited).
+                Changes arriving faster are merged and sent later.
+    :type max_rate float
+    :param mode: "delta" sends only the changed values, "snapshot" sends
+                the current values of all subscribed keys on each change
+    :type mode str
+    """
+    MODES = ("delta", "snapshot")
+
+    def __init__(self, keys=None, max_rate=None, mode="delta"):
+        if mode not in self.MODES:
+            raise ValueError("Unknown subscription mode: %s" % mode)
+        if max_rate is not None and max_rate <= 0:
+            raise ValueError("Invalid max_rate: %s" % max_rate)
+        if isinstance(keys, str):
+            raise ValueError("Subscription keys must be a list")
+        self.keys = frozenset(keys) if keys is not None else None
+        self.max_rate = max_rate
+        self.min_interval = 1.0 / max_rate if max_rate else 0.0
+        self.mode = mode
+        # changes held back by the rate cap
+        self.pending = dict()
+        # time.monotonic() of last message sent
+        self.last_sent = 0.0
+        # asyncio handle of scheduled delayed send
+        self.flush_handle = None
+
+    @classmethod
+    def from_message(cls, message):
+        """
+        Create subscription from decoded JSON message
+        :raises ValueError: if the message is no valid subscribe message
+        """
+        if not isinstance(message, dict) or message.get("type") != "subscribe":
+            raise ValueError("Not a subscribe message")
+        max_rate = message.get("max_rate")
+        return cls(keys=message.get("keys"),
+                   max_rate=float(max_rate) if max_rate is not None else None,
+                   mode=message.get("mode", "delta"))
+
+    def select(self, values):
+        """Return dict with the entries of values this client subscribed to"""
+        if self.keys is None:
+            return dict(values)
+        return dict((k, v) for k, v in values.items() if k in self.keys)
+
+    def cancel_flush(self):
+        if self.flush_handle is not None:
+            self.flush_handle.cancel()
+            self.flush_handle = None
+
+    def __str__(self):
+        keys = sorted(self.keys) if self.keys is not None else "all"
+        return "keys=%s, max_rate=%s, mode=%s" % (keys, self.max_rate, self.mode)
+
+
+class Deadband:
+    """
+    Change threshold for a polled value.
+
+    A numeric value counts as changed if it differs from the last published
+    value by more than max(absolute, relative * abs(last value)). Vectors
+    (lists, tuples) and dicts are compared element-wise and count as changed
+    if any element changed. Other values (strings, bools) are compared exactly.
+    :param absolute: absolute deadband (in units of the value)
+    :type absolute float
+    :param relative: deadband relative to the last published value
+    :type relative float
+    """
+    def __init__(self, absolute=0.0, relative=0.0):
+        if absolute < 0 or relative < 0:
+            raise ValueError("Deadbands must not be negative.")
+        self.absolute = float(absolute)
+        self.relative = float(relative)
+
+    def changed(self, old, new):
+        """Whether 'new' differs from 'old' by more than the deadband"""
+        if isinstance(new, dict):
+            if not isinstance(old, dict) or old.keys() != new.keys():
+                return True
+            return any(self.changed(old[key], new[key]) for key in new)
+        if isinstance(new, (list, tuple)):
+            if not isinstance(old, (list, tuple)) or len(old) != len(new):
+                return True
+            return any(self.changed(o, n) for o, n in zip(old, new))
+        if _is_number(old) and _is_number(new):
+            if math.isnan(old) or math.isnan(new):
+                return math.isnan(old) != math.isnan(new)
+            return abs(new - old) > max(self.absolute, self.relative * abs(old))
+        return new != old
+
+    def __repr__(self):
+        return "Deadband(absolute=%s, relative=%s)" % (self.absolute, self.relative)
+
+
+def _is_number(value):
+    """Whether value is an int or float (but not a bool)"""
+    return isinstance(value, (int, float)) and not isinstance(value, bool)
+
+
+def _value_changed(old, new, deadband=None):
+    """Compare old and new value of a polled command, using the deadband if given"""
+    if deadband is None:
+        return new != old
+    return deadband.changed(old, new)
 
 
 class MicroscopeException(Exception):
     """
-    Special exception class for returning HTTP status 204
+    Special exception class for returning HTTP status 404 (or 'status')
     """
-    def __init__(self, *args, **kw):
+    def __init__(self, *args, status=404, **kw):
         super(MicroscopeException, self).__init__(*args, **kw)
+        self.status = status
 
 class ArrayJSONEncoder(json.JSONEncoder):
     """
     Numpy array encoding JSON encoder
+
+    With frame_codec=True, arrays are compressed with the frame codec (see temscript.framecodec).
     """
     allowed_dtypes = {"INT8", "INT16", "INT32", "INT64", "UINT8", "UINT16", "UINT32", "UINT64", "FLOAT32", "FLOAT64"}
 
+    def __init__(self, *args, frame_codec=False, **kw):
+        self.frame_codec = frame_codec
+        super().__init__(*args, **kw)
+
     def default(self, obj):
         if isinstance(obj, np.ndarray):
             import sys, base64
@@ -450,13 +962,19 @@ class ArrayJSONEncoder(json.JSONEncoder):
             else:
                 endian = sys.byteorder.upper()
 
+            if self.frame_codec:
+                encoding, data = framecodec.ARRAY_ENCODING, framecodec.encode_frame(obj)
+            else:
+                encoding, data = "BASE64", obj
+            # width and height are the last two dimensions, "shape" gives all (e.g. stacks of frames)
             return {
-                'width': obj.shape[1],
-                'height': obj.shape[0],
+                'width': obj.shape[-1] if obj.ndim else 1,
+                'height': obj.shape[-2] if obj.ndim >= 2 else 1,
+                'shape': list(obj.shape),
                 'type': dtype_name,
                 'endianness': endian,
-                'encoding': "BASE64",
-                'data': base64.b64encode(obj).decode("ascii")
+                'encoding': encoding,
+                'data': base64.b64encode(data).decode("ascii")
             }
         return json.JSONEncoder.default(self, obj)
 
@@ -490,14 +1008,47 @@ class MicroscopeEventPublisher:
     :param polling_config: A configuration dict of
             methods and return types to poll.
             value is a tuple consisting of a conversion method
-            (e.g. "float()") and a scaling factor
-            (for int/float-types)
+            (e.g. "float()") and a Deadband instance or None
+            (None: every difference is a change). Numbers in
+            place of the deadband (formerly scaling factors)
+            are ignored.
+    :param poll_workers: Number of worker threads executing the
+            commands of a poll cycle in parallel (1: one after another).
+            The cycle runs off the event loop, so slow commands
+            do not block HTTP requests.
+    :param key_timeout: Time in seconds a command may take: a slower
+            command is left out of the cycle (and of following cycles,
+            until its call returned).
+    :param cycle_deadline: Time in seconds after which a cycle is committed
+            with the results available so far (default: the larger of
+            sleep_time and key_timeout).
     """
     def __init__(self, microscope_server,
-                 sleep_time, polling_config):
+                 sleep_time, polling_config,
+                 poll_workers=4, key_timeout=1.0, cycle_deadline=None):
         self.microscope_server = microscope_server
         self.sleep_time = sleep_time
         self.polling_config = polling_config
+        self.deadbands = dict((command, entry[1]) for command, entry in polling_config.items()
+                              if len(entry) > 1 and isinstance(entry[1], Deadband))
+        self.key_timeout = key_timeout
+        self.cycle_deadline = cycle_deadline if cycle_deadline is not None else max(sleep_time, key_timeout)
+        self._executor = ThreadPoolExecutor(max_workers=poll_workers,
+                                            thread_name_prefix="MicroscopePoll")
+        # commands whose call is running (holds the poll lane): command -> start time
+        self._in_flight = dict()
+        self._in_flight_lock = threading.Lock()
+        # calls of former cycles, which did not return yet (e.g. after a timeout): command -> future
+        self._outstanding = dict()
+        # start time of the latest published read per command (older reads are not published)
+        self._read_times = dict()
+        # cycle metrics, see stats()
+        self._cycles = 0
+        self._cycle_time_total = 0.0
+        self._cycle_time_max = 0.0
+        self._last_cycle = None
+        # running refresh tasks (referenced until done)
+        self._refresh_tasks = set()
 
         # the microscope state representation
         self.microscope_state = dict()
@@ -513,6 +1064,7 @@ class MicroscopeEventPublisher:
         if not self.is_started:
             log.debug("Starting server now...")
             self.is_started = True
+            self.microscope_server.event_publisher = self
             # configure polling task to check for Temscript changes periodically:
             self._task = asyncio.ensure_future(self._run())
 
@@ -522,8 +1074,12 @@ class MicroscopeEventPublisher:
         self.microscope_server.reset_microscope_state()
         if self.is_started:
             self.is_started = False
+            if self.microscope_server.event_publisher is self:
+                self.microscope_server.event_publisher = None
             # Stop task and await it stopped:
             self._task.cancel()
+            for task in list(self._refresh_tasks):
+                task.cancel()
 
     async def _run(self):
         log.info("Starting to poll for Temscripting changes with a polling time of %ss..." %
@@ -534,33 +1090,201 @@ class MicroscopeEventPublisher:
             # call polling function
             await self.polling_func()
 
-    async def check_for_microscope_changes(self):
-        #log.debug("checking for microscope changes...")
-        try:
-            changed = {}
-            all_results = dict()
-            for get_command in self.polling_config:
-                try:
-                    # execute get command
-                    # (here: imply parameterless command)
-                    result_raw = self.microscope_server.do_GET_V1(get_command,
+    def _poll_command(self, get_command):
+        """
+        Execute one configured GET command (in a worker thread)
+        :return: tuple of the start time of the call (monotonic and UNIX time)
+            and the converted result
+        """
+        # execute get command
+        # (here: imply parameterless command)
+        with self.microscope_server.scheduler.lane("poll"):
+            # in flight (see key_timeout) while holding the lane, not while waiting for it
+            started = time.monotonic()
+            timestamp = time.time()
+            with self._in_flight_lock:
+                self._in_flight[get_command] = started
+            try:
+                result_raw = self.microscope_server.do_GET_V1(get_command,
                                                               None)
-                    #log.debug("found %s=%s..." %
-                    #      (get_command, result_raw))
-                    casting_func = self.polling_config[get_command][0]
-                    result = casting_func(result_raw)
-                    # log.debug("Adding %s=%s to results..." %
-                    #        (get_command, result))
-                    all_results[get_command] = result
+            finally:
+                with self._in_flight_lock:
+                    self._in_flight.pop(get_command, None)
+        #log.debug("found %s=%s..." %
+        #      (get_command, result_raw))
+        casting_func = self.polling_config[get_command][0]
+        return started, timestamp, casting_func(result_raw)
+
+    def poll(self, commands, refresh=False):
+        """
+        Execute the given (configured) GET commands in the worker threads
+        and wait for them, at most until the cycle deadline.
+        Blocking: call from outside the event loop.
+        :param refresh: Whether the commands are read out of turn: they are
+                 read after running calls of the same command instead of
+                 being skipped (unless these exceeded the key timeout)
+        :return: tuple of a dict with the converted results of the
+                 successful commands, dicts with the start times of
+                 their calls (monotonic and UNIX time) and a dict with
+                 cycle metrics
+        """
+        start = time.monotonic()
+        deadline = start + self.cycle_deadline
+        futures = dict()
+        skipped = []
+        with self._in_flight_lock:
+            hung = set(command for command, started in self._in_flight.items()
+                       if start >= started + self.key_timeout)
+        for get_command in commands:
+            outstanding = self._outstanding.get(get_command)
+            if get_command in hung or (not refresh and outstanding is not None and not outstanding.done()):
+                # a former call did not return yet: do not queue another one
+                skipped.append(get_command)
+            else:
+                future = self._executor.submit(self._poll_command, get_command)
+                futures[future] = get_command
+                if not refresh:
+                    self._outstanding[get_command] = future
+        all_results = dict()
+        read_times = dict()
+        timestamps = dict()
+        failed = []
+        timed_out = []
+        pending = set(futures)
+        while pending:
+            now = time.monotonic()
+            with self._in_flight_lock:
+                expiries = [self._in_flight[futures[f]] + self.key_timeout
+                            for f in pending if futures[f] in self._in_flight]
+            wake = min(expiries + [deadline])
+            done, pending = wait(pending, timeout=max(0.0, wake - now), return_when=FIRST_COMPLETED)
+            for future in done:
+                get_command = futures[future]
+                try:
+                    read_times[get_command], timestamps[get_command], all_results[get_command] = future.result()
                 except Exception as exc:
-                    log.exception("TEMScripting method '{}' failed "
+                    failed.append(get_command)
+                    log.exception("TEMScripting method '%s' failed "
                         "while polling: %s" % (get_command, exc))
-            await self.microscope_server.change_microscope_state(all_results)
+            now = time.monotonic()
+            with self._in_flight_lock:
+                expired = set(f for f in pending if now >= deadline or
+                              (futures[f] in self._in_flight and
+                               now >= self._in_flight[futures[f]] + self.key_timeout))
+            for future in expired:
+                # cancels queued calls, running calls are ignored when they return
+                future.cancel()
+                timed_out.append(futures[future])
+            pending -= expired
+        cycle_time = time.monotonic() - start
+        if timed_out or skipped:
+            log.warning("Polling timed out for %s, skipped %s (still running)" %
+                        (sorted(timed_out), sorted(skipped)))
+        metrics = {
+            "cycle_time": cycle_time,
+            "commands": len(futures) + len(skipped),
+            "failed": sorted(failed),
+            "timed_out": sorted(timed_out),
+            "skipped": sorted(skipped),
+        }
+        return all_results, read_times, timestamps, metrics
+
+    async def _poll_and_publish(self, commands, refresh=False):
+        """
+        Run poll() off the event loop and commit its results, each with the time
+        of its own read. Results read before the latest published read of their
+        command (e.g. a cycle read overtaken by a refresh after a PUT) are dropped.
+        """
+        loop = asyncio.get_event_loop()
+        all_results, read_times, timestamps, metrics = await loop.run_in_executor(
+            None, self.poll, list(commands), refresh)
+        fresh = dict()
+        for command, value in all_results.items():
+            if read_times[command] >= self._read_times.get(command, read_times[command]):
+                self._read_times[command] = read_times[command]
+                fresh[command] = value
+        await self.microscope_server.change_microscope_state(fresh, timestamp=timestamps,
+                                                             deadbands=self.deadbands)
+        return metrics
+
+    async def check_for_microscope_changes(self):
+        #log.debug("checking for microscope changes...")
+        try:
+            metrics = await self._poll_and_publish(self.polling_config)
+            self._cycles += 1
+            self._cycle_time_total += metrics["cycle_time"]
+            self._cycle_time_max = max(self._cycle_time_max, metrics["cycle_time"])
+            self._last_cycle = metrics
+            if metrics["cycle_time"] > self.sleep_time:
+                log.info("Poll cycle took %.3fs, longer than pollsleep %.3fs" %
+                         (metrics["cycle_time"], self.sleep_time))
 
         except Exception as exc:
             #traceback.print_exc()
             log.exception("Polling failed: %s" % exc)
 
+    async def refresh(self, commands):
+        """
+        Poll some commands out of turn (e.g. after a PUT changed them) and publish
+        their changes. Commands not in the polling configuration are ignored.
+        :param commands: iterable of GET commands
+        """
+        commands = [command for command in commands if command in self.polling_config]
+        if not commands:
+            return
+        try:
+            await self._poll_and_publish(commands, refresh=True)
+        except Exception as exc:
+            log.exception("Refreshing %s failed: %s" % (commands, exc))
+
+    def schedule_refresh(self, commands):
+        """
+        Start refresh(commands) as a task of its own, so the caller (e.g. a
+        PUT handler) does not wait for the readback and the broadcast.
+        """
+        task = asyncio.ensure_future(self.refresh(commands))
+        self._refresh_tasks.add(task)
+        task.add_done_callback(self._refresh_tasks.discard)
+
+    def stats(self):
+        """
+        Return dict with poll cycle metrics: "cycles", "sleep_time", "mean_cycle_time",
+        "max_cycle_time" (seconds) and "last_cycle" (cycle_time, commands and the
+        commands that "failed", "timed_out" or were "skipped").
+        """
+        return {
+            "cycles": self._cycles,
+            "sleep_time": self.sleep_time,
+            "mean_cycle_time": self._cycle_time_total / self._cycles if self._cycles else None,
+            "max_cycle_time": self._cycle_time_max if self._cycles else None,
+            "last_cycle": self._last_cycle,
+        }
+
+def create_history(config):
+    """
+    Create the history of polled values as configured
+    by "history_capacity", "history_spill_dir" and
+    "history_spill_max_bytes"
+    :param config: configuration dict (see configure_server())
+    :return: TelemetryHistory instance
+    """
+    spill_dir = config.get("history_spill_dir") or None
+    return TelemetryHistory(capacity=config.get("history_capacity", 86400),
+                            spill_dir=spill_dir,
+                            spill_max_bytes=config.get("history_spill_max_bytes", 64 << 20))
+
+def create_slow_log(config):
+    """
+    Create the slow request log as configured by "slow_log"
+    (path, "" for none) and "slow_threshold" (seconds)
+    :param config: configuration dict (see configure_server())
+    :return: SlowRequestLog instance or None
+    """
+    path = config.get("slow_log") or None
+    if path is None:
+        return None
+    return SlowRequestLog(path, threshold=config.get("slow_threshold", 1.0))
+
 def configure_server():
     """
     Configure logger, configuration file under %localappdata% and
@@ -649,6 +1373,30 @@ def configure_server():
         polling_sleep = config["pollsleep"]
     log.debug("Starting server with polling sleep of %s s", polling_sleep)
 
+    # history of polled values: samples kept in memory per key and
+    # optional directory for samples pushed out of memory ("" for none)
+    if "history_capacity" not in config:
+        config["history_capacity"] = 86400
+    if "history_spill_dir" not in config:
+        config["history_spill_dir"] = ""
+    # size in bytes at which a spill file is rotated (the previous one is kept)
+    if "history_spill_max_bytes" not in config:
+        config["history_spill_max_bytes"] = 64 << 20
+    # time in seconds identical GET requests share one microscope call
+    if "coalesce_window" not in config:
+        config["coalesce_window"] = 0.05
+    # Server-Timing header and log of requests slower than
+    # slow_threshold seconds (log file path, "" for none)
+    if "server_timing" not in config:
+        config["server_timing"] = False
+    if "slow_log" not in config:
+        config["slow_log"] = ""
+    if "slow_threshold" not in config:
+        config["slow_threshold"] = 1.0
+    # maximum number of frames accumulated per acquisition request
+    if "max_frames" not in config:
+        config["max_frames"] = 1000
+
     # save config file (containing defaults for new parameters)
     config.saveConfigFile()
     # return resulting values (command line arguments win over config file)
@@ -664,29 +1412,29 @@ if __name__ == '__main__':
     # define all TEMScripting methods which should be polled
     # during one polling event via the web server.
     # value is a tuple consisting of a conversion method
-    # (e.g. "float()") and a scaling factor (for int/float)
-    # for the result of the method
+    # (e.g. "float()") and a deadband (None: any difference
+    # is a change) for the result of the method
     tem_scripting_method_config = {
         # for meta data key 'condenser.mode'
-        "instrument_mode_string": (str, 1),     # "TEM"/"STEM"
-        "illumination_mode":      (int, 1),    # e.g., 0 ("NANOPROBE"), 1: ("MICROPROBE")
-        "df_mode_string": (str, 1),             # e.g., "CARTESIAN", "OFF"
-        "spot_size_index": (int, 1),            # e.g., 3
-        "condenser_mode_string": (str, 1),      # e.g., "PROBE"
-        "beam_blanked": (bool, 1),              # True, False
+        "instrument_mode_string": (str, None),                       # "TEM"/"STEM"
+        "illumination_mode": (int, None),                            # e.g., 0 ("NANOPROBE"), 1: ("MICROPROBE")
+        "df_mode_string": (str, None),                               # e.g., "CARTESIAN", "OFF"
+        "spot_size_index": (int, None),                              # e.g., 3
+        "condenser_mode_string": (str, None),                        # e.g., "PROBE"
+        "beam_blanked": (bool, None),                                # True, False
         # for meta data key 'electron_gun.voltage'
-        "voltage": (float, 1),                  # e.g., "200"
+        "voltage": (float, Deadband(relative=1e-6)),                 # e.g., "200"
         # for backend key 'microscope.elementValues.HTOffset'
-        "voltage_offset": (float, 1),           # e.g., "0.1"
+        "voltage_offset": (float, Deadband(absolute=1e-3)),          # e.g., "0.1"
         # for meta data key "objective.mode -> projector.camera_length"
-        "indicated_camera_length": (float, 1),  # e.g., "0.028999", in meters
+        "indicated_camera_length": (float, Deadband(relative=1e-3)), # e.g., "0.028999", in meters
         # for meta data key "objective.mode -> projector.magnification"
-        "indicated_magnification": (float, 1),  # e.g., 200000.0
+        "indicated_magnification": (float, Deadband(relative=1e-3)), # e.g., 200000.0
         # for meta data key "objective.mode -> projector.mode"
-        "projection_mode_string": (str, 1),     # e.g., "SA"
-        "projection_mode_type_string": (str, 1),# e.g., "IMAGING"
+        "projection_mode_string": (str, None),                       # e.g., "SA"
+        "projection_mode_type_string": (str, None),                  # e.g., "IMAGING"
         # for meta data key "objective.mode -> scan_driver.magnification"
-        "stem_magnification": (float, 1),       # e.g., "6000"
+        "stem_magnification": (float, Deadband(relative=1e-3)),      # e.g., "6000"
     }
 
     log.info("Using HTTP+Websocket port %s..." % port)
@@ -694,10 +1442,15 @@ if __name__ == '__main__':
     # startup HTTP+Websocket server
     from temscript import Microscope
     #from microscope import Microscope
-    microscope = Microscope()
+    microscope = Microscope(warm_up=True)
     host="0.0.0.0"
     server = MicroscopeServerWithEvents(microscope=microscope,
-                                        host=host, port=port)
+                                        host=host, port=port,
+                                        history=create_history(config),
+                                        coalesce_window=config["coalesce_window"],
+                                        server_timing=config["server_timing"],
+                                        slow_log=create_slow_log(config),
+                                        max_frames=config["max_frames"])
     microscope_event_publisher = MicroscopeEventPublisher(server, polling_sleep,
                                         tem_scripting_method_config)
     # configure asyncio task for web server
@@ -0,0 +1,143 @@
+"""
+Timing of requests by phase, for the "Server-Timing" header and the slow request log.
+
+The servers create a :class:`RequestTiming` per request and activate it in the thread handling the
+request. The code on the way (scheduler, encoders) adds its phases with :func:`phase`, which does
+nothing without active timing. Phases are exclusive: the time of a nested phase is not counted in
+the enclosing phase (e.g. "compress" of the frames during "encode").
+
+Phases (see :data:`PHASES`): "queue" (wait for the microscope), "microscope" (call of the microscope),
+"encode" (JSON, base64 or pickle), "compress" (gzip or frame codec) and "send" (writing the response
+body). The header is sent before the body, so "send" appears only in the slow request log.
+"""
+from __future__ import division, print_function
+from contextlib import contextmanager
+import json
+import threading
+import time
+
+PHASES = ("queue", "microscope", "encode", "compress", "send")
+
+_local = threading.local()
+
+
+class RequestTiming(object):
+    """Durations (seconds) of the phases of one request"""
+    def __init__(self):
+        self.start = time.time()
+        self.phases = {}
+        self._stack = []
+
+    @contextmanager
+    def phase(self, name):
+        """Context manager adding its duration (without nested phases) to phase 'name'"""
+        entry = [name, time.time(), 0.0]
+        self._stack.append(entry)
+        try:
+            yield
+        finally:
+            self._stack.pop()
+            duration = time.time() - entry[1]
+            self.phases[name] = self.phases.get(name, 0.0) + duration - entry[2]
+            if self._stack:
+                self._stack[-1][2] += duration
+
+    @contextmanager
+    def activate(self):
+        """Context manager making this the timing of the current thread (see phase())"""
+        previous = getattr(_local, "timing", None)
+        _local.timing = self
+        try:
+            yield self
+        finally:
+            _local.timing = previous
+
+    def bind(self, func):
+        """Return func, which runs with this timing activated (e.g. in a worker thread)"""
+        def bound(*args, **kw):
+            with self.activate():
+                return func(*args, **kw)
+        return bound
+
+    def elapsed(self):
+        """Seconds since the start of the request"""
+        return time.time() - self.start
+
+    def current_phases(self):
+        """Durations of the phases, including the time so far of running phases"""
+        phases = dict(self.phases)
+        now = time.time()
+        nested = 0.0
+        for name, start, child in reversed(self._stack):
+            phases[name] = phases.get(name, 0.0) + now - start - child - nested
+            nested = now - start
+        return phases
+
+    def header(self):
+        """
+        Value of the Server-Timing header (durations in milliseconds). Phases still running
+        (e.g. a PUT answered during its microscope call) are included with their time so far.
+        """
+        phases = self.current_phases()
+        entries = ["%s;dur=%.3f" % (name, phases[name] * 1e3) for name in PHASES if name in phases]
+        entries.append("total;dur=%.3f" % (self.elapsed() * 1e3))
+        return ", ".join(entries)
+
+
+@contextmanager
+def phase(name):
+    """Add duration to phase 'name' of the current timing (if any)"""
+    timing = getattr(_local, "timing", None)
+    if timing is None:
+        yield
+    else:
+        with timing.phase(name):
+            yield
+
+
+def parse_server_timing(value):
+    """
+    Parse value of a Server-Timing header.
+
+    :returns: dict metric name -> duration in seconds (metrics without duration are left out)
+    """
+    result = {}
+    for entry in (value or "").split(","):
+        fields = [field.strip() for field in entry.split(";")]
+        for field in fields[1:]:
+            if field.startswith("dur="):
+                try:
+                    result[fields[0]] = float(field[4:]) * 1e-3
+                except ValueError:
+                    pass
+    return result
+
+
+class SlowRequestLog(object):
+    """
+    Log of slow requests, one JSON object per line with "time" (UNIX time of the start),
+    "method", "path", "status", "total" and the phases (seconds).
+
+    :param path: Path of the log file (appended)
+    :param threshold: Requests taking at least 'threshold' seconds are logged
+    """
+    def __init__(self, path, threshold=1.0):
+        self.threshold = float(threshold)
+        self._file = open(path, "a")
+        self._lock = threading.Lock()
+
+    def record(self, timing, method, path, status):
+        """Log the request, if it was slow"""
+        total = timing.elapsed()
+        if total < self.threshold:
+            return
+        entry = {"time": timing.start, "method": method, "path": path, "status": status, "total": total}
+        entry.update(timing.phases)
+        line = json.dumps(entry, sort_keys=True) + "\n"
+        with self._lock:
+            self._file.write(line)
+            self._file.flush()
+
+    def close(self):
+        with self._lock:
+            self._file.close()
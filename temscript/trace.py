@@ -0,0 +1,250 @@
+"""
+Recording and replay of microscope calls.
+
+:class:`TracingMicroscope` records every call of a microscope-like object (method, arguments, result
+and latency) into a trace file, e.g. in the server of an instrument (``temscript-server --trace FILE``).
+:func:`replay` issues the recorded calls again, with the recorded timing and concurrency, against
+another microscope-like object: a :class:`NullMicroscope` emulating the recorded latencies (see
+:func:`recorded_latency`) or a :class:`RemoteMicroscope` connected to a server under test.
+
+A trace file consists of the magic b"TTRC" followed by RPC frames (see :mod:`temscript.rpc`): a
+header (dict with "version" and the UNIX timestamp "start") and one record per call (tuple of
+start and duration in seconds, thread id, method, args, kwargs, status and result). The status
+is "ok" or the exception type name, then the result is the message. Arrays with more than
+:data:`MAX_TRACED_ARRAY_SIZE` elements (frames) are replaced by descriptors of their dtype and
+shape. Files ending in ".gz" are compressed.
+"""
+from __future__ import division, print_function
+from collections import namedtuple
+import threading
+import time
+import numpy as np
+
+from .rpc import encode, decode, frame, read_frame
+
+MAGIC = b"TTRC"
+VERSION = 1
+
+# Larger arrays are recorded by dtype and shape only
+MAX_TRACED_ARRAY_SIZE = 64
+
+# Methods which are not recorded (no calls of the microscope)
+UNTRACED_METHODS = {"release_images", "wait_warm_up"}
+
+TraceRecord = namedtuple("TraceRecord", ("start", "duration", "thread", "method", "args", "kwargs",
+                                         "status", "result"))
+
+
+def _open(path, mode):
+    if path.endswith(".gz"):
+        import gzip
+        return gzip.open(path, mode)
+    return open(path, mode)
+
+
+def _summarize(value):
+    """Replace large arrays in value by descriptors"""
+    if isinstance(value, np.ndarray) and value.size > MAX_TRACED_ARRAY_SIZE:
+        return {"__array__": value.dtype.str, "shape": list(value.shape)}
+    elif isinstance(value, (tuple, list)):
+        return type(value)(_summarize(item) for item in value)
+    elif isinstance(value, dict):
+        return dict((key, _summarize(item)) for key, item in value.items())
+    return value
+
+
+def _restore(value):
+    """Replace array descriptors in value by (zero) arrays"""
+    if isinstance(value, dict):
+        if "__array__" in value:
+            return np.zeros(value["shape"], dtype=value["__array__"])
+        return dict((key, _restore(item)) for key, item in value.items())
+    elif isinstance(value, (tuple, list)):
+        return type(value)(_restore(item) for item in value)
+    return value
+
+
+class TraceWriter(object):
+    """
+    Writes trace records to file 'path' (thread-safe). Each record is flushed,
+    so the trace of an aborted server is complete.
+    """
+    def __init__(self, path):
+        self._file = _open(path, "wb")
+        self._lock = threading.Lock()
+        self.start = time.time()
+        self._file.write(MAGIC + frame(encode({"version": VERSION, "start": self.start})))
+        self._file.flush()
+
+    def write(self, record):
+        """Write TraceRecord (values are summarized, see MAX_TRACED_ARRAY_SIZE)"""
+        record = tuple(_summarize(value) for value in record)
+        try:
+            data = frame(encode(record))
+        except TypeError:
+            # values of other types are recorded by their representation
+            data = frame(encode(record[:4] + tuple(repr(value) for value in record[4:6]) + record[6:7] +
+                                (repr(record[7]),)))
+        with self._lock:
+            self._file.write(data)
+            self._file.flush()
+
+    def close(self):
+        with self._lock:
+            self._file.close()
+
+
+def read_trace(path):
+    """
+    Read trace file.
+
+    :returns: tuple (header dict, list of TraceRecord in order of their start)
+    """
+    with _open(path, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError("Not a trace file: %s" % path)
+        payload = read_frame(f)
+        if payload is None:
+            raise ValueError("Truncated trace file: %s" % path)
+        header = decode(payload)
+        if header.get("version") != VERSION:
+            raise ValueError("Unsupported trace version: %s" % header.get("version"))
+        records = []
+        while True:
+            try:
+                payload = read_frame(f)
+            except EOFError:
+                # gzip file of an aborted server
+                break
+            if payload is None:
+                break
+            records.append(TraceRecord(*decode(payload)))
+    records.sort(key=lambda record: record.start)
+    return header, records
+
+
+class TracingMicroscope(object):
+    """
+    Proxy of a microscope-like object, which records the calls of its public methods
+    (except :data:`UNTRACED_METHODS`) by a :class:`TraceWriter`.
+
+    :param microscope: Microscope-like object
+    :param writer: TraceWriter (or path of trace file)
+    """
+    def __init__(self, microscope, writer):
+        if not isinstance(writer, TraceWriter):
+            writer = TraceWriter(writer)
+        self._microscope = microscope
+        self._writer = writer
+        self._methods = {}
+
+    def __getattr__(self, name):
+        attr = getattr(self._microscope, name)
+        if name.startswith("_") or name in UNTRACED_METHODS or not callable(attr):
+            return attr
+        method = self._methods.get(name)
+        if method is None:
+            method = self._methods[name] = self._traced(name, attr)
+        return method
+
+    def _traced(self, name, func):
+        writer = self._writer
+
+        def traced(*args, **kw):
+            start = time.time()
+            try:
+                result = func(*args, **kw)
+            except Exception as exc:
+                end = time.time()
+                writer.write(TraceRecord(start - writer.start, end - start, threading.current_thread().ident,
+                                         name, args, kw, type(exc).__name__, str(exc)))
+                raise
+            end = time.time()
+            writer.write(TraceRecord(start - writer.start, end - start, threading.current_thread().ident,
+                                     name, args, kw, "ok", result))
+            return result
+        traced.__name__ = name
+        traced.__doc__ = func.__doc__
+        return traced
+
+    def close_trace(self):
+        """Close the trace file"""
+        self._writer.close()
+
+
+def recorded_latency(records):
+    """
+    Mean duration of the successful calls per method, e.g. for ``NullMicroscope(latency=...)``.
+
+    :returns: dict method name -> seconds
+    """
+    totals = {}
+    for record in records:
+        if record.status == "ok":
+            count, total = totals.get(record.method, (0, 0.0))
+            totals[record.method] = count + 1, total + record.duration
+    return dict((method, total / count) for method, (count, total) in totals.items())
+
+
+def replay(records, microscope, speed=1.0):
+    """
+    Issue the recorded calls against microscope: the calls of each recorded thread in
+    their own thread, each call at its recorded start (divided by 'speed'), or as soon
+    as the previous call of its thread returned.
+
+    :param records: Sequence of TraceRecord (see read_trace())
+    :param microscope: Microscope-like object, or callable creating one for each replay
+        thread (for clients which are not thread-safe, e.g. RemoteMicroscope with HTTP)
+    :param speed: Factor of the replay speed (0: issue each call as soon as possible)
+    :returns: dict method name -> dict with "calls", "errors", "recorded_mean",
+        "mean", "max" (durations in seconds) and "lag_max" (seconds the start of
+        a call was later than recorded)
+    """
+    threads = {}
+    for record in records:
+        threads.setdefault(record.thread, []).append(record)
+    results = []
+    results_lock = threading.Lock()
+
+    def run(calls, t0):
+        target = microscope() if callable(microscope) else microscope
+        release_images = getattr(target, "release_images", None)
+        for record in calls:
+            if speed > 0:
+                delay = t0 + record.start / speed - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+            start = time.time()
+            lag = start - t0 - record.start / speed if speed > 0 else 0.0
+            ok = True
+            try:
+                result = getattr(target, record.method)(*_restore(record.args), **_restore(record.kwargs))
+                if record.method in ("acquire", "acquire_stack") and release_images is not None:
+                    release_images(result)
+            except Exception:
+                ok = False
+            with results_lock:
+                results.append((record, time.time() - start, lag, ok))
+
+    t0 = time.time()
+    workers = [threading.Thread(target=run, args=(calls, t0)) for calls in threads.values()]
+    for worker in workers:
+        worker.daemon = True
+        worker.start()
+    for worker in workers:
+        worker.join()
+
+    stats = {}
+    for record, duration, lag, ok in results:
+        entry = stats.setdefault(record.method, {"calls": 0, "errors": 0, "recorded_mean": 0.0, "mean": 0.0,
+                                                 "max": 0.0, "lag_max": 0.0})
+        entry["calls"] += 1
+        entry["errors"] += 0 if ok else 1
+        entry["recorded_mean"] += record.duration
+        entry["mean"] += duration
+        entry["max"] = max(entry["max"], duration)
+        entry["lag_max"] = max(entry["lag_max"], lag)
+    for entry in stats.values():
+        entry["recorded_mean"] /= entry["calls"]
+        entry["mean"] /= entry["calls"]
+    return stats